@@ -27,7 +27,9 @@ static std::map<OperationStatus, std::string> OperationStatusMap = {
 /**
  * Every operation instance should have a globally unique id
  */
-AsyncRPCOperation::AsyncRPCOperation() : error_code_(0), error_message_() {
+AsyncRPCOperation::AsyncRPCOperation() : error_code_(0), error_message_(),
+        priority_(OperationPriority::NORMAL), cancel_requested_(false),
+        queued_time_(std::chrono::system_clock::now()), started_(false), stopped_(false) {
     // Set a unique reference for each operation
     boost::uuids::uuid uuid = uuidgen();
     id_ = "opid-" + boost::uuids::to_string(uuid);
@@ -37,7 +39,9 @@ AsyncRPCOperation::AsyncRPCOperation() : error_code_(0), error_message_() {
 
 AsyncRPCOperation::AsyncRPCOperation(const AsyncRPCOperation& o) :
         id_(o.id_), creation_time_(o.creation_time_), state_(o.state_.load()),
-        start_time_(o.start_time_), end_time_(o.end_time_),
+        priority_(o.priority_.load()), cancel_requested_(o.cancel_requested_.load()),
+        queued_time_(o.queued_time_), start_time_(o.start_time_), end_time_(o.end_time_),
+        started_(o.started_), stopped_(o.stopped_),
         error_code_(o.error_code_), error_message_(o.error_message_),
         result_(o.result_)
 {
@@ -47,8 +51,13 @@ AsyncRPCOperation& AsyncRPCOperation::operator=( const AsyncRPCOperation& other
     this->id_ = other.id_;
     this->creation_time_ = other.creation_time_;
     this->state_.store(other.state_.load());
+    this->priority_.store(other.priority_.load());
+    this->cancel_requested_.store(other.cancel_requested_.load());
+    this->queued_time_ = other.queued_time_;
     this->start_time_ = other.start_time_;
     this->end_time_ = other.end_time_;
+    this->started_ = other.started_;
+    this->stopped_ = other.stopped_;
     this->error_code_ = other.error_code_;
     this->error_message_ = other.error_message_;
     this->result_ = other.result_;
@@ -60,9 +69,11 @@ AsyncRPCOperation::~AsyncRPCOperation() {
 }
 
 /**
- * Override this cancel() method if you can interrupt main() when executing.
+ * Cancel a queued operation. An executing operation is asked to stop, which
+ * it honors at its next call to throw_if_cancel_requested().
  */
 void AsyncRPCOperation::cancel() {
+    cancel_requested_.store(true);
     if (isReady()) {
         set_state(OperationStatus::CANCELLED);
     }
@@ -74,6 +85,7 @@ void AsyncRPCOperation::cancel() {
 void AsyncRPCOperation::start_execution_clock() {
     std::lock_guard<std::mutex> guard(lock_);
     start_time_ = std::chrono::system_clock::now();
+    started_ = true;
 }
 
 /**
@@ -82,6 +94,7 @@ void AsyncRPCOperation::start_execution_clock() {
 void AsyncRPCOperation::stop_execution_clock() {
     std::lock_guard<std::mutex> guard(lock_);
     end_time_ = std::chrono::system_clock::now();
+    stopped_ = true;
 }
 
 /**
@@ -155,7 +168,7 @@ UniValue AsyncRPCOperation::getStatus() const {
     obj.push_back(Pair("id", this->id_));
     obj.push_back(Pair("status", OperationStatusMap[status]));
     obj.push_back(Pair("creation_time", this->creation_time_));
-    // TODO: Issue #1354: There may be other useful metadata to return to the user.
+    obj.push_back(Pair("priority", getPriority() == OperationPriority::LOW ? "low" : "normal"));
     UniValue err = this->getError();
     if (!err.isNull()) {
         obj.push_back(Pair("error", err.get_obj()));
@@ -163,11 +176,16 @@ UniValue AsyncRPCOperation::getStatus() const {
     UniValue result = this->getResult();
     if (!result.isNull()) {
         obj.push_back(Pair("result", result));
+    }
 
-        // Include execution time for successful operation
-        std::chrono::duration<double> elapsed_seconds = end_time_ - start_time_;
+    // Time spent waiting in the queue, and executing so far or in total
+    std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
+    std::lock_guard<std::mutex> guard(lock_);
+    std::chrono::duration<double> queued_seconds = (started_ ? start_time_ : now) - queued_time_;
+    obj.push_back(Pair("queued_secs", queued_seconds.count()));
+    if (started_) {
+        std::chrono::duration<double> elapsed_seconds = (stopped_ ? end_time_ : now) - start_time_;
         obj.push_back(Pair("execution_secs", elapsed_seconds.count()));
-
     }
     return obj;
 }
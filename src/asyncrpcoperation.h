@@ -14,6 +14,8 @@
 #include <thread>
 #include <utility>
 #include <future>
+#include <mutex>
+#include <stdexcept>
 
 #include <univalue.h>
 
@@ -37,6 +39,20 @@ typedef enum class operationStateEnum {
     SUCCESS
 } OperationStatus;
 
+// Operations of a higher priority class are started first. LOW is meant for
+// bulk work (large payouts, consolidations) that should not delay the rest.
+typedef enum class operationPriorityEnum {
+    NORMAL = 0,
+    LOW,
+    NUM_PRIORITIES
+} OperationPriority;
+
+// Thrown by an executing operation that stops because it was asked to cancel.
+class AsyncRPCOperationCancelled : public std::runtime_error {
+public:
+    AsyncRPCOperationCancelled() : std::runtime_error("operation cancelled") {}
+};
+
 class AsyncRPCOperation {
 public:
     AsyncRPCOperation();
@@ -45,7 +61,9 @@ public:
     // You must implement this method in your subclass.
     virtual void main();
 
-    // Override this method if you can interrupt execution of main() in your subclass.
+    // Cancels the operation if it has not started yet. An executing operation
+    // is only asked to stop; main() may honor that at its own checkpoints by
+    // calling throw_if_cancel_requested().
     void cancel();
     
     // Getters and setters
@@ -62,6 +80,24 @@ public:
         return creation_time_;
     }
 
+    OperationPriority getPriority() const {
+        return priority_.load();
+    }
+
+    void setPriority(OperationPriority priority) {
+        priority_.store(priority);
+    }
+
+    // Operations with the same non-empty input source may pick the same
+    // inputs, so the queue never executes two of them at once.
+    virtual std::string getInputSource() const {
+        return "";
+    }
+
+    bool isCancelRequested() const {
+        return cancel_requested_.load();
+    }
+
     // Override this method to add data to the default status object.
     virtual UniValue getStatus() const;
 
@@ -114,11 +150,21 @@ protected:
     int error_code_;
     std::string error_message_;
     std::atomic<OperationStatus> state_;
-    std::chrono::time_point<std::chrono::system_clock> start_time_, end_time_;  
+    std::atomic<OperationPriority> priority_;
+    std::atomic<bool> cancel_requested_;
+    std::chrono::time_point<std::chrono::system_clock> queued_time_, start_time_, end_time_;
+    bool started_, stopped_;
 
     void start_execution_clock();
     void stop_execution_clock();
 
+    // Throws AsyncRPCOperationCancelled once cancel() has been called.
+    void throw_if_cancel_requested() const {
+        if (isCancelRequested()) {
+            throw AsyncRPCOperationCancelled();
+        }
+    }
+
     void set_state(OperationStatus state) {
         this->state_.store(state);
     }
@@ -4,8 +4,38 @@
 
 #include "asyncrpcqueue.h"
 
+#ifdef ENABLE_MINING
+#include "chainparams.h"
+#include "miner.h"
+#include "util.h"
+#endif
+
 static std::atomic<size_t> workerCounter(0);
 
+// Operations executing on any worker. Proving is CPU bound, so the internal
+// miner is stopped while there are any, and started again with the -gen
+// settings once the last one finishes.
+static std::mutex executingLock;
+static size_t executingCount = 0;
+
+static void BeginExecutingOperation() {
+    std::lock_guard<std::mutex> guard(executingLock);
+    if (executingCount++ == 0) {
+#ifdef ENABLE_MINING
+        GenerateBitcoins(false, 0, Params());
+#endif
+    }
+}
+
+static void EndExecutingOperation() {
+    std::lock_guard<std::mutex> guard(executingLock);
+    if (--executingCount == 0) {
+#ifdef ENABLE_MINING
+        GenerateBitcoins(GetBoolArg("-gen", false), GetArg("-genproclimit", 1), Params());
+#endif
+    }
+}
+
 /**
  * Static method to return the shared/default queue.
  */
@@ -15,7 +45,7 @@ shared_ptr<AsyncRPCQueue> AsyncRPCQueue::sharedInstance() {
     return q;
 }
 
-AsyncRPCQueue::AsyncRPCQueue() : closed_(false), finish_(false) {
+AsyncRPCQueue::AsyncRPCQueue() : closed_(false), finish_(false), active_() {
 }
 
 AsyncRPCQueue::~AsyncRPCQueue() {
@@ -28,46 +58,98 @@ AsyncRPCQueue::~AsyncRPCQueue() {
 void AsyncRPCQueue::run(size_t workerId) {
 
     while (true) {
-        AsyncRPCOperationId key;
         std::shared_ptr<AsyncRPCOperation> operation;
+        std::string source;
+        int priority = 0;
         {
             std::unique_lock<std::mutex> guard(lock_);
-            while (operation_id_queue_.empty() && !isClosed() && !isFinishing()) {
-                this->condition_.wait(guard);
-            }
+            while (true) {
+                // Exit if the queue is closing.
+                if (isClosed()) {
+                    for (std::deque<AsyncRPCOperationId> & queue : operation_id_queue_) {
+                        queue.clear();
+                    }
+                    return;
+                }
 
-            // Exit if the queue is empty and we are finishing up
-            if (isFinishing() && operation_id_queue_.empty()) {
-                break;
-            }
+                operation = takeNextOperation(source, priority);
+                if (operation) {
+                    break;
+                }
 
-            // Exit if the queue is closing.
-            if (isClosed()) {
-                while (!operation_id_queue_.empty()) {
-                    operation_id_queue_.pop();
+                // Exit if the queue is empty and we are finishing up
+                if (isFinishing() && !hasQueuedOperations()) {
+                    return;
                 }
-                break;
+
+                this->condition_.wait(guard);
             }
+        }
 
-            // Get operation id
-            key = operation_id_queue_.front();
-            operation_id_queue_.pop();
+        BeginExecutingOperation();
+        operation->main();
+        EndExecutingOperation();
 
-            // Search operation map
-            AsyncRPCOperationMap::const_iterator iter = operation_map_.find(key);
-            if (iter != operation_map_.end()) {
-                operation = iter->second;
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            if (!source.empty()) {
+                active_sources_.erase(active_sources_.find(source));
             }
+            active_[priority]--;
+        }
+        // Operations waiting for this one's input source or worker can start
+        this->condition_.notify_all();
+    }
+}
+
+bool AsyncRPCQueue::hasQueuedOperations() const {
+    for (const std::deque<AsyncRPCOperationId> & queue : operation_id_queue_) {
+        if (!queue.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Remove and return the first queued operation of the highest priority class
+ * that can start now, or null. An operation cannot start while another one
+ * with the same input source is executing, and LOW priority operations do not
+ * take the last free worker of a queue with several workers.
+ */
+std::shared_ptr<AsyncRPCOperation> AsyncRPCQueue::takeNextOperation(std::string & source, int & priority) {
+    const size_t nActiveLow = active_[(int)OperationPriority::LOW];
+    for (int p = 0; p < (int)OperationPriority::NUM_PRIORITIES; p++) {
+        if (p == (int)OperationPriority::LOW && workers_.size() > 1 && nActiveLow + 1 >= workers_.size()) {
+            continue;
         }
 
-        if (!operation) {
-            // cannot find operation in map, may have been removed
-        } else if (operation->isCancelled()) {
-            // skip cancelled operation
-        } else {
-            operation->main();
+        std::deque<AsyncRPCOperationId> & queue = operation_id_queue_[p];
+        for (auto it = queue.begin(); it != queue.end(); ) {
+            AsyncRPCOperationMap::const_iterator iter = operation_map_.find(*it);
+            if (iter == operation_map_.end() || iter->second->isCancelled()) {
+                // removed from the map, or cancelled while queued
+                it = queue.erase(it);
+                continue;
+            }
+
+            source = iter->second->getInputSource();
+            if (!source.empty() && active_sources_.count(source)) {
+                ++it;
+                continue;
+            }
+
+            std::shared_ptr<AsyncRPCOperation> operation = iter->second;
+            queue.erase(it);
+            if (!source.empty()) {
+                active_sources_.insert(source);
+            }
+            priority = p;
+            active_[p]++;
+            return operation;
         }
     }
+    return nullptr;
 }
 
 
@@ -91,7 +173,7 @@ void AsyncRPCQueue::addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOp
 
     AsyncRPCOperationId id = ptrOperation->getId();
     operation_map_.emplace(id, ptrOperation);
-    operation_id_queue_.push(id);
+    operation_id_queue_[(int)ptrOperation->getPriority()].push_back(id);
     this->condition_.notify_one();
 }
 
@@ -168,7 +250,53 @@ void AsyncRPCQueue::cancelAllOperations() {
  */
 size_t AsyncRPCQueue::getOperationCount() const {
     std::lock_guard<std::mutex> guard(lock_);
-    return operation_id_queue_.size();
+    size_t count = 0;
+    for (const std::deque<AsyncRPCOperationId> & queue : operation_id_queue_) {
+        count += queue.size();
+    }
+    return count;
+}
+
+/**
+ * Return the number of operations of a priority class that are queued and not
+ * cancelled.
+ */
+size_t AsyncRPCQueue::getOperationCount(OperationPriority priority) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    size_t count = 0;
+    for (const AsyncRPCOperationId & id : operation_id_queue_[(int)priority]) {
+        AsyncRPCOperationMap::const_iterator iter = operation_map_.find(id);
+        if (iter != operation_map_.end() && !iter->second->isCancelled()) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * Return the number of operations of a priority class executing on a worker.
+ */
+size_t AsyncRPCQueue::getExecutingCount(OperationPriority priority) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return active_[(int)priority];
+}
+
+/**
+ * Return how many queued operations are ahead of the given one, or -1 if it
+ * is not queued. Operations held back by their input source are counted too.
+ */
+int AsyncRPCQueue::getQueuePosition(AsyncRPCOperationId id) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    int position = 0;
+    for (const std::deque<AsyncRPCOperationId> & queue : operation_id_queue_) {
+        for (const AsyncRPCOperationId & queued : queue) {
+            if (queued == id) {
+                return position;
+            }
+            position++;
+        }
+    }
+    return -1;
 }
 
 /**
@@ -10,7 +10,8 @@
 #include <iostream>
 #include <string>
 #include <chrono>
-#include <queue>
+#include <deque>
+#include <set>
 #include <unordered_map>
 #include <vector>
 #include <future>
@@ -44,7 +45,10 @@ public:
     void closeAndWait(); // block thread until all threads have terminated.
     void finishAndWait(); // block thread until existing operations have finished, threads terminated
     void cancelAllOperations(); // mark all operations in the queue as cancelled
-    size_t getOperationCount() const;
+    size_t getOperationCount() const; // number of queued operations
+    size_t getOperationCount(OperationPriority priority) const; // queued in one priority class
+    size_t getExecutingCount(OperationPriority priority) const; // executing in one priority class
+    int getQueuePosition(AsyncRPCOperationId) const; // -1 if not queued
     std::shared_ptr<AsyncRPCOperation> getOperationForId(AsyncRPCOperationId) const;
     std::shared_ptr<AsyncRPCOperation> popOperationForId(AsyncRPCOperationId);
     void addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation);
@@ -54,6 +58,9 @@ private:
     // addWorker() will spawn a new thread on run())
     void run(size_t workerId);
     void wait_for_worker_threads();
+    // Caller must hold lock_
+    bool hasQueuedOperations() const;
+    std::shared_ptr<AsyncRPCOperation> takeNextOperation(std::string & source, int & priority);
 
     // Why this is not a recursive lock: http://www.zaval.org/resources/library/butenhof1.html
     mutable std::mutex lock_;
@@ -61,7 +68,12 @@ private:
     std::atomic<bool> closed_;
     std::atomic<bool> finish_;
     AsyncRPCOperationMap operation_map_;
-    std::queue <AsyncRPCOperationId> operation_id_queue_;
+    // One FIFO queue per priority class
+    std::deque<AsyncRPCOperationId> operation_id_queue_[(int)OperationPriority::NUM_PRIORITIES];
+    // Input sources of the executing operations
+    std::multiset<std::string> active_sources_;
+    // Executing operations per priority class; LOW ones may not take the last worker
+    size_t active_[(int)OperationPriority::NUM_PRIORITIES];
     std::vector<std::thread> workers_;
 };
 
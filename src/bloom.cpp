@@ -6,6 +6,7 @@
 
 #include "primitives/transaction.h"
 #include "hash.h"
+#include "memusage.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "random.h"
@@ -270,3 +271,56 @@ void CRollingBloomFilter::reset()
     b2.reset(nNewTweak);
     nInsertions = 0;
 }
+
+namespace {
+
+const unsigned int BLOCKED_BLOOM_WORDS = 8;
+const unsigned int BLOCKED_BLOOM_BITS_PER_ELEMENT = 16;
+/** Odd multipliers deriving the bit to use in each word of a block. */
+const uint32_t BLOCKED_BLOOM_SALTS[BLOCKED_BLOOM_WORDS] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+}
+
+CBlockedBloomFilter::CBlockedBloomFilter(unsigned int nElements) :
+    salt(GetRandHash()), nCapacity(nElements), nInsertions(0)
+{
+    // A power of two number of blocks, so the block index is a mask.
+    const uint64_t nBits = (uint64_t)nElements * BLOCKED_BLOOM_BITS_PER_ELEMENT;
+    uint64_t nBlocks = 1;
+    while (nBlocks * BLOCKED_BLOOM_WORDS * 32 < nBits && nBlocks < ((uint64_t)1 << 31)) {
+        nBlocks <<= 1;
+    }
+    nBlockMask = nBlocks - 1;
+    vData.assign(nBlocks * BLOCKED_BLOOM_WORDS, 0);
+}
+
+void CBlockedBloomFilter::insert(const uint256& hash)
+{
+    const uint64_t h = hash.GetHash(salt);
+    uint32_t* block = &vData[((h >> 32) & nBlockMask) * BLOCKED_BLOOM_WORDS];
+    const uint32_t key = (uint32_t)h;
+    for (unsigned int i = 0; i < BLOCKED_BLOOM_WORDS; i++) {
+        block[i] |= (uint32_t)1 << ((key * BLOCKED_BLOOM_SALTS[i]) >> 27);
+    }
+    nInsertions++;
+}
+
+bool CBlockedBloomFilter::contains(const uint256& hash) const
+{
+    const uint64_t h = hash.GetHash(salt);
+    const uint32_t* block = &vData[((h >> 32) & nBlockMask) * BLOCKED_BLOOM_WORDS];
+    const uint32_t key = (uint32_t)h;
+    for (unsigned int i = 0; i < BLOCKED_BLOOM_WORDS; i++) {
+        if (!(block[i] & ((uint32_t)1 << ((key * BLOCKED_BLOOM_SALTS[i]) >> 27))))
+            return false;
+    }
+    return true;
+}
+
+size_t CBlockedBloomFilter::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(vData);
+}
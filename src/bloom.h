@@ -6,12 +6,13 @@
 #define BITCOIN_BLOOM_H
 
 #include "serialize.h"
+#include "uint256.h"
 
+#include <stdint.h>
 #include <vector>
 
 class COutPoint;
 class CTransaction;
-class uint256;
 
 //! 20,000 items with fp rate < 0.1% or 10,000 items and <0.0001%
 static const unsigned int MAX_BLOOM_FILTER_SIZE = 36000; // bytes
@@ -134,5 +135,37 @@ private:
     CBloomFilter b1, b2;
 };
 
+/**
+ * A blocked Bloom filter over 256-bit hashes. Each element sets, and a lookup
+ * tests, one bit in each of the eight 32-bit words of a single 256-bit block,
+ * so a lookup touches one cache line and no more than one hash is computed.
+ * At the 16 bits per element it is sized for, false positives are below 0.5%.
+ *
+ * Elements cannot be removed; a filter that has to forget elements, or that
+ * has been filled past its capacity, is rebuilt. The element hashes are salted
+ * with a random value, so elements cannot be crafted to collide on every node.
+ */
+class CBlockedBloomFilter
+{
+private:
+    std::vector<uint32_t> vData;
+    uint32_t nBlockMask;
+    uint256 salt;
+    unsigned int nCapacity;
+    unsigned int nInsertions;
+
+public:
+    //! An empty filter sized for nElements elements.
+    explicit CBlockedBloomFilter(unsigned int nElements = 0);
+
+    void insert(const uint256& hash);
+    bool contains(const uint256& hash) const;
+
+    //! The number of elements inserted so far.
+    unsigned int size() const { return nInsertions; }
+    //! The number of elements the filter was sized for.
+    unsigned int capacity() const { return nCapacity; }
+    size_t DynamicMemoryUsage() const;
+};
 
 #endif // BITCOIN_BLOOM_H
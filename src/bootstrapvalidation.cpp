@@ -460,6 +460,13 @@ static void ThreadBootstrapUtxoValidation()
 
         int progress = startProgress < 0 ? 0 : startProgress;
         if (!wipe) {
+            // A scratch DB left by an older version still stores one record per
+            // transaction; convert it before connecting more blocks onto it. An
+            // interrupted conversion resumes on the next run.
+            if (!scratchdb.Upgrade()) {
+                LogPrintf("Trustless bootstrap: could not upgrade the scratch chainstate; will retry on restart\n");
+                return;
+            }
             // Reconcile the persisted progress with what the scratch DB actually
             // durably holds, in BOTH directions. The intermittent cache flush
             // below advances the DB's best block independently of the per-batch
@@ -583,7 +590,10 @@ static void ThreadBootstrapUtxoValidation()
             // flush duration. (BatchWrite reads/writes only this view's caches and
             // scratchdb; it takes no global lock and no shared state.)
             if (view.DynamicMemoryUsage() > BOOTSTRAPVAL_FLUSH_CAP) {
-                view.Flush();
+                // Write the dirty entries but keep the recently used half of
+                // the cache, so the replay does not restart from a cold cache.
+                view.Sync();
+                view.Trim(BOOTSTRAPVAL_FLUSH_CAP / 2);
             }
             if (failed) {
                 break;
@@ -4,49 +4,25 @@
 
 #include "coins.h"
 
+#include "consensus/consensus.h"
+#include "hash.h"
 #include "memusage.h"
 #include "random.h"
+#include "streams.h"
 #include "version.h"
 #include "policy/fees.h"
 
 #include <assert.h>
 
-/**
- * calculate number of bytes for the bitmask, and its number of non-zero bytes
- * each bit in the bitmask represents the availability of one output, but the
- * availabilities of the first two outputs are encoded separately
- */
-void CCoins::CalcMaskSize(unsigned int &nBytes, unsigned int &nNonzeroBytes) const {
-    unsigned int nLastUsedByte = 0;
-    for (unsigned int b = 0; 2+b*8 < vout.size(); b++) {
-        bool fZero = true;
-        for (unsigned int i = 0; i < 8 && 2+b*8+i < vout.size(); i++) {
-            if (!vout[2+b*8+i].IsNull()) {
-                fZero = false;
-                continue;
-            }
-        }
-        if (!fZero) {
-            nLastUsedByte = b + 1;
-            nNonzeroBytes++;
-        }
-    }
-    nBytes += nLastUsedByte;
-}
-
-bool CCoins::Spend(uint32_t nPos) 
-{
-    if (nPos >= vout.size() || vout[nPos].IsNull())
-        return false;
-    vout[nPos].SetNull();
-    Cleanup();
-    return true;
-}
 bool CCoinsView::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const { return false; }
 bool CCoinsView::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return false; }
 bool CCoinsView::GetNullifier(const uint256 &nullifier, ShieldedType type) const { return false; }
-bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return false; }
-bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
+bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
+bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
+{
+    Coin coin;
+    return GetCoin(outpoint, coin);
+}
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 uint256 CCoinsView::GetBestAnchor(ShieldedType type) const { return uint256(); };
 bool CCoinsView::BatchWrite(CCoinsMap &mapCoins,
@@ -56,7 +32,8 @@ bool CCoinsView::BatchWrite(CCoinsMap &mapCoins,
                             CAnchorsSproutMap &mapSproutAnchors,
                             CAnchorsSaplingMap &mapSaplingAnchors,
                             CNullifiersMap &mapSproutNullifiers,
-                            CNullifiersMap &mapSaplingNullifiers) { return false; }
+                            CNullifiersMap &mapSaplingNullifiers,
+                            bool fErase) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
 
 
@@ -65,8 +42,8 @@ CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
 bool CCoinsViewBacked::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const { return base->GetSproutAnchorAt(rt, tree); }
 bool CCoinsViewBacked::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return base->GetSaplingAnchorAt(rt, tree); }
 bool CCoinsViewBacked::GetNullifier(const uint256 &nullifier, ShieldedType type) const { return base->GetNullifier(nullifier, type); }
-bool CCoinsViewBacked::GetCoins(const uint256 &txid, CCoins &coins) const { return base->GetCoins(txid, coins); }
-bool CCoinsViewBacked::HaveCoins(const uint256 &txid) const { return base->HaveCoins(txid); }
+bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const { return base->GetCoin(outpoint, coin); }
+bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->HaveCoin(outpoint); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 uint256 CCoinsViewBacked::GetBestAnchor(ShieldedType type) const { return base->GetBestAnchor(type); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
@@ -77,17 +54,19 @@ bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins,
                                   CAnchorsSproutMap &mapSproutAnchors,
                                   CAnchorsSaplingMap &mapSaplingAnchors,
                                   CNullifiersMap &mapSproutNullifiers,
-                                  CNullifiersMap &mapSaplingNullifiers) { return base->BatchWrite(mapCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor, mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers); }
+                                  CNullifiersMap &mapSaplingNullifiers,
+                                  bool fErase) { return base->BatchWrite(mapCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor, mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers, fErase); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStats(stats); }
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+SaltedOutpointHasher::SaltedOutpointHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::~CCoinsViewCache()
-{
-    assert(!hasModifier);
-}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn),
+    cacheCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &cacheCoinsMemoryResource),
+    cacheSproutNullifiers(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &cacheSproutNullifiersMemoryResource),
+    cacheSaplingNullifiers(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &cacheSaplingNullifiersMemoryResource),
+    cachedCoinsUsage(0), nAccessClock(0) { }
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) +
@@ -98,25 +77,37 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
            cachedCoinsUsage;
 }
 
-CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
-    CCoinsMap::iterator it = cacheCoins.find(txid);
-    if (it != cacheCoins.end())
+void CCoinsViewCache::Touch(CCoinsCacheEntry &entry) const {
+    if (++nAccessClock == 0) {
+        // The clock wrapped around: halve every stamp, which keeps their order.
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+            it->second.nLastAccess >>= 1;
+        }
+        nAccessClock = 1u << 31;
+    }
+    entry.nLastAccess = nAccessClock;
+}
+
+CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
+    CCoinsMap::iterator it = cacheCoins.find(outpoint);
+    if (it != cacheCoins.end()) {
+        Touch(it->second);
         return it;
-    CCoins tmp;
-    if (!base->GetCoins(txid, tmp))
+    }
+    Coin tmp;
+    if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
-    CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
-    tmp.swap(ret->second.coins);
-    if (ret->second.coins.IsPruned()) {
-        // The parent only has an empty entry for this txid; we can consider our
+    CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(outpoint, CCoinsCacheEntry(std::move(tmp)))).first;
+    Touch(ret->second);
+    if (ret->second.coin.IsSpent()) {
+        // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
-    cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
+    cachedCoinsUsage += ret->second.coin.DynamicMemoryUsage();
     return ret;
 }
 
-
 bool CCoinsViewCache::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
     CAnchorsSproutMap::const_iterator it = cacheSproutAnchors.find(rt);
     if (it != cacheSproutAnchors.end()) {
@@ -330,61 +321,82 @@ void CCoinsViewCache::SetNullifiers(const CTransaction& tx, bool spent) {
     }
 }
 
-bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
+bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it != cacheCoins.end()) {
-        coins = it->second.coins;
-        return true;
+        coin = it->second.coin;
+        return !coin.IsSpent();
     }
     return false;
 }
 
-CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
-    assert(!hasModifier);
-    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
-    size_t cachedCoinUsage = 0;
-    if (ret.second) {
-        if (!base->GetCoins(txid, ret.first->second.coins)) {
-            // The parent view does not have this entry; mark it as fresh.
-            ret.first->second.coins.Clear();
-            ret.first->second.flags = CCoinsCacheEntry::FRESH;
-        } else if (ret.first->second.coins.IsPruned()) {
-            // The parent view only has a pruned entry for this; mark it as fresh.
-            ret.first->second.flags = CCoinsCacheEntry::FRESH;
+void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possible_overwrite) {
+    assert(!coin.IsSpent());
+    if (coin.out.scriptPubKey.IsUnspendable()) return;
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(outpoint, CCoinsCacheEntry()));
+    CCoinsMap::iterator it = ret.first;
+    bool fresh = false;
+    if (!ret.second) {
+        cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+    }
+    if (!possible_overwrite) {
+        if (!it->second.coin.IsSpent()) {
+            throw std::logic_error("Adding new coin that replaces non-pruned entry");
         }
-    } else {
-        cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
+        fresh = !(it->second.flags & CCoinsCacheEntry::DIRTY);
+    }
+    it->second.coin = std::move(coin);
+    it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
+    cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    Touch(it->second);
+}
+
+void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool check) {
+    bool fCoinbase = tx.IsCoinBase();
+    const uint256& txid = tx.GetHash();
+    for (size_t i = 0; i < tx.vout.size(); ++i) {
+        bool overwrite = check ? cache.HaveCoin(COutPoint(txid, i)) : fCoinbase;
+        // Always set the possible_overwrite flag to AddCoin for coinbase txn, in order to correctly
+        // deal with the (in this chain purely theoretical) occurrence of duplicate coinbase transactions.
+        cache.AddCoin(COutPoint(txid, i), Coin(tx.vout[i], nHeight, fCoinbase, tx.nVersion), overwrite);
     }
-    // Assume that whenever ModifyCoins is called, the entry will be modified.
-    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first, cachedCoinUsage);
 }
 
-CCoinsModifier CCoinsViewCache::ModifyNewCoins(const uint256 &txid) {
-    assert(!hasModifier);
-    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
-    ret.first->second.coins.Clear();
-    ret.first->second.flags = CCoinsCacheEntry::FRESH;
-    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first, 0);
+bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
+    CCoinsMap::iterator it = FetchCoin(outpoint);
+    if (it == cacheCoins.end()) return false;
+    cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+    if (moveout) {
+        *moveout = std::move(it->second.coin);
+    }
+    if (it->second.flags & CCoinsCacheEntry::FRESH) {
+        cacheCoins.erase(it);
+    } else {
+        it->second.flags |= CCoinsCacheEntry::DIRTY;
+        it->second.coin.Clear();
+    }
+    return true;
 }
 
-const CCoins* CCoinsViewCache::AccessCoins(const uint256 &txid) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
+static const Coin coinEmpty;
+
+const Coin& CCoinsViewCache::AccessCoin(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) {
-        return NULL;
+        return coinEmpty;
     } else {
-        return &it->second.coins;
+        return it->second.coin;
     }
 }
 
-bool CCoinsViewCache::HaveCoins(const uint256 &txid) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
-    // We're using vtx.empty() instead of IsPruned here for performance reasons,
-    // as we only care about the case where a transaction was replaced entirely
-    // in a reorganization (which wipes vout entirely, as opposed to spending
-    // which just cleans individual outputs).
-    return (it != cacheCoins.end() && !it->second.coins.vout.empty());
+bool CCoinsViewCache::HaveCoin(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
+    return (it != cacheCoins.end() && !it->second.coin.IsSpent());
+}
+
+bool CCoinsViewCache::HaveCoinInCache(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = cacheCoins.find(outpoint);
+    return (it != cacheCoins.end() && !it->second.coin.IsSpent());
 }
 
 uint256 CCoinsViewCache::GetBestBlock() const {
@@ -415,7 +427,7 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-void BatchWriteNullifiers(CNullifiersMap &mapNullifiers, CNullifiersMap &cacheNullifiers)
+void BatchWriteNullifiers(CNullifiersMap &mapNullifiers, CNullifiersMap &cacheNullifiers, bool fErase)
 {
     for (CNullifiersMap::iterator child_it = mapNullifiers.begin(); child_it != mapNullifiers.end();) {
         if (child_it->second.flags & CNullifiersCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
@@ -433,7 +445,8 @@ void BatchWriteNullifiers(CNullifiersMap &mapNullifiers, CNullifiersMap &cacheNu
             }
         }
         CNullifiersMap::iterator itOld = child_it++;
-        mapNullifiers.erase(itOld);
+        if (fErase)
+            mapNullifiers.erase(itOld);
     }
 }
 
@@ -441,7 +454,8 @@ template<typename Map, typename MapIterator, typename MapEntry>
 void BatchWriteAnchors(
     Map &mapAnchors,
     Map &cacheAnchors,
-    size_t &cachedCoinsUsage
+    size_t &cachedCoinsUsage,
+    bool fErase
 )
 {
     for (MapIterator child_it = mapAnchors.begin(); child_it != mapAnchors.end();)
@@ -466,7 +480,8 @@ void BatchWriteAnchors(
         }
 
         MapIterator itOld = child_it++;
-        mapAnchors.erase(itOld);
+        if (fErase)
+            mapAnchors.erase(itOld);
     }
 }
 
@@ -477,48 +492,74 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                                  CAnchorsSproutMap &mapSproutAnchors,
                                  CAnchorsSaplingMap &mapSaplingAnchors,
                                  CNullifiersMap &mapSproutNullifiers,
-                                 CNullifiersMap &mapSaplingNullifiers) {
-    assert(!hasModifier);
+                                 CNullifiersMap &mapSaplingNullifiers,
+                                 bool fErase) {
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
             CCoinsMap::iterator itUs = cacheCoins.find(it->first);
             if (itUs == cacheCoins.end()) {
-                if (!it->second.coins.IsPruned()) {
-                    // The parent cache does not have an entry, while the child
-                    // cache does have (a non-pruned) one. Move the data up, and
-                    // mark it as fresh (if the grandparent did have it, we
-                    // would have pulled it in at first GetCoins).
-                    assert(it->second.flags & CCoinsCacheEntry::FRESH);
+                // The parent cache does not have an entry, while the child does
+                // We can ignore it if it's both FRESH and pruned in the child
+                if (!(it->second.flags & CCoinsCacheEntry::FRESH && it->second.coin.IsSpent())) {
+                    // Otherwise we will need to create it in the parent
+                    // and move the data up and mark it as dirty
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
-                    entry.coins.swap(it->second.coins);
-                    cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
-                    entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                    if (fErase)
+                        entry.coin = std::move(it->second.coin);
+                    else
+                        entry.coin = it->second.coin;
+                    cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
+                    entry.flags = CCoinsCacheEntry::DIRTY;
+                    Touch(entry);
+                    // We can mark it FRESH in the parent if it was FRESH in the child
+                    // Otherwise it might have just been flushed from the parent's cache
+                    // and already exist in the grandparent
+                    if (it->second.flags & CCoinsCacheEntry::FRESH)
+                        entry.flags |= CCoinsCacheEntry::FRESH;
                 }
             } else {
-                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
+                // Assert that the child cache entry was not marked FRESH if the
+                // parent cache entry has unspent outputs. If this ever happens,
+                // it means the FRESH flag was misapplied and there is a logic
+                // error in the calling code.
+                if ((it->second.flags & CCoinsCacheEntry::FRESH) && !itUs->second.coin.IsSpent())
+                    throw std::logic_error("FRESH flag misapplied to cache entry for base transaction with spendable outputs");
+
+                // Found the entry in the parent cache
+                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coin.IsSpent()) {
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
-                    itUs->second.coins.swap(it->second.coins);
-                    cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
+                    if (fErase)
+                        itUs->second.coin = std::move(it->second.coin);
+                    else
+                        itUs->second.coin = it->second.coin;
+                    cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    Touch(itUs->second);
+                    // NOTE: It is possible the child has a FRESH flag here in
+                    // the event the entry we found in the parent is pruned. But
+                    // we must not copy that FRESH flag to the parent as that
+                    // pruned state likely still needs to be communicated to the
+                    // grandparent.
                 }
             }
         }
         CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase)
+            mapCoins.erase(itOld);
     }
 
-    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry>(mapSproutAnchors, cacheSproutAnchors, cachedCoinsUsage);
-    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry>(mapSaplingAnchors, cacheSaplingAnchors, cachedCoinsUsage);
+    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry>(mapSproutAnchors, cacheSproutAnchors, cachedCoinsUsage, fErase);
+    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry>(mapSaplingAnchors, cacheSaplingAnchors, cachedCoinsUsage, fErase);
 
-    ::BatchWriteNullifiers(mapSproutNullifiers, cacheSproutNullifiers);
-    ::BatchWriteNullifiers(mapSaplingNullifiers, cacheSaplingNullifiers);
+    ::BatchWriteNullifiers(mapSproutNullifiers, cacheSproutNullifiers, fErase);
+    ::BatchWriteNullifiers(mapSaplingNullifiers, cacheSaplingNullifiers, fErase);
 
     hashSproutAnchor = hashSproutAnchorIn;
     hashSaplingAnchor = hashSaplingAnchorIn;
@@ -527,25 +568,174 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
 }
 
 bool CCoinsViewCache::Flush() {
-    bool fOk = base->BatchWrite(cacheCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor, cacheSproutAnchors, cacheSaplingAnchors, cacheSproutNullifiers, cacheSaplingNullifiers);
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor, cacheSproutAnchors, cacheSaplingAnchors, cacheSproutNullifiers, cacheSaplingNullifiers, true);
     cacheCoins.clear();
     cacheSproutAnchors.clear();
     cacheSaplingAnchors.clear();
     cacheSproutNullifiers.clear();
     cacheSaplingNullifiers.clear();
     cachedCoinsUsage = 0;
+    ReallocateCache();
+    return fOk;
+}
+
+template<typename Map>
+static void SyncAnchors(Map &cacheAnchors, size_t &cachedCoinsUsage)
+{
+    for (typename Map::iterator it = cacheAnchors.begin(); it != cacheAnchors.end();) {
+        if (!it->second.entered) {
+            cachedCoinsUsage -= it->second.tree.DynamicMemoryUsage();
+            cacheAnchors.erase(it++);
+        } else {
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+}
+
+static void SyncNullifiers(CNullifiersMap &cacheNullifiers)
+{
+    for (CNullifiersMap::iterator it = cacheNullifiers.begin(); it != cacheNullifiers.end();) {
+        if (!it->second.entered) {
+            cacheNullifiers.erase(it++);
+        } else {
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+}
+
+bool CCoinsViewCache::Sync() {
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor, cacheSproutAnchors, cacheSaplingAnchors, cacheSproutNullifiers, cacheSaplingNullifiers, false);
+    // The base now holds everything we do: keep the unspent coins as clean
+    // entries and drop the spent ones, whose erasure has been written.
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (it->second.coin.IsSpent()) {
+            cacheCoins.erase(it++);
+        } else {
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+    SyncAnchors(cacheSproutAnchors, cachedCoinsUsage);
+    SyncAnchors(cacheSaplingAnchors, cachedCoinsUsage);
+    SyncNullifiers(cacheSproutNullifiers);
+    SyncNullifiers(cacheSaplingNullifiers);
     return fOk;
 }
 
+template<typename Map, typename MapEntry>
+static void TrimAnchors(Map &cacheAnchors, size_t &cachedCoinsUsage)
+{
+    for (typename Map::iterator it = cacheAnchors.begin(); it != cacheAnchors.end();) {
+        if (!(it->second.flags & MapEntry::DIRTY)) {
+            cachedCoinsUsage -= it->second.tree.DynamicMemoryUsage();
+            cacheAnchors.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+static void TrimNullifiers(CNullifiersMap &cacheNullifiers)
+{
+    for (CNullifiersMap::iterator it = cacheNullifiers.begin(); it != cacheNullifiers.end();) {
+        if (!(it->second.flags & CNullifiersCacheEntry::DIRTY)) {
+            cacheNullifiers.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/**
+ * Trim() groups coins by the age of their last access on a log scale, with
+ * four buckets per power of two, so that eviction is least recently used
+ * first up to that resolution without sorting the whole cache.
+ */
+static const unsigned int TRIM_AGE_BUCKETS = 32 * 4;
+
+static unsigned int TrimAgeBucket(uint32_t age)
+{
+    if (age < 4)
+        return age;
+    unsigned int msb = 2;
+    while (age >> (msb + 1))
+        msb++;
+    return msb * 4 + ((age >> (msb - 2)) & 3);
+}
+
+void CCoinsViewCache::Trim(size_t nTargetUsage) {
+    if (DynamicMemoryUsage() <= nTargetUsage)
+        return;
+
+    // Anchors and nullifiers are a small part of the cache and only the best
+    // anchors are looked up again soon, so drop all clean ones first.
+    TrimAnchors<CAnchorsSproutMap, CAnchorsSproutCacheEntry>(cacheSproutAnchors, cachedCoinsUsage);
+    TrimAnchors<CAnchorsSaplingMap, CAnchorsSaplingCacheEntry>(cacheSaplingAnchors, cachedCoinsUsage);
+    TrimNullifiers(cacheSproutNullifiers);
+    TrimNullifiers(cacheSaplingNullifiers);
+
+    size_t nUsage = DynamicMemoryUsage();
+    if (nUsage <= nTargetUsage || cacheCoins.empty())
+        return;
+
+    // Estimate how much memory each age bucket of clean coins holds, then
+    // evict whole buckets, oldest first, until the estimate covers the excess.
+    const size_t nNodeUsage = memusage::DynamicUsage(cacheCoins) / cacheCoins.size();
+    size_t vBucketUsage[TRIM_AGE_BUCKETS] = {};
+    for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+            vBucketUsage[TrimAgeBucket(nAccessClock - it->second.nLastAccess)] += nNodeUsage + it->second.coin.DynamicMemoryUsage();
+        }
+    }
+    unsigned int nCutoff = TRIM_AGE_BUCKETS;
+    size_t nFreed = 0;
+    while (nCutoff > 0 && nFreed < nUsage - nTargetUsage) {
+        nFreed += vBucketUsage[--nCutoff];
+    }
+
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY) && TrimAgeBucket(nAccessClock - it->second.nLastAccess) >= nCutoff) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            cacheCoins.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void CCoinsViewCache::ReallocateCache()
+{
+    // Cache should be empty when we're calling this.
+    assert(cacheCoins.size() == 0);
+    assert(cacheSproutNullifiers.size() == 0);
+    assert(cacheSaplingNullifiers.size() == 0);
+    cacheCoins.~CCoinsMap();
+    cacheCoinsMemoryResource.~CCoinsMapMemoryResource();
+    ::new (&cacheCoinsMemoryResource) CCoinsMapMemoryResource();
+    ::new (&cacheCoins) CCoinsMap(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &cacheCoinsMemoryResource);
+
+    cacheSproutNullifiers.~CNullifiersMap();
+    cacheSproutNullifiersMemoryResource.~CNullifiersMapMemoryResource();
+    ::new (&cacheSproutNullifiersMemoryResource) CNullifiersMapMemoryResource();
+    ::new (&cacheSproutNullifiers) CNullifiersMap(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &cacheSproutNullifiersMemoryResource);
+
+    cacheSaplingNullifiers.~CNullifiersMap();
+    cacheSaplingNullifiersMemoryResource.~CNullifiersMapMemoryResource();
+    ::new (&cacheSaplingNullifiersMemoryResource) CNullifiersMapMemoryResource();
+    ::new (&cacheSaplingNullifiers) CNullifiersMap(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &cacheSaplingNullifiersMemoryResource);
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
 
 const CTxOut &CCoinsViewCache::GetOutputFor(const CTxIn& input) const
 {
-    const CCoins* coins = AccessCoins(input.prevout.hash);
-    assert(coins && coins->IsAvailable(input.prevout.n));
-    return coins->vout[input.prevout.n];
+    const Coin& coin = AccessCoin(input.prevout);
+    assert(!coin.IsSpent());
+    return coin.out;
 }
 
 CAmount CCoinsViewCache::GetValueIn(const CTransaction& tx) const
@@ -610,9 +800,7 @@ bool CCoinsViewCache::HaveInputs(const CTransaction& tx) const
 {
     if (!tx.IsCoinBase()) {
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
-            const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins* coins = AccessCoins(prevout.hash);
-            if (!coins || !coins->IsAvailable(prevout.n)) {
+            if (!HaveCoin(tx.vin[i].prevout)) {
                 return false;
             }
         }
@@ -638,32 +826,111 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight) const
     double dResult = 0.0;
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
     {
-        const CCoins* coins = AccessCoins(txin.prevout.hash);
-        assert(coins);
-        if (!coins->IsAvailable(txin.prevout.n)) continue;
-        if (coins->nHeight < nHeight) {
-            dResult += coins->vout[txin.prevout.n].nValue * (nHeight-coins->nHeight);
+        const Coin& coin = AccessCoin(txin.prevout);
+        if (coin.IsSpent()) continue;
+        if (coin.nHeight < nHeight) {
+            dResult += coin.out.nValue * (nHeight-coin.nHeight);
         }
     }
 
     return tx.ComputePriority(dResult);
 }
 
-CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
-    assert(!cache.hasModifier);
-    cache.hasModifier = true;
+static const size_t MAX_OUTPUTS_PER_BLOCK = MAX_BLOCK_SIZE / ::GetSerializeSize(CTxOut(), SER_NETWORK, PROTOCOL_VERSION);
+
+const Coin& AccessByTxid(const CCoinsViewCache& view, const uint256& txid)
+{
+    COutPoint iter(txid, 0);
+    while (iter.n < MAX_OUTPUTS_PER_BLOCK) {
+        const Coin& alternate = view.AccessCoin(iter);
+        if (!alternate.IsSpent()) return alternate;
+        ++iter.n;
+    }
+    return coinEmpty;
 }
 
-CCoinsModifier::~CCoinsModifier()
+namespace {
+
+/** Serialize one element of the chainstate commitment. The leading tag keeps
+ *  elements of different kinds apart; the shielded ones reuse the database
+ *  key prefixes. */
+CDataStream CommitmentCoin(const COutPoint &outpoint, const Coin &coin)
 {
-    assert(cache.hasModifier);
-    cache.hasModifier = false;
-    it->second.coins.Cleanup();
-    cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
-    if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
-        cache.cacheCoins.erase(it);
-    } else {
-        // If the coin still exists after the modification, add the new usage
-        cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << 'C' << outpoint << static_cast<uint32_t>(coin.nHeight * 2 + coin.fCoinBase) << coin.nVersion << coin.out;
+    return ss;
+}
+
+CDataStream CommitmentShielded(char tag, const uint256 &key)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << tag << key;
+    return ss;
+}
+
+char NullifierTag(ShieldedType type)
+{
+    switch (type) {
+        case SPROUT: return 's';
+        case SAPLING: return 'S';
+        default: throw std::runtime_error("Unknown shielded type");
+    }
+}
+
+char AnchorTag(ShieldedType type)
+{
+    switch (type) {
+        case SPROUT: return 'A';
+        case SAPLING: return 'Z';
+        default: throw std::runtime_error("Unknown shielded type");
     }
 }
+
+} // namespace
+
+void CUtxoCommitment::AddCoin(const COutPoint &outpoint, const Coin &coin)
+{
+    CDataStream ss = CommitmentCoin(outpoint, coin);
+    muhash.Insert((const unsigned char*)&ss[0], ss.size());
+}
+
+void CUtxoCommitment::RemoveCoin(const COutPoint &outpoint, const Coin &coin)
+{
+    CDataStream ss = CommitmentCoin(outpoint, coin);
+    muhash.Remove((const unsigned char*)&ss[0], ss.size());
+}
+
+void CUtxoCommitment::AddNullifier(const uint256 &nf, ShieldedType type)
+{
+    CDataStream ss = CommitmentShielded(NullifierTag(type), nf);
+    muhash.Insert((const unsigned char*)&ss[0], ss.size());
+}
+
+void CUtxoCommitment::RemoveNullifier(const uint256 &nf, ShieldedType type)
+{
+    CDataStream ss = CommitmentShielded(NullifierTag(type), nf);
+    muhash.Remove((const unsigned char*)&ss[0], ss.size());
+}
+
+void CUtxoCommitment::AddAnchor(const uint256 &rt, ShieldedType type)
+{
+    CDataStream ss = CommitmentShielded(AnchorTag(type), rt);
+    muhash.Insert((const unsigned char*)&ss[0], ss.size());
+}
+
+void CUtxoCommitment::RemoveAnchor(const uint256 &rt, ShieldedType type)
+{
+    CDataStream ss = CommitmentShielded(AnchorTag(type), rt);
+    muhash.Remove((const unsigned char*)&ss[0], ss.size());
+}
+
+uint256 CUtxoCommitment::GetHash() const
+{
+    MuHash3072 set = muhash;
+    unsigned char hashSet[MuHash3072::OUTPUT_SIZE];
+    set.Finalize(hashSet);
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << FLATDATA(hashSet) << hashSproutAnchor << hashSaplingAnchor;
+    return ss.GetHash();
+}
@@ -0,0 +1,111 @@
+// Copyright (c) 2017-2020 The Bitcoin Core developers
+// Copyright (c) 2026 The Zclassic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** An integer modulo 2^3072 - 1103717, the largest 3072-bit safe prime. */
+class Num3072
+{
+private:
+    void FullReduce();
+    bool IsOverflow() const;
+    Num3072 GetInverse() const;
+
+public:
+    static const size_t BYTE_SIZE = 384;
+
+#if defined(__SIZEOF_INT128__)
+    typedef uint64_t limb_t;
+    __extension__ typedef unsigned __int128 double_limb_t;
+    static const int LIMB_SIZE = 64;
+#else
+    typedef uint32_t limb_t;
+    typedef uint64_t double_limb_t;
+    static const int LIMB_SIZE = 32;
+#endif
+    static const int LIMBS = 3072 / LIMB_SIZE;
+
+    limb_t limbs[LIMBS];
+
+    //! Sets this to 1.
+    Num3072();
+    //! Reads a little-endian 3072-bit number.
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    void Square();
+    void Divide(const Num3072& a);
+    //! Writes the fully reduced number in little-endian order.
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]);
+};
+
+/**
+ * A multiplicative hash of a set of byte strings ("MuHash", see Maitin-Shepard
+ * et al., "Elliptic Curve Multiset Hash").
+ *
+ * Every element is hashed to a number modulo a 3072-bit prime and the set hash
+ * is the product of those numbers, so elements can be added and removed in any
+ * order, and the hashes of two disjoint sets combine into the hash of their
+ * union with a single multiplication. Removals are accumulated in a separate
+ * denominator, which keeps both operations a single modular multiplication;
+ * the only inversion happens in Finalize().
+ *
+ * Elements are expanded to 3072 bits with SHA-512 in counter mode, keyed by
+ * the SHA-256 of the element.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+    static const size_t STATE_SIZE = 2 * Num3072::BYTE_SIZE;
+
+    //! The hash of the empty set.
+    MuHash3072() {}
+
+    //! Add an element to the set.
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    //! Remove an element from the set. It does not need to have been inserted
+    //! first: removing before inserting yields the same hash.
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+    //! Combine with the hash of another set (multiset union).
+    MuHash3072& operator*=(const MuHash3072& mul);
+    //! Subtract the hash of another set.
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    //! Compute the 32-byte set hash. Normalizes the internal state, which
+    //! still represents the same set afterwards.
+    void Finalize(unsigned char (&out)[OUTPUT_SIZE]);
+
+    //! Raw state, for persisting a running hash.
+    void GetState(unsigned char (&out)[STATE_SIZE]) const;
+    void SetState(const unsigned char (&in)[STATE_SIZE]);
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        unsigned char state[STATE_SIZE];
+        GetState(state);
+        s.write((const char*)state, STATE_SIZE);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        unsigned char state[STATE_SIZE];
+        s.read((char*)state, STATE_SIZE);
+        SetState(state);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
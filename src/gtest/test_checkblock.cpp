@@ -2,10 +2,15 @@
 #include <gmock/gmock.h>
 
 #include "consensus/validation.h"
+#include "init.h"
 #include "main.h"
 #include "utiltest.h"
 #include "zcash/Proof.hpp"
 
+#include <boost/thread.hpp>
+
+extern ZCJoinSplit* params;
+
 class MockCValidationState : public CValidationState {
 public:
     MOCK_METHOD6(DoS, bool(int level, bool ret,
@@ -69,6 +74,55 @@ TEST(CheckBlock, BlockSproutRejectsBadVersion) {
 }
 
 
+TEST(CheckBlock, JoinSplitProofsCheckedOnWorkers) {
+    SelectParams(CBaseChainParams::REGTEST);
+    pzcashParams = params;
+
+    CMutableTransaction mtxCoinbase;
+    mtxCoinbase.vin.resize(1);
+    mtxCoinbase.vin[0].prevout.SetNull();
+    mtxCoinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    mtxCoinbase.vout.resize(1);
+    mtxCoinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    mtxCoinbase.vout[0].nValue = 0;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    CMutableTransaction mtx = GetValidSproutReceive(*params, sk, 10, true);
+    // Changing a public input invalidates the proof but keeps the
+    // transaction structurally valid.
+    CMutableTransaction mtxBad = mtx;
+    mtxBad.vjoinsplit[0].vpub_old += 1;
+
+    auto verifier = libzcash::ProofVerifier::Strict();
+
+    nScriptCheckThreads = 2;
+    boost::thread_group workers;
+    workers.create_thread(&ThreadProofCheck);
+
+    {
+        CBlock block;
+        block.vtx.push_back(mtxCoinbase);
+        block.vtx.push_back(mtx);
+        MockCValidationState state;
+        EXPECT_TRUE(CheckBlock(block, state, verifier, false, false, true, true));
+    }
+
+    {
+        CBlock block;
+        block.vtx.push_back(mtxCoinbase);
+        block.vtx.push_back(mtx);
+        block.vtx.push_back(mtxBad);
+        MockCValidationState state;
+        EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "bad-txns-joinsplit-verification-failed", false, ::testing::_)).Times(1);
+        EXPECT_FALSE(CheckBlock(block, state, verifier, false, false, true, true));
+    }
+
+    workers.interrupt_all();
+    workers.join_all();
+    nScriptCheckThreads = 0;
+    pzcashParams = NULL;
+}
+
 class ContextualCheckBlockTest : public ::testing::Test {
 protected:
     CBlockIndex fakeTip;
@@ -339,3 +393,107 @@ TEST_F(ContextualCheckBlockTest, BlockSaplingRulesRejectOtherTx) {
         ExpectInvalidBlockFromTx(CTransaction(mtx), 100, "bad-sapling-tx-version-group-id");
     }
 }
+
+
+// Test that Sapling proofs handed to the proof-check workers give the same
+// verdict, and the same reject reason, as verifying them inline.
+TEST_F(ContextualCheckBlockTest, SaplingProofsCheckedOnWorkers) {
+    auto consensusParams = RegtestActivateSapling();
+
+    CMutableTransaction mtxCoinbase = GetFirstBlockCoinbaseTx();
+    mtxCoinbase.fOverwintered = true;
+    mtxCoinbase.nVersion = SAPLING_TX_VERSION;
+    mtxCoinbase.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+
+    CBasicKeyStore keystore;
+    auto sk = GetTestMasterSaplingSpendingKey();
+    CMutableTransaction mtx = GetValidSaplingReceive(consensusParams, keystore, sk, 5000);
+    CMutableTransaction mtxBad = mtx;
+    mtxBad.vShieldedOutput[0].zkproof[0] ^= 0x01;
+
+    CBlockIndex indexPrev {Params().GenesisBlock()};
+
+    nScriptCheckThreads = 2;
+    boost::thread_group workers;
+    workers.create_thread(&ThreadProofCheck);
+
+    {
+        CBlock block;
+        block.vtx.push_back(mtxCoinbase);
+        block.vtx.push_back(mtx);
+        MockCValidationState state;
+        EXPECT_TRUE(ContextualCheckBlock(block, state, &indexPrev));
+    }
+
+    {
+        CBlock block;
+        block.vtx.push_back(mtxCoinbase);
+        block.vtx.push_back(mtx);
+        block.vtx.push_back(mtxBad);
+        MockCValidationState state;
+        EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "bad-txns-sapling-output-description-invalid", false, ::testing::_)).Times(1);
+        EXPECT_FALSE(ContextualCheckBlock(block, state, &indexPrev));
+    }
+
+    workers.interrupt_all();
+    workers.join_all();
+    nScriptCheckThreads = 0;
+}
+
+TEST_F(ContextualCheckBlockTest, JoinSplitSigsCheckedOnWorkers) {
+    RegtestActivateSapling();
+
+    CMutableTransaction mtxCoinbase = GetFirstBlockCoinbaseTx();
+    mtxCoinbase.fOverwintered = true;
+    mtxCoinbase.nVersion = SAPLING_TX_VERSION;
+    mtxCoinbase.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+
+    CMutableTransaction mtx;
+    mtx.fOverwintered = true;
+    mtx.nVersion = SAPLING_TX_VERSION;
+    mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+    JSDescription jsdesc;
+    jsdesc.proof = libzcash::GrothProof();
+    mtx.vjoinsplit.push_back(jsdesc);
+
+    unsigned char joinSplitPrivKey[crypto_sign_SECRETKEYBYTES];
+    crypto_sign_keypair(mtx.joinSplitPubKey.begin(), joinSplitPrivKey);
+    CScript scriptCode;
+    CTransaction signTx(mtx);
+    auto consensusBranchId = CurrentEpochBranchId(1, Params().GetConsensus());
+    uint256 dataToBeSigned = SignatureHash(scriptCode, signTx, NOT_AN_INPUT, SigHashType(), 0, consensusBranchId);
+    assert(crypto_sign_detached(&mtx.joinSplitSig[0], NULL,
+                                dataToBeSigned.begin(), 32,
+                                joinSplitPrivKey) == 0);
+
+    CMutableTransaction mtxBad = mtx;
+    mtxBad.joinSplitSig[0] ^= 0x01;
+
+    CBlockIndex indexPrev {Params().GenesisBlock()};
+
+    nScriptCheckThreads = 2;
+    boost::thread_group workers;
+    workers.create_thread(&ThreadProofCheck);
+
+    {
+        CBlock block;
+        block.vtx.push_back(mtxCoinbase);
+        block.vtx.push_back(mtx);
+        MockCValidationState state;
+        EXPECT_TRUE(ContextualCheckBlock(block, state, &indexPrev));
+    }
+
+    {
+        CBlock block;
+        block.vtx.push_back(mtxCoinbase);
+        block.vtx.push_back(mtx);
+        block.vtx.push_back(mtxBad);
+        MockCValidationState state;
+        EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "bad-txns-invalid-joinsplit-signature", false, ::testing::_)).Times(1);
+        EXPECT_FALSE(ContextualCheckBlock(block, state, &indexPrev));
+    }
+
+    workers.interrupt_all();
+    workers.join_all();
+    nScriptCheckThreads = 0;
+}
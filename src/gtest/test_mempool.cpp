@@ -6,9 +6,11 @@
 #include "core_io.h"
 #include "main.h"
 #include "primitives/transaction.h"
+#include "transaction_builder.h"
 #include "txmempool.h"
 #include "policy/fees.h"
 #include "util.h"
+#include "utiltest.h"
 
 // Implementation is in test_checktransaction.cpp
 extern CMutableTransaction GetValidTransaction();
@@ -31,19 +33,18 @@ public:
         return false;
     }
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
+        if (outpoint.n != 0) {
+            return false;
+        }
         CTxOut txOut;
         txOut.nValue = 4288035;
-        CCoins newCoins;
-        newCoins.vout.resize(2);
-        newCoins.vout[0] = txOut;
-        newCoins.nHeight = 92045;
-        coins.swap(newCoins);
+        coin = Coin(txOut, 92045, false, 0);
         return true;
     }
 
-    bool HaveCoins(const uint256 &txid) const {
-        return true;
+    bool HaveCoin(const COutPoint &outpoint) const {
+        return outpoint.n == 0;
     }
 
     uint256 GetBestBlock() const {
@@ -63,7 +64,8 @@ public:
                     CAnchorsSproutMap &mapSproutAnchors,
                     CAnchorsSaplingMap &mapSaplingAnchors,
                     CNullifiersMap &mapSproutNullifiers,
-                    CNullifiersMap &mapSaplingNullifiers) {
+                    CNullifiersMap &mapSaplingNullifiers,
+                    bool fErase) {
         return false;
     }
 
@@ -79,7 +81,7 @@ public:
 // whenever IsInitialBlockDownload() is true (see commit "speed up initial
 // sync"). The gtest environment has no chain, so IBD is true and the
 // Overwinter/Sapling rejection rules in AcceptToMemoryPool never run. Without
-// them the code falls through to CCoinsViewCache::HaveCoins(), which
+// them the code falls through to CCoinsViewCache::HaveCoin(), which
 // dereferences the uninitialized global pcoinsTip and crashes. Installing a
 // tip with maximal work and a current timestamp makes IBD latch to false so
 // the contextual consensus rules actually reject the transaction first.
@@ -351,3 +353,35 @@ TEST(Mempool, ExpiringSoonTxRejection) {
     // Revert to default
     UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
 }
+
+
+// PreVerifyTransaction runs the proof checks of AcceptToMemoryPool outside
+// cs_main and must reject a bad proof with the same reason.
+TEST(Mempool, PreVerifyTransactionChecksSaplingProofs) {
+    auto consensusParams = RegtestActivateSapling();
+
+    // Disable IBD so ContextualCheckTransaction actually verifies the proofs.
+    FakeChainTip fakeChainTip;
+
+    CBasicKeyStore keystore;
+    CKey tsk = AddTestCKeyToKeyStore(keystore);
+    auto scriptPubKey = GetScriptForDestination(tsk.GetPubKey().GetID());
+    auto sk = GetTestMasterSaplingSpendingKey();
+
+    auto builder = TransactionBuilder(consensusParams, 1, &keystore);
+    builder.AddTransparentInput(COutPoint(uint256S("1"), 0), scriptPubKey, 50000);
+    builder.AddSaplingOutput(sk.expsk.full_viewing_key().ovk, sk.DefaultAddress(), 40000, {});
+    CMutableTransaction mtx = builder.Build().GetTxOrThrow();
+
+    CValidationState state1;
+    EXPECT_TRUE(PreVerifyTransaction(CTransaction(mtx), state1, 1));
+    EXPECT_TRUE(state1.IsValid());
+
+    mtx.vShieldedOutput[0].zkproof[0] ^= 0x01;
+    CValidationState state2;
+    EXPECT_FALSE(PreVerifyTransaction(CTransaction(mtx), state2, 1));
+    EXPECT_EQ(state2.GetRejectReason(), "bad-txns-sapling-output-description-invalid");
+
+    // Revert to default
+    RegtestDeactivateSapling();
+}
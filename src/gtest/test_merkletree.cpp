@@ -342,3 +342,112 @@ TEST(merkletree, testZeroElements) {
         ASSERT_TRUE(newTree.root() == oldroot);
     }
 }
+
+template<typename Tree, typename Hash>
+void test_append_many(UniValue commitment_tests, UniValue root_tests)
+{
+    std::vector<uint256> commitments;
+    for (size_t i = 0; i < 16; i++) {
+        commitments.push_back(uint256S(commitment_tests[i].get_str()));
+    }
+
+    // Split the commitments at every point into a run of single appends and
+    // one bulk append, on top of which a last single append still works.
+    for (size_t start = 0; start <= 16; start++) {
+        for (size_t end = start; end <= 16; end++) {
+            Tree tree;
+            for (size_t i = 0; i < start; i++) {
+                tree.append(commitments[i]);
+                // Asks for the root in between, so a stale memoized one
+                // would show.
+                tree.root();
+            }
+            tree.append_many(std::vector<Hash>(commitments.begin() + start, commitments.begin() + end));
+            ASSERT_EQ(tree.size(), end);
+            if (end > 0) {
+                expect_test_vector(root_tests[end - 1], tree.root());
+                ASSERT_TRUE(tree.last() == commitments[end - 1]);
+            } else {
+                ASSERT_TRUE(tree.root() == Tree::empty_root());
+            }
+
+            Tree expected;
+            for (size_t i = 0; i < end; i++) {
+                expected.append(commitments[i]);
+            }
+            ASSERT_TRUE(tree == expected);
+
+            if (end < 16) {
+                tree.append(commitments[end]);
+                expect_test_vector(root_tests[end], tree.root());
+            } else {
+                ASSERT_THROW(tree.append_many(std::vector<Hash>(1)), std::runtime_error);
+            }
+        }
+    }
+}
+
+TEST(merkletree, appendMany) {
+    test_append_many<SproutTestingMerkleTree, libzcash::SHA256Compress>(
+        read_json(MAKE_STRING(json_tests::merkle_commitments)),
+        read_json(MAKE_STRING(json_tests::merkle_roots)));
+    test_append_many<SaplingTestingMerkleTree, libzcash::PedersenHash>(
+        read_json(MAKE_STRING(json_tests::merkle_commitments_sapling)),
+        read_json(MAKE_STRING(json_tests::merkle_roots_sapling)));
+}
+
+template<typename Tree, typename Witness, typename WitnessBatch, typename Hash>
+void test_witness_batch(UniValue commitment_tests, UniValue root_tests)
+{
+    std::vector<Hash> commitments;
+    for (size_t i = 0; i < 16; i++) {
+        commitments.push_back(uint256S(commitment_tests[i].get_str()));
+    }
+
+    // Treat commitments [start, end) as one block, with a witness for every
+    // commitment up to end, and check the batch gives every witness the same
+    // state as appending the block one commitment at a time.
+    for (size_t start = 0; start <= 16; start++) {
+        for (size_t end = start; end <= 16; end++) {
+            Tree tree;
+            std::vector<Witness> expected;
+            std::vector<Witness> witnesses;
+            for (size_t i = 0; i < end; i++) {
+                tree.append(commitments[i]);
+                for (Witness& wit : expected) {
+                    wit.append(commitments[i]);
+                }
+                if (i < start) {
+                    for (Witness& wit : witnesses) {
+                        wit.append(commitments[i]);
+                    }
+                }
+                expected.push_back(tree.witness());
+                witnesses.push_back(tree.witness());
+            }
+
+            WitnessBatch batch(start, std::vector<Hash>(commitments.begin() + start, commitments.begin() + end));
+            for (Witness& wit : witnesses) {
+                batch.advance(wit);
+            }
+
+            for (size_t i = 0; i < end; i++) {
+                ASSERT_TRUE(witnesses[i] == expected[i]);
+                expect_test_vector(root_tests[end - 1], witnesses[i].root());
+                if (end < 16) {
+                    witnesses[i].append(commitments[end]);
+                    expect_test_vector(root_tests[end], witnesses[i].root());
+                }
+            }
+        }
+    }
+}
+
+TEST(merkletree, witnessBatch) {
+    test_witness_batch<SproutTestingMerkleTree, SproutTestingWitness, SproutTestingWitnessBatch, libzcash::SHA256Compress>(
+        read_json(MAKE_STRING(json_tests::merkle_commitments)),
+        read_json(MAKE_STRING(json_tests::merkle_roots)));
+    test_witness_batch<SaplingTestingMerkleTree, SaplingTestingWitness, SaplingTestingWitnessBatch, libzcash::PedersenHash>(
+        read_json(MAKE_STRING(json_tests::merkle_commitments_sapling)),
+        read_json(MAKE_STRING(json_tests::merkle_roots_sapling)));
+}
@@ -0,0 +1,34 @@
+#include <gtest/gtest.h>
+
+#include "consensus/upgrades.h"
+#include "proofcache.h"
+#include "uint256.h"
+
+TEST(ProofCache, SproutEntriesIgnoreBranch) {
+    uint256 txid = uint256S("0123");
+    EXPECT_FALSE(IsSproutProofCached(txid));
+
+    CacheSproutProof(txid);
+    EXPECT_TRUE(IsSproutProofCached(txid));
+    // A Sprout entry says nothing about the Sapling checks
+    EXPECT_FALSE(IsSaplingProofCached(txid, NetworkUpgradeInfo[Consensus::UPGRADE_SAPLING].nBranchId));
+
+    // Erased entries stay valid until an insert reclaims their slot
+    EraseCachedProofs(txid, NetworkUpgradeInfo[Consensus::UPGRADE_SAPLING].nBranchId);
+    EXPECT_TRUE(IsSproutProofCached(txid));
+}
+
+TEST(ProofCache, SaplingEntriesAreBranchSpecific) {
+    uint256 txid = uint256S("4567");
+    uint32_t saplingBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_SAPLING].nBranchId;
+    uint32_t overwinterBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_OVERWINTER].nBranchId;
+
+    CacheSaplingProof(txid, saplingBranchId);
+    EXPECT_TRUE(IsSaplingProofCached(txid, saplingBranchId));
+    EXPECT_FALSE(IsSaplingProofCached(txid, overwinterBranchId));
+    EXPECT_FALSE(IsSproutProofCached(txid));
+
+    EraseCachedProofs(txid, saplingBranchId);
+    EXPECT_TRUE(IsSaplingProofCached(txid, saplingBranchId));
+    EXPECT_FALSE(IsSaplingProofCached(txid, overwinterBranchId));
+}
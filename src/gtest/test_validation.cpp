@@ -35,11 +35,11 @@ public:
         return false;
     }
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         return false;
     }
 
-    bool HaveCoins(const uint256 &txid) const {
+    bool HaveCoin(const COutPoint &outpoint) const {
         return false;
     }
 
@@ -60,7 +60,8 @@ public:
                     CAnchorsSproutMap &mapSproutAnchors,
                     CAnchorsSaplingMap &mapSaplingAnchors,
                     CNullifiersMap &mapSproutNullifiers,
-                    CNullifiersMap saplingNullifiersMap) {
+                    CNullifiersMap saplingNullifiersMap,
+                    bool fErase) {
         return false;
     }
 
@@ -283,17 +284,19 @@ TEST(Validation, ChainstateCommitmentBindsShieldedState)
     // non-trivial and stable across the two snapshots below.
     const uint256 best = uint256S("0x99");
     {
-        CCoinsMap mapCoins;
-        CCoinsCacheEntry& e = mapCoins[uint256S("0x01")];
-        e.coins.fCoinBase = false;
-        e.coins.nVersion = 1;
-        e.coins.nHeight = 1;
-        e.coins.vout.resize(1);
-        e.coins.vout[0].nValue = 10 * COIN;
+        CCoinsMapMemoryResource coinsResource;
+        CCoinsMap mapCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &coinsResource);
+        CCoinsCacheEntry& e = mapCoins[COutPoint(uint256S("0x01"), 0)];
+        e.coin.fCoinBase = false;
+        e.coin.nVersion = 1;
+        e.coin.nHeight = 1;
+        e.coin.out.nValue = 10 * COIN;
         e.flags = CCoinsCacheEntry::DIRTY;
         CAnchorsSproutMap aS; CAnchorsSaplingMap aZ;
-        CNullifiersMap nS, nZ;
-        ASSERT_TRUE(db.BatchWrite(mapCoins, best, uint256(), uint256(), aS, aZ, nS, nZ));
+        CNullifiersMapMemoryResource nullifiersResource;
+        CNullifiersMap nS(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &nullifiersResource);
+        CNullifiersMap nZ(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &nullifiersResource);
+        ASSERT_TRUE(db.BatchWrite(mapCoins, best, uint256(), uint256(), aS, aZ, nS, nZ, true));
     }
 
     CCoinsStats before;
@@ -302,13 +305,16 @@ TEST(Validation, ChainstateCommitmentBindsShieldedState)
     // Add a single Sprout nullifier — shielded state only; no coin is added or removed,
     // and the best block is left unchanged (BatchWrite skips a null hashBlock).
     {
-        CCoinsMap noCoins;
+        CCoinsMapMemoryResource coinsResource;
+        CCoinsMap noCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &coinsResource);
         CAnchorsSproutMap aS; CAnchorsSaplingMap aZ;
-        CNullifiersMap sproutN, saplingN;
+        CNullifiersMapMemoryResource nullifiersResource;
+        CNullifiersMap sproutN(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &nullifiersResource);
+        CNullifiersMap saplingN(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &nullifiersResource);
         CNullifiersCacheEntry& ne = sproutN[uint256S("0x5150")];
         ne.entered = true;
         ne.flags = CNullifiersCacheEntry::DIRTY;
-        ASSERT_TRUE(db.BatchWrite(noCoins, uint256(), uint256(), uint256(), aS, aZ, sproutN, saplingN));
+        ASSERT_TRUE(db.BatchWrite(noCoins, uint256(), uint256(), uint256(), aS, aZ, sproutN, saplingN, true));
     }
 
     CCoinsStats after;
@@ -338,17 +344,19 @@ TEST(Validation, ChainstateCommitmentBindsCoinMetadata)
 
     // Re-write the SAME coin (same outputs) with chosen metadata each time.
     auto writeCoin = [&](bool fCoinBase, int nHeight) {
-        CCoinsMap mapCoins;
-        CCoinsCacheEntry& e = mapCoins[uint256S("0x01")];
-        e.coins.fCoinBase = fCoinBase;
-        e.coins.nVersion = 1;
-        e.coins.nHeight = nHeight;
-        e.coins.vout.resize(1);
-        e.coins.vout[0].nValue = 10 * COIN; // OUTPUT identical across every write
+        CCoinsMapMemoryResource coinsResource;
+        CCoinsMap mapCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &coinsResource);
+        CCoinsCacheEntry& e = mapCoins[COutPoint(uint256S("0x01"), 0)];
+        e.coin.fCoinBase = fCoinBase;
+        e.coin.nVersion = 1;
+        e.coin.nHeight = nHeight;
+        e.coin.out.nValue = 10 * COIN; // OUTPUT identical across every write
         e.flags = CCoinsCacheEntry::DIRTY;
         CAnchorsSproutMap aS; CAnchorsSaplingMap aZ;
-        CNullifiersMap nS, nZ;
-        ASSERT_TRUE(db.BatchWrite(mapCoins, best, uint256(), uint256(), aS, aZ, nS, nZ));
+        CNullifiersMapMemoryResource nullifiersResource;
+        CNullifiersMap nS(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &nullifiersResource);
+        CNullifiersMap nZ(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &nullifiersResource);
+        ASSERT_TRUE(db.BatchWrite(mapCoins, best, uint256(), uint256(), aS, aZ, nS, nZ, true));
     };
 
     writeCoin(/*fCoinBase=*/false, /*nHeight=*/1);
@@ -371,3 +379,283 @@ TEST(Validation, ChainstateCommitmentBindsCoinMetadata)
     EXPECT_EQ(base.hashSerialized, bumpHeight.hashSerialized);
     EXPECT_NE(base.hashSerializedFull, bumpHeight.hashSerializedFull);
 }
+
+// The rolling chainstate commitment is maintained block by block and only
+// recomputed from the database when none was stored; both must agree.
+TEST(Validation, UtxoCommitmentMatchesScan)
+{
+    CCoinsViewDB db(boost::filesystem::path("mem-chainstate-commitment-test"),
+                    1 << 20, /*fMemory=*/true, /*fWipe=*/false);
+
+    CUtxoCommitment expected;
+    expected.SetBestAnchors(SproutMerkleTree::empty_root(), SaplingMerkleTree::empty_root());
+    CUtxoCommitment scanned;
+    ASSERT_TRUE(db.GetUtxoCommitment(scanned));
+    EXPECT_EQ(expected.GetHash(), scanned.GetHash());
+
+    const COutPoint outpoint(uint256S("0x01"), 1);
+    Coin coin;
+    coin.fCoinBase = true;
+    coin.nVersion = 2;
+    coin.nHeight = 7;
+    coin.out.nValue = 10 * COIN;
+    coin.out.scriptPubKey = CScript() << OP_TRUE;
+    SproutMerkleTree sproutTree;
+    sproutTree.append(uint256S("0x1234"));
+    {
+        CCoinsViewCache cache(&db);
+        cache.AddCoin(outpoint, Coin(coin), false);
+        cache.PushAnchor(sproutTree);
+        cache.SetBestBlock(uint256S("0x99"));
+        ASSERT_TRUE(cache.Flush());
+    }
+    {
+        CCoinsMapMemoryResource coinsResource;
+        CCoinsMap noCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &coinsResource);
+        CAnchorsSproutMap aS; CAnchorsSaplingMap aZ;
+        CNullifiersMapMemoryResource nullifiersResource;
+        CNullifiersMap sproutN(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &nullifiersResource);
+        CNullifiersMap saplingN(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &nullifiersResource);
+        CNullifiersCacheEntry& ne = saplingN[uint256S("0x5150")];
+        ne.entered = true;
+        ne.flags = CNullifiersCacheEntry::DIRTY;
+        ASSERT_TRUE(db.BatchWrite(noCoins, uint256(), uint256(), uint256(), aS, aZ, sproutN, saplingN, true));
+    }
+
+    CUtxoCommitment delta;
+    delta.AddCoin(outpoint, coin);
+    delta.AddAnchor(sproutTree.root(), SPROUT);
+    delta.AddNullifier(uint256S("0x5150"), SAPLING);
+    expected.Apply(delta);
+    expected.SetBestAnchors(sproutTree.root(), SaplingMerkleTree::empty_root());
+    ASSERT_TRUE(db.GetUtxoCommitment(scanned));
+    EXPECT_EQ(expected.GetHash(), scanned.GetHash());
+
+    // The commitment binds the coin metadata, not just the output.
+    Coin relabelled = coin;
+    relabelled.fCoinBase = false;
+    CUtxoCommitment relabel = expected;
+    CUtxoCommitment relabelDelta;
+    relabelDelta.RemoveCoin(outpoint, coin);
+    relabelDelta.AddCoin(outpoint, relabelled);
+    relabel.Apply(relabelDelta);
+    EXPECT_NE(expected.GetHash(), relabel.GetHash());
+
+    // Spending the coin removes it again, and the running state survives a
+    // round trip through its block tree encoding.
+    {
+        CCoinsViewCache cache(&db);
+        ASSERT_TRUE(cache.SpendCoin(outpoint));
+        ASSERT_TRUE(cache.Flush());
+    }
+    CUtxoCommitment spend;
+    spend.RemoveCoin(outpoint, coin);
+    expected.Apply(spend);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << expected;
+    CUtxoCommitment decoded;
+    ss >> decoded;
+    ASSERT_TRUE(db.GetUtxoCommitment(scanned));
+    EXPECT_EQ(decoded.GetHash(), scanned.GetHash());
+}
+
+// GetStats() scans the chainstate in parallel ranges; the commitments must be
+// exactly those of a single pass over the database in key order.
+TEST(Validation, ChainstateStatsMatchSerialScan)
+{
+    CCoinsViewDB db(boost::filesystem::path("mem-chainstate-stats-test"),
+                    1 << 22, /*fMemory=*/true, /*fWipe=*/false);
+
+    // Spread transactions over many ranges, some sharing a first txid byte.
+    std::map<uint256, std::vector<std::pair<uint32_t, Coin> > > txs;
+    for (int i = 0; i < 600; i++) {
+        uint256 txid = GetRandHash();
+        if (i % 3 == 0)
+            *txid.begin() = 0x42;
+        for (uint32_t n = 0; n < 1 + (uint32_t)(i % 3); n++) {
+            Coin coin;
+            coin.fCoinBase = i % 5 == 0;
+            coin.nVersion = 1 + i % 4;
+            coin.nHeight = i;
+            coin.out.nValue = i * 1000 + n;
+            coin.out.scriptPubKey = CScript() << i << OP_DROP << OP_TRUE;
+            // Output indexes past 127 take a multi-byte VARINT in the key.
+            txs[txid].push_back(std::make_pair(n * 100, coin));
+        }
+    }
+    std::set<uint256> sproutNullifiers, saplingNullifiers;
+    for (int i = 0; i < 300; i++) {
+        (i % 2 ? sproutNullifiers : saplingNullifiers).insert(GetRandHash());
+    }
+    SproutMerkleTree sproutTree;
+    sproutTree.append(uint256S("0x1234"));
+    {
+        CCoinsViewCache cache(&db);
+        for (std::map<uint256, std::vector<std::pair<uint32_t, Coin> > >::const_iterator it = txs.begin(); it != txs.end(); ++it) {
+            for (size_t i = 0; i < it->second.size(); i++) {
+                cache.AddCoin(COutPoint(it->first, it->second[i].first), Coin(it->second[i].second), false);
+            }
+        }
+        cache.PushAnchor(sproutTree);
+        cache.SetBestBlock(uint256S("0x99"));
+        ASSERT_TRUE(cache.Flush());
+    }
+    {
+        CCoinsMapMemoryResource coinsResource;
+        CCoinsMap noCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &coinsResource);
+        CAnchorsSproutMap aS; CAnchorsSaplingMap aZ;
+        CNullifiersMapMemoryResource nullifiersResource;
+        CNullifiersMap sproutN(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &nullifiersResource);
+        CNullifiersMap saplingN(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &nullifiersResource);
+        for (std::set<uint256>::const_iterator it = sproutNullifiers.begin(); it != sproutNullifiers.end(); ++it) {
+            CNullifiersCacheEntry& ne = sproutN[*it];
+            ne.entered = true;
+            ne.flags = CNullifiersCacheEntry::DIRTY;
+        }
+        for (std::set<uint256>::const_iterator it = saplingNullifiers.begin(); it != saplingNullifiers.end(); ++it) {
+            CNullifiersCacheEntry& ne = saplingN[*it];
+            ne.entered = true;
+            ne.flags = CNullifiersCacheEntry::DIRTY;
+        }
+        ASSERT_TRUE(db.BatchWrite(noCoins, uint256(), uint256(), uint256(), aS, aZ, sproutN, saplingN, true));
+    }
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    CHashWriter ssMeta(SER_GETHASH, PROTOCOL_VERSION);
+    ss << uint256S("0x99");
+    uint64_t nOutputs = 0;
+    CAmount nTotalAmount = 0;
+    for (std::map<uint256, std::vector<std::pair<uint32_t, Coin> > >::const_iterator it = txs.begin(); it != txs.end(); ++it) {
+        const Coin& first = it->second[0].second;
+        ssMeta << VARINT(first.nHeight);
+        ssMeta << static_cast<uint8_t>(first.fCoinBase ? 1 : 0);
+        ssMeta << VARINT(static_cast<uint32_t>(first.nVersion));
+        for (size_t i = 0; i < it->second.size(); i++) {
+            ss << VARINT(it->second[i].first + 1);
+            ss << it->second[i].second.out;
+            nOutputs++;
+            nTotalAmount += it->second[i].second.out.nValue;
+        }
+        ss << VARINT(0);
+    }
+    const uint256 hashSerialized = ss.GetHash();
+    CHashWriter ssFull(SER_GETHASH, PROTOCOL_VERSION);
+    ssFull << hashSerialized;
+    ssFull << ssMeta.GetHash();
+    ssFull << sproutTree.root();
+    ssFull << SaplingMerkleTree::empty_root();
+    ssFull << sproutTree.root();
+    for (std::set<uint256>::const_iterator it = sproutNullifiers.begin(); it != sproutNullifiers.end(); ++it)
+        ssFull << *it;
+    for (std::set<uint256>::const_iterator it = saplingNullifiers.begin(); it != saplingNullifiers.end(); ++it)
+        ssFull << *it;
+
+    CCoinsStats stats;
+    ASSERT_TRUE(db.GetStats(stats));
+    EXPECT_EQ(uint256S("0x99"), stats.hashBlock);
+    EXPECT_EQ(txs.size(), stats.nTransactions);
+    EXPECT_EQ(nOutputs, stats.nTransactionOutputs);
+    EXPECT_EQ(nTotalAmount, stats.nTotalAmount);
+    EXPECT_EQ(hashSerialized, stats.hashSerialized);
+    EXPECT_EQ(ssFull.GetHash(), stats.hashSerializedFull);
+    EXPECT_EQ(-1, GetCoinsStatsProgress());
+}
+
+// GetNullifier() consults an in-memory filter before the database; it must
+// still see every nullifier written, also across a rebuild of the filter once
+// it outgrows its initial size, and stop seeing erased ones.
+TEST(Validation, NullifierFilterTracksDatabase)
+{
+    CCoinsViewDB db(boost::filesystem::path("mem-nullifier-filter-test"),
+                    1 << 22, /*fMemory=*/true, /*fWipe=*/false);
+
+    std::vector<uint256> nullifiers;
+    for (unsigned int i = 0; i < MIN_NULLIFIER_FILTER_ELEMENTS + 100; i++) {
+        nullifiers.push_back(GetRandHash());
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        CCoinsMapMemoryResource coinsResource;
+        CCoinsMap noCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &coinsResource);
+        CAnchorsSproutMap aS; CAnchorsSaplingMap aZ;
+        CNullifiersMapMemoryResource nullifiersResource;
+        CNullifiersMap sproutN(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &nullifiersResource);
+        CNullifiersMap saplingN(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &nullifiersResource);
+        // The first pass fills the filter exactly; the second overflows it.
+        size_t begin = pass == 0 ? 0 : MIN_NULLIFIER_FILTER_ELEMENTS;
+        size_t end = pass == 0 ? MIN_NULLIFIER_FILTER_ELEMENTS : nullifiers.size();
+        for (size_t i = begin; i < end; i++) {
+            CNullifiersCacheEntry& ne = saplingN[nullifiers[i]];
+            ne.entered = true;
+            ne.flags = CNullifiersCacheEntry::DIRTY;
+        }
+        ASSERT_TRUE(db.BatchWrite(noCoins, uint256(), uint256(), uint256(), aS, aZ, sproutN, saplingN, true));
+    }
+    for (size_t i = 0; i < nullifiers.size(); i++) {
+        EXPECT_TRUE(db.GetNullifier(nullifiers[i], SAPLING));
+        EXPECT_FALSE(db.GetNullifier(nullifiers[i], SPROUT));
+    }
+    EXPECT_FALSE(db.GetNullifier(GetRandHash(), SAPLING));
+
+    {
+        CCoinsMapMemoryResource coinsResource;
+        CCoinsMap noCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &coinsResource);
+        CAnchorsSproutMap aS; CAnchorsSaplingMap aZ;
+        CNullifiersMapMemoryResource nullifiersResource;
+        CNullifiersMap sproutN(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &nullifiersResource);
+        CNullifiersMap saplingN(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), &nullifiersResource);
+        CNullifiersCacheEntry& ne = saplingN[nullifiers[0]];
+        ne.entered = false;
+        ne.flags = CNullifiersCacheEntry::DIRTY;
+        ASSERT_TRUE(db.BatchWrite(noCoins, uint256(), uint256(), uint256(), aS, aZ, sproutN, saplingN, true));
+    }
+    EXPECT_FALSE(db.GetNullifier(nullifiers[0], SAPLING));
+    EXPECT_TRUE(db.GetNullifier(nullifiers[1], SAPLING));
+}
+
+// Anchor trees read from the database are kept in a small LRU; an anchor
+// erased by a disconnect must not be served from it afterwards.
+TEST(Validation, AnchorCacheFollowsDatabase)
+{
+    CCoinsViewDB db(boost::filesystem::path("mem-anchor-cache-test"),
+                    1 << 20, /*fMemory=*/true, /*fWipe=*/false);
+
+    SproutMerkleTree tree;
+    tree.append(uint256S("0x1234"));
+    const uint256 root = tree.root();
+    {
+        CCoinsViewCache cache(&db);
+        cache.PushAnchor(tree);
+        ASSERT_TRUE(cache.Flush());
+    }
+    SproutMerkleTree read;
+    ASSERT_TRUE(db.GetSproutAnchorAt(root, read));
+    EXPECT_EQ(root, read.root());
+    ASSERT_TRUE(db.GetSproutAnchorAt(root, read));
+    EXPECT_EQ(root, read.root());
+
+    {
+        CCoinsViewCache cache(&db);
+        cache.PopAnchor(SproutMerkleTree::empty_root(), SPROUT);
+        ASSERT_TRUE(cache.Flush());
+    }
+    EXPECT_FALSE(db.GetSproutAnchorAt(root, read));
+
+    // The least recently used tree is the one evicted.
+    CAnchorTreeCache<SproutMerkleTree> lru;
+    std::vector<uint256> roots;
+    for (size_t i = 0; i <= ANCHOR_CACHE_ENTRIES; i++) {
+        tree.append(GetRandHash());
+        roots.push_back(tree.root());
+        lru.Put(tree.root(), tree);
+        if (i == 0)
+            continue;
+        // Keep the first one in use.
+        EXPECT_TRUE(lru.Get(roots[0], read));
+    }
+    EXPECT_TRUE(lru.Get(roots[0], read));
+    EXPECT_EQ(roots[0], read.root());
+    EXPECT_FALSE(lru.Get(roots[1], read));
+    EXPECT_TRUE(lru.Get(roots.back(), read));
+    lru.Erase(roots.back());
+    EXPECT_FALSE(lru.Get(roots.back(), read));
+}
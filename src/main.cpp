@@ -22,6 +22,7 @@
 #include "metrics.h"
 #include "net.h"
 #include "pow.h"
+#include "proofcache.h"
 #include "rpc/server.h"
 #include "txdb.h"
 #include "txmempool.h"
@@ -262,6 +263,14 @@ namespace {
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /** Rolling chainstate commitment as of chainActive.Tip(), unless unknown. */
+    CUtxoCommitment utxoCommitmentTip;
+    bool fUtxoCommitmentTip = false;
+    /** Commitments of recent blocks not yet written to the block tree database. */
+    std::map<uint256, CUtxoCommitment> mapUtxoCommitmentsDirty;
+    /** Commitments to remove from the block tree database. */
+    set<uint256> setUtxoCommitmentsErase;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -953,7 +962,8 @@ bool ContextualCheckTransaction(
         CValidationState &state,
         const int nHeight,
         const int dosLevel,
-        bool (*isInitBlockDownload)())
+        bool (*isInitBlockDownload)(),
+        std::vector<CProofCheck> *pvProofChecks)
 {
     if (isInitBlockDownload()) {
         return true;
@@ -1041,12 +1051,12 @@ bool ContextualCheckTransaction(
     }
 
     uint256 dataToBeSigned;
+    auto consensusBranchId = CurrentEpochBranchId(nHeight, Params().GetConsensus());
 
     if (!tx.vjoinsplit.empty() ||
         !tx.vShieldedSpend.empty() ||
         !tx.vShieldedOutput.empty())
     {
-        auto consensusBranchId = CurrentEpochBranchId(nHeight, Params().GetConsensus());
         // Empty output script.
         CScript scriptCode;
         try {
@@ -1057,80 +1067,103 @@ bool ContextualCheckTransaction(
         }
     }
 
-    if (!tx.vjoinsplit.empty())
-    {
-        BOOST_STATIC_ASSERT(crypto_sign_PUBLICKEYBYTES == 32);
+    bool fCheckJoinSplitSig = !tx.vjoinsplit.empty();
+    bool fCheckSaplingProofs = (!tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) &&
+                               !IsSaplingProofCached(tx.GetHash(), consensusBranchId);
 
-        // We rely on libsodium to check that the signature is canonical.
-        // https://github.com/jedisct1/libsodium/commit/62911edb7ff2275cccd74bf1c8aefcc4d76924e0
-        if (crypto_sign_verify_detached(&tx.joinSplitSig[0],
-                                        dataToBeSigned.begin(), 32,
-                                        tx.joinSplitPubKey.begin()
-                                        ) != 0) {
-            return state.DoS(isInitBlockDownload() ? 0 : 100,
-                                error("CheckTransaction(): invalid joinsplit signature"),
-                                REJECT_INVALID, "bad-txns-invalid-joinsplit-signature");
+    if (pvProofChecks) {
+        if (fCheckJoinSplitSig || fCheckSaplingProofs) {
+            pvProofChecks->push_back(CProofCheck());
+            CProofCheck check(tx, dataToBeSigned, fCheckJoinSplitSig, fCheckSaplingProofs);
+            check.swap(pvProofChecks->back());
         }
+        return true;
     }
 
-    if (!tx.vShieldedSpend.empty() ||
-        !tx.vShieldedOutput.empty())
-    {
-        auto ctx = librustzcash_sapling_verification_ctx_init();
-
-        for (const SpendDescription &spend : tx.vShieldedSpend) {
-            if (!librustzcash_sapling_check_spend(
-                ctx,
-                spend.cv.begin(),
-                spend.anchor.begin(),
-                spend.nullifier.begin(),
-                spend.rk.begin(),
-                spend.zkproof.begin(),
-                spend.spendAuthSig.begin(),
-                dataToBeSigned.begin()
-            ))
-            {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(100, error("ContextualCheckTransaction(): Sapling spend description invalid"),
-                                      REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
-            }
-        }
+    if (fCheckJoinSplitSig &&
+        !CheckJoinSplitSig(tx, dataToBeSigned, state, isInitBlockDownload() ? 0 : 100)) {
+        return false;
+    }
 
-        for (const OutputDescription &output : tx.vShieldedOutput) {
-            if (!librustzcash_sapling_check_output(
-                ctx,
-                output.cv.begin(),
-                output.cm.begin(),
-                output.ephemeralKey.begin(),
-                output.zkproof.begin()
-            ))
-            {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(100, error("ContextualCheckTransaction(): Sapling output description invalid"),
-                                      REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
-            }
-        }
+    if (fCheckSaplingProofs && !CheckSaplingProofs(tx, dataToBeSigned, state)) {
+        return false;
+    }
+    return true;
+}
+
+bool CheckJoinSplitSig(const CTransaction& tx, const uint256& dataToBeSigned, CValidationState &state, int dosLevel)
+{
+    BOOST_STATIC_ASSERT(crypto_sign_PUBLICKEYBYTES == 32);
+
+    // We rely on libsodium to check that the signature is canonical.
+    // https://github.com/jedisct1/libsodium/commit/62911edb7ff2275cccd74bf1c8aefcc4d76924e0
+    if (crypto_sign_verify_detached(&tx.joinSplitSig[0],
+                                    dataToBeSigned.begin(), 32,
+                                    tx.joinSplitPubKey.begin()
+                                    ) != 0) {
+        return state.DoS(dosLevel, error("CheckTransaction(): invalid joinsplit signature"),
+                         REJECT_INVALID, "bad-txns-invalid-joinsplit-signature");
+    }
+    return true;
+}
 
-        if (!librustzcash_sapling_final_check(
+bool CheckSaplingProofs(const CTransaction& tx, const uint256& dataToBeSigned, CValidationState &state)
+{
+    auto ctx = librustzcash_sapling_verification_ctx_init();
+
+    for (const SpendDescription &spend : tx.vShieldedSpend) {
+        if (!librustzcash_sapling_check_spend(
             ctx,
-            tx.valueBalance,
-            tx.bindingSig.begin(),
+            spend.cv.begin(),
+            spend.anchor.begin(),
+            spend.nullifier.begin(),
+            spend.rk.begin(),
+            spend.zkproof.begin(),
+            spend.spendAuthSig.begin(),
             dataToBeSigned.begin()
         ))
         {
             librustzcash_sapling_verification_ctx_free(ctx);
-            return state.DoS(100, error("ContextualCheckTransaction(): Sapling binding signature invalid"),
-                                  REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
+            return state.DoS(100, error("ContextualCheckTransaction(): Sapling spend description invalid"),
+                                  REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
         }
+    }
 
+    for (const OutputDescription &output : tx.vShieldedOutput) {
+        if (!librustzcash_sapling_check_output(
+            ctx,
+            output.cv.begin(),
+            output.cm.begin(),
+            output.ephemeralKey.begin(),
+            output.zkproof.begin()
+        ))
+        {
+            librustzcash_sapling_verification_ctx_free(ctx);
+            return state.DoS(100, error("ContextualCheckTransaction(): Sapling output description invalid"),
+                                  REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
+        }
+    }
+
+    if (!librustzcash_sapling_final_check(
+        ctx,
+        tx.valueBalance,
+        tx.bindingSig.begin(),
+        dataToBeSigned.begin()
+    ))
+    {
         librustzcash_sapling_verification_ctx_free(ctx);
+        return state.DoS(100, error("ContextualCheckTransaction(): Sapling binding signature invalid"),
+                              REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
     }
+
+    librustzcash_sapling_verification_ctx_free(ctx);
     return true;
 }
 
 
 bool CheckTransaction(const CTransaction& tx, CValidationState &state,
-                      libzcash::ProofVerifier& verifier)
+                      libzcash::ProofVerifier& verifier,
+                      std::vector<CProofCheck> *pvProofChecks)
 {
     // Don't count coinbase transactions because mining skews the count
     if (!tx.IsCoinBase()) {
@@ -1139,8 +1172,19 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state,
 
     if (!CheckTransactionWithoutProofVerification(tx, state)) {
         return false;
+    } else if (!tx.vjoinsplit.empty() && IsSproutProofCached(tx.GetHash())) {
+        // Proofs were verified when the transaction entered the mempool
+        return true;
     } else {
         // Ensure that zk-SNARKs verify
+        if (pvProofChecks) {
+            for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
+                pvProofChecks->push_back(CProofCheck());
+                CProofCheck check(tx, i, verifier);
+                check.swap(pvProofChecks->back());
+            }
+            return true;
+        }
         BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
             if (!joinsplit.Verify(*pzcashParams, verifier, tx.joinSplitPubKey)) {
                 return state.DoS(100, error("CheckTransaction(): joinsplit does not verify"),
@@ -1415,8 +1459,22 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
+bool PreVerifyTransaction(const CTransaction& tx, CValidationState &state, int nextBlockHeight)
+{
+    auto verifier = libzcash::ProofVerifier::Strict();
+    if (!CheckTransaction(tx, state, verifier))
+        return error("PreVerifyTransaction: CheckTransaction failed");
+
+    // Same DoS level as AcceptToMemoryPool.
+    if (!ContextualCheckTransaction(tx, state, nextBlockHeight, 10))
+        return error("PreVerifyTransaction: ContextualCheckTransaction failed");
+
+    return true;
+}
+
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectAbsurdFee)
+                        bool* pfMissingInputs, bool fRejectAbsurdFee,
+                        const boost::optional<uint32_t>& preVerifiedBranchId)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1439,13 +1497,22 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         }
     }
 
-    auto verifier = libzcash::ProofVerifier::Strict();
+    // Proofs checked by PreVerifyTransaction against the branch that is still
+    // current are not verified again while cs_main is held.
+    bool fProofsVerified = preVerifiedBranchId && *preVerifiedBranchId == consensusBranchId;
+
+    auto verifier = fProofsVerified ? libzcash::ProofVerifier::Disabled() : libzcash::ProofVerifier::Strict();
     if (!CheckTransaction(tx, state, verifier))
         return error("AcceptToMemoryPool: CheckTransaction failed");
 
     // DoS level set to 10 to be more forgiving.
     // Check transaction contextually against the set of consensus rules which apply in the next block to be mined.
-    if (!ContextualCheckTransaction(tx, state, nextBlockHeight, 10)) {
+    // Already verified joinSplitSig and Sapling checks are collected and dropped instead of being run.
+    // Nothing is verified during IBD, which latches to false, so sample it first.
+    bool fShieldedChecked = !IsInitialBlockDownload();
+    std::vector<CProofCheck> vVerifiedProofChecks;
+    if (!ContextualCheckTransaction(tx, state, nextBlockHeight, 10, IsInitialBlockDownload,
+                                    fProofsVerified ? &vVerifiedProofChecks : NULL)) {
         return error("AcceptToMemoryPool: ContextualCheckTransaction failed");
     }
 
@@ -1516,14 +1583,22 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         view.SetBackend(viewMemPool);
 
         // do we already have it?
-        if (view.HaveCoins(hash))
-            return false;
+        for (size_t out = 0; out < tx.vout.size(); out++) {
+            if (view.HaveCoin(COutPoint(hash, out)))
+                return false;
+        }
 
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
+        // With one record per output a spent input cannot be told apart from a
+        // missing one, so both fill in pfMissingInputs.
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are inputs missing because we already have the tx?
+                for (size_t out = 0; out < tx.vout.size(); out++) {
+                    // Optimistically just do efficient check of cache for outputs
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out)))
+                        return false;
+                }
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false;
@@ -1574,8 +1649,8 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -1662,6 +1737,14 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry, !IsInitialBlockDownload());
+
+        // Remember the verified proofs for when the transaction is mined
+        if (!tx.vjoinsplit.empty()) {
+            CacheSproutProof(hash);
+        }
+        if (fShieldedChecked && (!tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty())) {
+            CacheSaplingProof(hash, consensusBranchId);
+        }
     }
 
     return true;
@@ -1701,13 +1784,8 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
     }
 
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
-        int nHeight = -1;
-        {
-            CCoinsViewCache &view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
-        }
+        const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+        int nHeight = coin.IsSpent() ? -1 : coin.nHeight;
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
     }
@@ -2023,20 +2101,10 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
             // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            txundo.vprevout.push_back(Coin());
+            bool is_spent = inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(is_spent);
         }
     }
 
@@ -2044,7 +2112,7 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     inputs.SetNullifiers(tx, true);
 
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -2053,6 +2121,41 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
     UpdateCoins(tx, inputs, txundo, nHeight);
 }
 
+/** Add the nullifiers revealed by a transaction to a commitment, or remove them. */
+static void CommitNullifiers(CUtxoCommitment& commitment, const CTransaction& tx, bool spent)
+{
+    for (const JSDescription &joinsplit : tx.vjoinsplit) {
+        for (const uint256 &nullifier : joinsplit.nullifiers) {
+            if (spent)
+                commitment.AddNullifier(nullifier, SPROUT);
+            else
+                commitment.RemoveNullifier(nullifier, SPROUT);
+        }
+    }
+    for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
+        if (spent)
+            commitment.AddNullifier(spendDescription.nullifier, SAPLING);
+        else
+            commitment.RemoveNullifier(spendDescription.nullifier, SAPLING);
+    }
+}
+
+/** Collect the chainstate changes UpdateCoins made for a transaction. */
+static void CommitTxConnect(CUtxoCommitment& commitment, const CTransaction& tx, const CTxUndo& txundo, int nHeight)
+{
+    if (!tx.IsCoinBase()) {
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            commitment.RemoveCoin(tx.vin[j].prevout, txundo.vprevout[j]);
+        }
+    }
+    CommitNullifiers(commitment, tx, true);
+    const uint256& txid = tx.GetHash();
+    for (size_t o = 0; o < tx.vout.size(); o++) {
+        if (!tx.vout[o].scriptPubKey.IsUnspendable())
+            commitment.AddCoin(COutPoint(txid, o), Coin(tx.vout[o], nHeight, tx.IsCoinBase(), tx.nVersion));
+    }
+}
+
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore, *txdata), consensusBranchId, &error)) {
@@ -2061,6 +2164,20 @@ bool CScriptCheck::operator()() {
     return true;
 }
 
+bool CProofCheck::operator()() {
+    CValidationState state;
+    if (pverifier && !ptx->vjoinsplit[nJoinSplit].Verify(*pzcashParams, *pverifier, ptx->joinSplitPubKey)) {
+        return false;
+    }
+    if (fJoinSplitSig && !CheckJoinSplitSig(*ptx, dataToBeSigned, state, 100)) {
+        return false;
+    }
+    if (fSaplingProofs && !CheckSaplingProofs(*ptx, dataToBeSigned, state)) {
+        return false;
+    }
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -2085,14 +2202,14 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
-            if (coins->IsCoinBase()) {
+            if (coin.IsCoinBase()) {
                 // Ensure that coinbases are matured
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY) {
+                if (nSpendHeight - coin.nHeight < COINBASE_MATURITY) {
                     return state.Invalid(
-                        error("CheckInputs(): tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight),
+                        error("CheckInputs(): tried to spend coinbase at depth %d", nSpendHeight - coin.nHeight),
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase");
                 }
 
@@ -2108,8 +2225,8 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, error("CheckInputs(): txin values out of range"),
                                  REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
@@ -2169,11 +2286,11 @@ bool ContextualCheckInputs(
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, consensusBranchId, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore, consensusBranchId, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -2185,7 +2302,7 @@ bool ContextualCheckInputs(
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, consensusBranchId, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -2282,49 +2399,54 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
 
 } // anon namespace
 
+enum DisconnectResult
+{
+    DISCONNECT_OK,      // All good.
+    DISCONNECT_UNCLEAN, // Rolled back, but UTXO set was inconsistent with block.
+    DISCONNECT_FAILED   // Something else went wrong.
+};
+
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * Restore the UTXO in a Coin at a given COutPoint
+ * @param undo The Coin to be restored.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
- * @return True on success.
+ * @return A DisconnectResult as an int
  */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+static int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
-    }
-    if (coins->IsAvailable(out.n))
+    if (view.HaveCoin(out))
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
 
-    return fClean;
-}
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height, coinbase and version). Older versions included this
+        // information only in undo records for the last spend of a transactions'
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (!alternate.IsSpent()) {
+            undo.nHeight = alternate.nHeight;
+            undo.fCoinBase = alternate.fCoinBase;
+            undo.nVersion = alternate.nVersion;
+        } else {
+            error("%s: undo data adding output to missing transaction", __func__);
+            return DISCONNECT_FAILED;
+        }
+    }
+    // The potential_overwrite parameter to AddCoin is only allowed to be false if we know for
+    // sure that the coin did not already exist in the cache. As we have queried for that above
+    // using HaveCoin, we don't need to guess. When fClean is false, a coin already existed and
+    // it is an overwrite.
+    view.AddCoin(out, std::move(undo), !fClean);
 
-enum DisconnectResult
-{
-    DISCONNECT_OK,      // All good.
-    DISCONNECT_UNCLEAN, // Rolled back, but UTXO set was inconsistent with block.
-    DISCONNECT_FAILED   // Something else went wrong.
-};
+    return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
+}
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
- *  When UNCLEAN or FAILED is returned, view is left in an indeterminate state. */
-DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view)
+ *  When UNCLEAN or FAILED is returned, view is left in an indeterminate state.
+ *  When pcommitment is set, the changes to the chainstate commitment are collected in it. */
+DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, CUtxoCommitment* pcommitment = NULL)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -2350,45 +2472,49 @@ DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex,
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 hash = tx.GetHash();
+        bool is_coinbase = tx.IsCoinBase();
 
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != (int)coin.nHeight || is_coinbase != (bool)coin.fCoinBase)
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+                if (is_spent && pcommitment)
+                    pcommitment->RemoveCoin(out, coin);
+            }
         }
 
         // unspend nullifiers
         view.SetNullifiers(tx, false);
+        if (pcommitment)
+            CommitNullifiers(*pcommitment, tx, false);
 
         // restore inputs
         if (i > 0) { // not coinbases
-            const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+            CTxUndo &txundo = blockUndo.vtxundo[i-1];
             if (txundo.vprevout.size() != tx.vin.size()) {
                 error("DisconnectBlock(): transaction and undo data inconsistent");
                 return DISCONNECT_FAILED;
             }
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
-                    fClean = false;
+                int res = ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out);
+                if (res == DISCONNECT_FAILED) return DISCONNECT_FAILED;
+                fClean = fClean && res != DISCONNECT_UNCLEAN;
+                if (pcommitment)
+                    pcommitment->AddCoin(out, view.AccessCoin(out));
             }
         }
     }
 
+    // PopAnchor drops the best root only when it differs from the old one.
+    const uint256 sprout_tree_root = view.GetBestAnchor(SPROUT);
+    const uint256 sapling_tree_root = view.GetBestAnchor(SAPLING);
+
     // set the old best Sprout anchor back
     view.PopAnchor(blockUndo.old_sprout_tree_root, SPROUT);
 
@@ -2403,6 +2529,13 @@ DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex,
         view.PopAnchor(SaplingMerkleTree::empty_root(), SAPLING);
     }
 
+    if (pcommitment) {
+        if (view.GetBestAnchor(SPROUT) != sprout_tree_root)
+            pcommitment->RemoveAnchor(sprout_tree_root, SPROUT);
+        if (view.GetBestAnchor(SAPLING) != sapling_tree_root)
+            pcommitment->RemoveAnchor(sapling_tree_root, SAPLING);
+    }
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
@@ -2441,6 +2574,15 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+// Each Sapling proof check costs milliseconds, so hand them out in small
+// batches to keep all workers busy until the end of a block.
+static CCheckQueue<CProofCheck> proofcheckqueue(4);
+
+void ThreadProofCheck() {
+    RenameThread("zcl-proofch");
+    proofcheckqueue.Thread();
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -2523,7 +2665,7 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, bool fScratchView)
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, bool fScratchView, CUtxoCommitment* pcommitment)
 {
     const CChainParams& chainparams = Params();
     AssertLockHeld(cs_main);
@@ -2542,7 +2684,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
     // For blocks before checkpoint: skip expensive signature checks AND structural validation (hash chain is sufficient)
-    if (!CheckBlock(block, state, fExpensiveChecks ? verifier : disabledVerifier, !fJustCheck, !fJustCheck, fExpensiveChecks))
+    if (!CheckBlock(block, state, fExpensiveChecks ? verifier : disabledVerifier, !fJustCheck, !fJustCheck, fExpensiveChecks, true))
         return false;
 
     // verify that the view's current state corresponds to the previous block
@@ -2598,14 +2740,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
-    // Do not allow blocks that contain transactions which 'overwrite' older transactions,
-    // unless those are already completely spent.
-    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
-        const CCoins* coins = view.AccessCoins(tx.GetHash());
-        if (coins && !coins->IsPruned())
-            return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                             REJECT_INVALID, "bad-txns-BIP30");
-    }
+    // There is no BIP30 check for transactions that 'overwrite' older ones
+    // with unspent outputs. BIP34 coinbase heights have been enforced since
+    // launch (see ContextualCheckBlock), so every coinbase has a unique txid,
+    // and any other transaction spends outputs that a duplicate of it would
+    // also have to spend. Checking would cost a chainstate lookup per output.
 
     unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY | SCRIPT_VERIFY_CHECKDATASIG_SIGOPS;
 
@@ -2643,14 +2782,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         assert(sprout_tree.root() == old_sprout_tree_root);
     }
 
+    auto old_sapling_tree_root = view.GetBestAnchor(SAPLING);
     SaplingMerkleTree sapling_tree;
-    assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
+    assert(view.GetSaplingAnchorAt(old_sapling_tree_root, sapling_tree));
 
     // Grab the consensus branch ID for the block's height
     auto consensusBranchId = CurrentEpochBranchId(pindex->nHeight, Params().GetConsensus());
 
     std::vector<PrecomputedTransactionData> txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+    std::vector<libzcash::SHA256Compress> sprout_commitments;
+    std::vector<libzcash::PedersenHash> sapling_commitments;
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = block.vtx[i];
@@ -2699,25 +2841,38 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             blockundo.vtxundo.push_back(CTxUndo());
         }
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
+        if (pcommitment)
+            CommitTxConnect(*pcommitment, tx, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
 
         BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
             BOOST_FOREACH(const uint256 &note_commitment, joinsplit.commitments) {
-                // Insert the note commitments into our temporary tree.
-
-                sprout_tree.append(note_commitment);
+                // Collect the note commitments for our temporary tree.
+                sprout_commitments.push_back(note_commitment);
             }
         }
 
         BOOST_FOREACH(const OutputDescription &outputDescription, tx.vShieldedOutput) {
-            sapling_tree.append(outputDescription.cm);
+            sapling_commitments.push_back(outputDescription.cm);
         }
 
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
 
+    // Nothing in the block reads the trees before this point, so all of its
+    // commitments go in at once.
+    sprout_tree.append_many(sprout_commitments);
+    sapling_tree.append_many(sapling_commitments);
+
     view.PushAnchor(sprout_tree);
     view.PushAnchor(sapling_tree);
+    if (pcommitment) {
+        // PushAnchor only stores a root that differs from the best one.
+        if (sprout_tree.root() != old_sprout_tree_root)
+            pcommitment->AddAnchor(sprout_tree.root(), SPROUT);
+        if (sapling_tree.root() != old_sapling_tree_root)
+            pcommitment->AddAnchor(sapling_tree.root(), SAPLING);
+    }
     if (!fJustCheck && !fScratchView) {
         pindex->hashFinalSproutRoot = sprout_tree.root();
     }
@@ -2751,6 +2906,15 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (fJustCheck)
         return true;
 
+    // The block's proofs will not be needed again
+    if (!fScratchView) {
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+            if (!tx.vjoinsplit.empty() || !tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) {
+                EraseCachedProofs(tx.GetHash(), consensusBranchId);
+            }
+        }
+    }
+
     // Write undo information to disk. Skipped for a scratch re-derivation: it
     // mutates the shared block index (nUndoPos/nStatus/RaiseValidity) and writes
     // undo files the live node already owns; a forward-only scratch replay never
@@ -2885,6 +3049,20 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                 vBlocks.push_back(*it);
                 setDirtyBlockIndex.erase(it++);
             }
+            // The chainstate commitments of recent blocks go out just ahead of
+            // the (synced) block index write, so that the commitment of the
+            // chainstate's best block is always on disk once the chainstate is.
+            std::vector<std::pair<uint256, const CUtxoCommitment*> > vCommitments;
+            vCommitments.reserve(mapUtxoCommitmentsDirty.size());
+            for (std::map<uint256, CUtxoCommitment>::const_iterator it = mapUtxoCommitmentsDirty.begin(); it != mapUtxoCommitmentsDirty.end(); it++) {
+                vCommitments.push_back(make_pair(it->first, &it->second));
+            }
+            std::vector<uint256> vCommitmentsErase(setUtxoCommitmentsErase.begin(), setUtxoCommitmentsErase.end());
+            if (!pblocktree->WriteUtxoCommitments(vCommitments, vCommitmentsErase)) {
+                return AbortNode(state, "Failed to write to block index database");
+            }
+            mapUtxoCommitmentsDirty.clear();
+            setUtxoCommitmentsErase.clear();
             if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                 return AbortNode(state, "Files to write to block index database");
             }
@@ -2896,16 +3074,22 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Only the dirty entries are written; the cache stays warm so hot
+        // coins need not be read back from the database afterwards.
+        if (!pcoinsTip->Sync())
             return AbortNode(state, "Failed to write to coin database");
+        // When the cache is (nearly) full, make room by evicting the least
+        // recently used coins instead of wiping it.
+        if (fCacheLarge || fCacheCritical)
+            pcoinsTip->Trim(nCoinCacheUsage / 100 * COINS_CACHE_RETAIN_PERCENT);
         nLastFlush = nNow;
         // Forensic (opt-in: -debug=flush): after a full flush, the durable block
         // index must be at-or-ahead of the coins best block. Capturing both tips
@@ -2979,6 +3163,89 @@ void static UpdateTip(CBlockIndex *pindexNew) {
     }
 }
 
+/**
+ * Fold the changes of a block just connected to the tip into the tip's
+ * chainstate commitment, and keep the result for that block. The commitment
+ * of the block falling out of the kept window is dropped.
+ */
+static void ConnectUtxoCommitment(const CBlockIndex* pindex, const CUtxoCommitment& delta)
+{
+    if (!fUtxoCommitmentTip)
+        return;
+    utxoCommitmentTip.Apply(delta);
+    utxoCommitmentTip.SetBestAnchors(pcoinsTip->GetBestAnchor(SPROUT), pcoinsTip->GetBestAnchor(SAPLING));
+    mapUtxoCommitmentsDirty[pindex->GetBlockHash()] = utxoCommitmentTip;
+    setUtxoCommitmentsErase.erase(pindex->GetBlockHash());
+    if (pindex->nHeight >= UTXO_COMMITMENT_KEEP_BLOCKS) {
+        const uint256 hashExpired = pindex->GetAncestor(pindex->nHeight - UTXO_COMMITMENT_KEEP_BLOCKS)->GetBlockHash();
+        // Most expire before they are ever written.
+        if (mapUtxoCommitmentsDirty.erase(hashExpired) == 0)
+            setUtxoCommitmentsErase.insert(hashExpired);
+    }
+}
+
+/** As ConnectUtxoCommitment(), for a block just disconnected from the tip. */
+static void DisconnectUtxoCommitment(const CBlockIndex* pindex, const CUtxoCommitment& delta)
+{
+    if (!fUtxoCommitmentTip)
+        return;
+    utxoCommitmentTip.Apply(delta);
+    utxoCommitmentTip.SetBestAnchors(pcoinsTip->GetBestAnchor(SPROUT), pcoinsTip->GetBestAnchor(SAPLING));
+    mapUtxoCommitmentsDirty.erase(pindex->GetBlockHash());
+    setUtxoCommitmentsErase.insert(pindex->GetBlockHash());
+}
+
+bool LoadUtxoCommitment(const CCoinsViewDB& coinsdb)
+{
+    LOCK(cs_main);
+    fUtxoCommitmentTip = false;
+    mapUtxoCommitmentsDirty.clear();
+    setUtxoCommitmentsErase.clear();
+
+    const uint256 hashBest = pcoinsTip->GetBestBlock();
+    if (hashBest.IsNull()) {
+        // Empty chainstate (e.g. -reindex): the commitment starts from scratch.
+        utxoCommitmentTip = CUtxoCommitment();
+        utxoCommitmentTip.SetBestAnchors(pcoinsTip->GetBestAnchor(SPROUT), pcoinsTip->GetBestAnchor(SAPLING));
+    } else if (!pblocktree->ReadUtxoCommitment(hashBest, utxoCommitmentTip)) {
+        // First start after an upgrade or a snapshot import: compute it once.
+        LogPrintf("Computing the chainstate commitment at %s...\n", hashBest.ToString());
+        uiInterface.InitMessage(_("Computing chainstate commitment..."));
+        FlushStateToDisk();
+        int64_t nStart = GetTimeMillis();
+        if (!coinsdb.GetUtxoCommitment(utxoCommitmentTip))
+            return false;
+        mapUtxoCommitmentsDirty[hashBest] = utxoCommitmentTip;
+        LogPrintf("Computed the chainstate commitment in %dms\n", GetTimeMillis() - nStart);
+    }
+    fUtxoCommitmentTip = true;
+    return true;
+}
+
+bool GetUtxoCommitment(const CBlockIndex* pindex, uint256& hash)
+{
+    AssertLockHeld(cs_main);
+    if (!fUtxoCommitmentTip || pindex == NULL)
+        return false;
+    if (pindex == chainActive.Tip()) {
+        hash = utxoCommitmentTip.GetHash();
+        return true;
+    }
+    // Only blocks on the active chain have a commitment.
+    if (!chainActive.Contains(pindex) || pindex->nHeight + UTXO_COMMITMENT_KEEP_BLOCKS <= chainActive.Height())
+        return false;
+    std::map<uint256, CUtxoCommitment>::const_iterator it = mapUtxoCommitmentsDirty.find(pindex->GetBlockHash());
+    if (it != mapUtxoCommitmentsDirty.end()) {
+        hash = it->second.GetHash();
+        return true;
+    }
+    CUtxoCommitment commitment;
+    if (setUtxoCommitmentsErase.count(pindex->GetBlockHash()) || !pblocktree->ReadUtxoCommitment(pindex->GetBlockHash(), commitment))
+        return false;
+    hash = commitment.GetHash();
+    return true;
+}
+
 /**
  * Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and
  * mempool.removeWithoutBranchId after this, with cs_main held.
@@ -2996,9 +3263,11 @@ bool static DisconnectTip(CValidationState &state, bool fBare = false) {
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
+        CUtxoCommitment commitmentDelta;
+        if (DisconnectBlock(block, pindexDelete, view, fUtxoCommitmentTip ? &commitmentDelta : NULL) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
+        DisconnectUtxoCommitment(pindexDelete, commitmentDelta);
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     uint256 sproutAnchorAfterDisconnect = pcoinsTip->GetBestAnchor(SPROUT);
@@ -3388,7 +3657,8 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     }
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view);
+        CUtxoCommitment commitmentDelta;
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, false, fUtxoCommitmentTip ? &commitmentDelta : NULL);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -3410,6 +3680,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
+        ConnectUtxoCommitment(pindexNew, commitmentDelta);
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
@@ -4278,7 +4549,8 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
 
 bool CheckBlock(const CBlock& block, CValidationState& state,
                 libzcash::ProofVerifier& verifier,
-                bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSizeLimits)
+                bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSizeLimits,
+                bool fParallelProofs)
 {
     // These are checks that are independent of context.
 
@@ -4327,10 +4599,27 @@ bool CheckBlock(const CBlock& block, CValidationState& state,
                 return state.DoS(100, error("CheckBlock(): more than one coinbase"),
                                  REJECT_INVALID, "bad-cb-multiple");
 
-        // Check transactions
-        BOOST_FOREACH(const CTransaction& tx, block.vtx)
-            if (!CheckTransaction(tx, state, verifier))
+        // Check transactions. JoinSplit proofs of the whole block are fanned
+        // out to the proof-check workers while the remaining transactions
+        // are checked here.
+        bool fQueueProofs = fParallelProofs && nScriptCheckThreads;
+        CCheckQueueControl<CProofCheck> control(fQueueProofs ? &proofcheckqueue : NULL);
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+            std::vector<CProofCheck> vProofChecks;
+            if (!CheckTransaction(tx, state, verifier, fQueueProofs ? &vProofChecks : NULL))
                 return error("CheckBlock(): CheckTransaction failed");
+            control.Add(vProofChecks);
+        }
+
+        if (!control.Wait()) {
+            // A worker only reports pass/fail. Re-check serially so the first
+            // failing transaction in block order sets the reject reason.
+            BOOST_FOREACH(const CTransaction& tx, block.vtx)
+                if (!CheckTransaction(tx, state, verifier))
+                    return error("CheckBlock(): CheckTransaction failed");
+            return state.DoS(100, error("CheckBlock(): joinsplit proof verification failed"),
+                             REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+        }
 
         unsigned int nSigOps = 0;
         BOOST_FOREACH(const CTransaction& tx, block.vtx)
@@ -4404,13 +4693,21 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     const int nHeight = pindexPrev == NULL ? 0 : pindexPrev->nHeight + 1;
     const Consensus::Params& consensusParams = Params().GetConsensus();
 
+    // The joinSplitSig of every Sprout transaction and the Sapling proofs are
+    // collected over the whole block and verified on the proof-check workers
+    // while the remaining contextual rules are checked here.
+    CCheckQueueControl<CProofCheck> control(nScriptCheckThreads ? &proofcheckqueue : NULL);
+
     // Check that all transactions are finalized
     BOOST_FOREACH(const CTransaction& tx, block.vtx) {
 
         // Check transaction contextually against consensus rules at block height
-        if (!ContextualCheckTransaction(tx, state, nHeight, 100)) {
+        std::vector<CProofCheck> vProofChecks;
+        if (!ContextualCheckTransaction(tx, state, nHeight, 100, IsInitialBlockDownload,
+                                        nScriptCheckThreads ? &vProofChecks : NULL)) {
             return false; // Failure reason has been set in validation state object
         }
+        control.Add(vProofChecks);
 
         int nLockTimeFlags = 0;
         int64_t nLockTimeCutoff = (nLockTimeFlags & LOCKTIME_MEDIAN_TIME_PAST)
@@ -4434,6 +4731,19 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
         }
     }
 
+    if (!control.Wait()) {
+        // A worker only reports pass/fail. Re-check serially so the first
+        // failing transaction in block order sets the reject reason, exactly
+        // as it would without proof-check threads.
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+            if (!ContextualCheckTransaction(tx, state, nHeight, 100)) {
+                return false;
+            }
+        }
+        return state.DoS(100, error("%s: joinsplit signature or Sapling proof verification failed", __func__),
+                         REJECT_INVALID, "bad-txns-sapling-proof-invalid");
+    }
+
     return true;
 }
 
@@ -5734,7 +6044,8 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoins(inv.hash);
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) || // Best effort: only try output 0 and 1
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash);
@@ -6587,15 +6898,37 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        // Verify the proofs and signatures of a shielded transaction before
+        // taking cs_main, so that other cs_main users do not queue up behind
+        // milliseconds of SNARK verification. A failure here is handled below
+        // exactly like a rejection by AcceptToMemoryPool.
+        CValidationState state;
+        // Skipped during IBD, where ContextualCheckTransaction verifies nothing;
+        // IsInitialBlockDownload latches to false, so it cannot flip back
+        // before AcceptToMemoryPool runs.
+        boost::optional<uint32_t> preVerifiedBranchId;
+        if (!tx.vjoinsplit.empty() || !tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) {
+            bool fSkip;
+            int nextBlockHeight;
+            {
+                LOCK(cs_main);
+                fSkip = AlreadyHave(inv) || IsInitialBlockDownload();
+                nextBlockHeight = chainActive.Height() + 1;
+            }
+            if (!fSkip && PreVerifyTransaction(tx, state, nextBlockHeight)) {
+                preVerifiedBranchId = CurrentEpochBranchId(nextBlockHeight, Params().GetConsensus());
+            }
+        }
+
         LOCK(cs_main);
 
         bool fMissingInputs = false;
-        CValidationState state;
 
         pfrom->setAskFor.erase(inv.hash);
         mapAlreadyAskedFor.erase(inv);
 
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs))
+        if (!AlreadyHave(inv) && state.IsValid() &&
+            AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs, false, preVerifiedBranchId))
         {
             mempool.check(pcoinsTip);
             RelayTransaction(tx);
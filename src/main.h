@@ -41,8 +41,11 @@
 class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
+class CCoinsViewDB;
 class CInv;
+class CProofCheck;
 class CScriptCheck;
+class CTxUndo;
 class CValidationInterface;
 class CValidationState;
 class PrecomputedTransactionData;
@@ -95,6 +98,10 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 4096;
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Percentage of the coins cache limit kept resident, least recently used entries evicted first, when the cache fills up. */
+static const unsigned int COINS_CACHE_RETAIN_PERCENT = 50;
+/** Number of most recent blocks whose chainstate commitment is kept in the block tree database. */
+static const int UTXO_COMMITMENT_KEEP_BLOCKS = 2880;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
@@ -228,6 +235,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the shielded proof checking thread */
+void ThreadProofCheck();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -273,9 +282,20 @@ void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
 
-/** (try to) add transaction to memory pool **/
+/**
+ * Run the context-free proof checks and the signature checks of
+ * AcceptToMemoryPool ahead of time, without holding cs_main. On success the
+ * transaction may be passed to AcceptToMemoryPool together with the consensus
+ * branch of nextBlockHeight so that its proofs are not verified again.
+ */
+bool PreVerifyTransaction(const CTransaction& tx, CValidationState &state, int nextBlockHeight);
+
+/** (try to) add transaction to memory pool
+ *  If preVerifiedBranchId matches the consensus branch of the next block, the
+ *  transaction's proofs were already checked by PreVerifyTransaction. **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectAbsurdFee=false);
+                        bool* pfMissingInputs, bool fRejectAbsurdFee=false,
+                        const boost::optional<uint32_t>& preVerifiedBranchId = boost::none);
 
 
 struct CNodeStateStats {
@@ -362,17 +382,41 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, cons
                            const Consensus::Params& consensusParams, uint32_t consensusBranchId,
                            std::vector<CScriptCheck> *pvChecks = NULL);
 
-/** Check a transaction contextually against a set of consensus rules */
+/**
+ * Check a transaction contextually against a set of consensus rules.
+ * If pvProofChecks is not NULL, the joinSplitSig, Sapling proof and binding
+ * signature checks are pushed onto it instead of being performed inline.
+ */
 bool ContextualCheckTransaction(const CTransaction& tx, CValidationState &state, int nHeight, int dosLevel,
-                                bool (*isInitBlockDownload)() = IsInitialBlockDownload);
+                                bool (*isInitBlockDownload)() = IsInitialBlockDownload,
+                                std::vector<CProofCheck> *pvProofChecks = NULL);
+
+/** Verify the Ed25519 joinSplitSig of a transaction over its signature hash */
+bool CheckJoinSplitSig(const CTransaction& tx, const uint256& dataToBeSigned, CValidationState &state, int dosLevel);
+
+/**
+ * Verify the Sapling spend/output proofs and binding signature of a transaction.
+ * The verification context cannot be shared across transactions: it accumulates
+ * the binding validating key from this transaction's value commitments and
+ * valueBalance, and the binding signature is over this transaction's sighash.
+ */
+bool CheckSaplingProofs(const CTransaction& tx, const uint256& dataToBeSigned, CValidationState &state);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
 
+/** Like UpdateCoins, but moves the coins spent by tx into txundo */
+void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txundo, int nHeight);
+
 /** Transaction validation functions */
 
 /** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, CValidationState& state, libzcash::ProofVerifier& verifier);
+/**
+ * Context-independent transaction checks. If pvProofChecks is not NULL, the
+ * JoinSplit proofs are pushed onto it instead of being verified inline.
+ */
+bool CheckTransaction(const CTransaction& tx, CValidationState& state, libzcash::ProofVerifier& verifier,
+                      std::vector<CProofCheck> *pvProofChecks = NULL);
 bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state);
 
 /** Check for standard transaction types
@@ -437,8 +481,8 @@ private:
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), consensusBranchId(0), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, uint32_t consensusBranchIdIn, PrecomputedTransactionData* txdataIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, uint32_t consensusBranchIdIn, PrecomputedTransactionData* txdataIn) :
+        scriptPubKey(outIn.scriptPubKey), amount(outIn.nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), consensusBranchId(consensusBranchIdIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
@@ -458,6 +502,48 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the proof and signature checks of one transaction:
+ * either the proof of a single JoinSplit, or the signature-hash dependent
+ * checks, i.e. the Ed25519 joinSplitSig and/or the Sapling spend and output
+ * proofs plus the binding signature. The librustzcash verification context
+ * accumulates value commitments across a whole transaction, so a transaction
+ * is the smallest unit of Sapling work.
+ * Note that this stores references to the transaction and the verifier.
+ */
+class CProofCheck
+{
+private:
+    const CTransaction *ptx;
+    uint256 dataToBeSigned;
+    bool fJoinSplitSig;
+    bool fSaplingProofs;
+    size_t nJoinSplit;
+    libzcash::ProofVerifier *pverifier;
+
+public:
+    CProofCheck(): ptx(NULL), fJoinSplitSig(false), fSaplingProofs(false), nJoinSplit(0), pverifier(NULL) {}
+    CProofCheck(const CTransaction& txIn, const uint256& dataToBeSignedIn,
+                bool fJoinSplitSigIn, bool fSaplingProofsIn) :
+        ptx(&txIn), dataToBeSigned(dataToBeSignedIn),
+        fJoinSplitSig(fJoinSplitSigIn), fSaplingProofs(fSaplingProofsIn),
+        nJoinSplit(0), pverifier(NULL) { }
+    CProofCheck(const CTransaction& txIn, size_t nJoinSplitIn, libzcash::ProofVerifier& verifierIn) :
+        ptx(&txIn), fJoinSplitSig(false), fSaplingProofs(false),
+        nJoinSplit(nJoinSplitIn), pverifier(&verifierIn) { }
+
+    bool operator()();
+
+    void swap(CProofCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(dataToBeSigned, check.dataToBeSigned);
+        std::swap(fJoinSplitSig, check.fJoinSplitSig);
+        std::swap(fSaplingProofs, check.fSaplingProofs);
+        std::swap(nJoinSplit, check.nJoinSplit);
+        std::swap(pverifier, check.pverifier);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
@@ -478,14 +564,29 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
  *  re-derivation (option B trustless bootstrap). Suppresses side effects on GLOBAL
  *  state a scratch replay must not touch: writing the live txindex, mutating the
  *  shared block index (undo write / RaiseValidity), and firing the
- *  validation-interface signals. Default false => normal connection is unchanged. */
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false, bool fScratchView = false);
+ *  validation-interface signals. Default false => normal connection is unchanged.
+ *  pcommitment: when set, the block's changes to the rolling chainstate
+ *  commitment are collected in it. */
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false, bool fScratchView = false, CUtxoCommitment* pcommitment = NULL);
 
-/** Context-independent validity checks */
+/** Load the rolling chainstate commitment of the tip, computing it from
+ *  coinsdb when none was stored yet. Call once the chainstate is loaded. */
+bool LoadUtxoCommitment(const CCoinsViewDB& coinsdb);
+
+/** Look up the chainstate commitment (CUtxoCommitment::GetHash()) as of a
+ *  block on the active chain, within the last UTXO_COMMITMENT_KEEP_BLOCKS. */
+bool GetUtxoCommitment(const CBlockIndex* pindex, uint256& hash);
+
+/**
+ * Context-independent validity checks.
+ * fParallelProofs verifies the JoinSplit proofs on the proof-check workers; the
+ * caller must hold cs_main, which serializes use of the proof-check queue.
+ */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
 bool CheckBlock(const CBlock& block, CValidationState& state,
                 libzcash::ProofVerifier& verifier,
-                bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSizeLimits = true);
+                bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSizeLimits = true,
+                bool fParallelProofs = false);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex *pindexPrev);
@@ -5,6 +5,9 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include "prevector.h"
+#include "support/allocators/pool.h"
+
 #include <stdlib.h>
 
 #include <map>
@@ -115,6 +118,20 @@ static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(boost_unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+template<typename X, typename Y, typename Z, typename E, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z, E, PoolAllocator<std::pair<const X, Y>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    // The nodes live in the pool's chunks. Blocks the pool holds but has not
+    // handed out (freed nodes, the tail of the last chunk) are reused before
+    // any new chunk is allocated, so they are not counted: evicting entries
+    // makes room even though the chunks are kept. The chunks themselves are
+    // tracked in a std::list (next, prev and chunk pointer per node).
+    const PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>* pool_resource = m.get_allocator().resource();
+    size_t usage_resource = MallocUsage(sizeof(void*) * 3) * pool_resource->NumAllocatedChunks();
+    size_t usage_chunks = MallocUsage(pool_resource->ChunkSizeBytes()) * pool_resource->NumAllocatedChunks() - pool_resource->NumUnusedBytes();
+    return usage_resource + usage_chunks + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
 }
 
 #endif
@@ -0,0 +1,147 @@
+// Copyright (c) 2026 The Zclassic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "proofcache.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
+#include "random.h"
+#include "util.h"
+
+#include <cstring>
+
+#include <boost/thread.hpp>
+
+namespace {
+
+enum ProofCacheType : unsigned char {
+    PROOF_CACHE_SPROUT = 's',
+    PROOF_CACHE_SAPLING = 'S',
+};
+
+/**
+ * We're hashing a nonce into the entries themselves, so we don't need extra
+ * blinding in the set hash computation.
+ */
+class CProofCacheHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        static_assert(hash_select < 8, "CProofCacheHasher only has 8 hashes available.");
+        uint32_t u;
+        std::memcpy(&u, key.begin() + 4 * hash_select, 4);
+        return u;
+    }
+};
+
+/**
+ * Same layout and locking as the signature cache: lookups and erasing take
+ * the shared side of the lock, and erased entries are only reclaimed by
+ * later inserts.
+ */
+class CProofCache
+{
+private:
+    //! Entries are SHA256(nonce || type || txid || consensus branch id):
+    uint256 nonce;
+    typedef CuckooCache::cache<uint256, CProofCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_proofcache;
+
+public:
+    CProofCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    void
+    ComputeEntry(uint256& entry, ProofCacheType type, const uint256& txid, uint32_t consensusBranchId)
+    {
+        unsigned char branchId[4];
+        WriteLE32(branchId, consensusBranchId);
+        unsigned char typeByte = type;
+        CSHA256().Write(nonce.begin(), 32).Write(&typeByte, 1).Write(txid.begin(), 32).Write(branchId, 4).Finalize(entry.begin());
+    }
+
+    bool
+    Get(const uint256& entry, const bool erase)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_proofcache);
+        return setValid.contains(entry, erase);
+    }
+
+    void Set(const uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_proofcache);
+        setValid.insert(entry);
+    }
+
+    uint32_t setup_bytes(size_t n)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_proofcache);
+        return setValid.setup_bytes(n);
+    }
+};
+
+CProofCache& GetProofCache()
+{
+    static CProofCache proofCache;
+    return proofCache;
+}
+
+}
+
+// To be called once in AppInit2/TestingSetup to initialize the proof cache
+void InitProofCache()
+{
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxproofcachesize", DEFAULT_MAX_PROOF_CACHE_SIZE)), MAX_MAX_PROOF_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = GetProofCache().setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for proof cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>20, nElems);
+}
+
+bool IsSproutProofCached(const uint256& txid)
+{
+    CProofCache& proofCache = GetProofCache();
+    uint256 entry;
+    proofCache.ComputeEntry(entry, PROOF_CACHE_SPROUT, txid, 0);
+    return proofCache.Get(entry, false);
+}
+
+void CacheSproutProof(const uint256& txid)
+{
+    CProofCache& proofCache = GetProofCache();
+    uint256 entry;
+    proofCache.ComputeEntry(entry, PROOF_CACHE_SPROUT, txid, 0);
+    proofCache.Set(entry);
+}
+
+bool IsSaplingProofCached(const uint256& txid, uint32_t consensusBranchId)
+{
+    CProofCache& proofCache = GetProofCache();
+    uint256 entry;
+    proofCache.ComputeEntry(entry, PROOF_CACHE_SAPLING, txid, consensusBranchId);
+    return proofCache.Get(entry, false);
+}
+
+void CacheSaplingProof(const uint256& txid, uint32_t consensusBranchId)
+{
+    CProofCache& proofCache = GetProofCache();
+    uint256 entry;
+    proofCache.ComputeEntry(entry, PROOF_CACHE_SAPLING, txid, consensusBranchId);
+    proofCache.Set(entry);
+}
+
+void EraseCachedProofs(const uint256& txid, uint32_t consensusBranchId)
+{
+    CProofCache& proofCache = GetProofCache();
+    uint256 entry;
+    proofCache.ComputeEntry(entry, PROOF_CACHE_SPROUT, txid, 0);
+    proofCache.Get(entry, true);
+    proofCache.ComputeEntry(entry, PROOF_CACHE_SAPLING, txid, consensusBranchId);
+    proofCache.Get(entry, true);
+}
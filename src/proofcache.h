@@ -0,0 +1,42 @@
+// Copyright (c) 2026 The Zclassic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PROOFCACHE_H
+#define BITCOIN_PROOFCACHE_H
+
+#include "uint256.h"
+
+#include <stdint.h>
+
+// DoS prevention: limit cache size to 10MiB (over 300000 entries, as each
+// entry takes a little over 32 bytes).
+static const unsigned int DEFAULT_MAX_PROOF_CACHE_SIZE = 10;
+// Maximum proof cache size allowed
+static const int64_t MAX_MAX_PROOF_CACHE_SIZE = 16384;
+
+/**
+ * Valid proof cache, to avoid running the zk-SNARK verifiers twice for every
+ * shielded transaction (once when accepted into the memory pool, and again
+ * when its block is checked and connected).
+ *
+ * Entries are keyed by txid, which commits to every proof and signature of
+ * the transaction. JoinSplit proofs do not depend on the consensus branch.
+ * Sapling entries also cover the spend authorization and binding signatures,
+ * which sign a branch-specific hash, so they are keyed by branch as well.
+ */
+void InitProofCache();
+
+bool IsSproutProofCached(const uint256& txid);
+void CacheSproutProof(const uint256& txid);
+
+bool IsSaplingProofCached(const uint256& txid, uint32_t consensusBranchId);
+void CacheSaplingProof(const uint256& txid, uint32_t consensusBranchId);
+
+/**
+ * Let later inserts reclaim the entries of a transaction whose block has been
+ * connected. They are still reported as cached until that happens.
+ */
+void EraseCachedProofs(const uint256& txid, uint32_t consensusBranchId);
+
+#endif // BITCOIN_PROOFCACHE_H
@@ -13,8 +13,10 @@
 #include "main.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
 
 #include <stdint.h>
@@ -382,7 +384,8 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
             "  \"bits\" : \"1d00ffff\", (string) The bits\n"
             "  \"difficulty\" : x.xxx,  (numeric) The difficulty\n"
             "  \"previousblockhash\" : \"hash\",  (string) The hash of the previous block\n"
-            "  \"nextblockhash\" : \"hash\"       (string) The hash of the next block\n"
+            "  \"nextblockhash\" : \"hash\",      (string) The hash of the next block\n"
+            "  \"utxocommitment\" : \"hash\"      (string) Rolling commitment to the chainstate after this block; only for recent blocks of the active chain\n"
             "}\n"
             "\nResult (for verbose=false):\n"
             "\"data\"             (string) A string that is serialized, hex-encoded data for block 'hash'.\n"
@@ -413,7 +416,11 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
         return strHex;
     }
 
-    return blockheaderToJSON(pblockindex);
+    UniValue result = blockheaderToJSON(pblockindex);
+    uint256 hashUtxoCommitment;
+    if (GetUtxoCommitment(pblockindex, hashUtxoCommitment))
+        result.push_back(Pair("utxocommitment", hashUtxoCommitment.GetHex()));
+    return result;
 }
 
 UniValue getblock(const UniValue& params, bool fHelp)
@@ -535,7 +542,7 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
         throw runtime_error(
             "gettxoutsetinfo\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time; getblockchaininfo reports its progress.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -545,6 +552,7 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
             "  \"hash_serialized\": \"hash\",   (string) The serialized hash of the transparent UTXO set\n"
             "  \"hash_chainstate_full\": \"hash\", (string) Commitment over the whole chainstate (transparent UTXOs incl. per-coin height/coinbase/version metadata, plus Sprout/Sapling anchors and nullifier sets); this is the value a bootstrap fast-sync anchor commits to\n"
+            "  \"utxo_commitment\": \"hash\",    (string) Rolling commitment to the same state as hash_chainstate_full, kept up to date block by block (see getblockheader)\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
@@ -564,6 +572,13 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
         ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
         ret.push_back(Pair("hash_chainstate_full", stats.hashSerializedFull.GetHex()));
+        {
+            LOCK(cs_main);
+            BlockMap::const_iterator it = mapBlockIndex.find(stats.hashBlock);
+            uint256 hashUtxoCommitment;
+            if (it != mapBlockIndex.end() && GetUtxoCommitment(it->second, hashUtxoCommitment))
+                ret.push_back(Pair("utxo_commitment", hashUtxoCommitment.GetHex()));
+        }
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     }
     return ret;
@@ -618,33 +633,36 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    if (n < 0)
+        return NullUniValue;
+    COutPoint out(hash, n);
+
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) {
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
+        }
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin)) {
             return NullUniValue;
+        }
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("version", coin.nVersion));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
 
     return ret;
 }
@@ -777,6 +795,7 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "     \"since\": ttt             (numeric) unix time the hold began (only when held)\n"
             "  },\n"
             "  \"size_on_disk\": xxxxxx,       (numeric) the estimated size of the block and undo files on disk\n"
+            "  \"utxo_scan_progress\": xxxx, (numeric) progress [0..1] of a running UTXO set scan (gettxoutsetinfo, bootstrap snapshot checks); only present while one runs\n"
             "  \"commitments\": xxxxxx,    (numeric) the current number of note commitments in the commitment tree\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
@@ -830,6 +849,9 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("chainwork",             chainActive.Tip()->nChainWork.GetHex()));
     obj.push_back(Pair("pruned",                fPruneMode));
     obj.push_back(Pair("size_on_disk",          CalculateCurrentUsage()));
+    const double dUtxoScanProgress = GetCoinsStatsProgress();
+    if (dUtxoScanProgress >= 0)
+        obj.push_back(Pair("utxo_scan_progress", dUtxoScanProgress));
 
     SproutMerkleTree tree;
     pcoinsTip->GetSproutAnchorAt(pcoinsTip->GetBestAnchor(SPROUT), tree);
@@ -1071,6 +1093,38 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+UniValue getsigcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns details on the signature cache.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": xxxxx             (numeric) Number of slots in the cache\n"
+            "  \"usage\": xxxxx               (numeric) Memory allocated for the cache, in bytes\n"
+            "  \"bytesperentry\": x.xxx       (numeric) Memory used per slot, in bytes\n"
+            "  \"lookups\": xxxxx             (numeric) Signature checks that consulted the cache\n"
+            "  \"hits\": xxxxx                (numeric) Signature checks answered by the cache\n"
+            "  \"hitrate\": x.xxx             (numeric) Fraction of lookups that were hits\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "")
+        );
+
+    SignatureCacheStats stats = GetSignatureCacheStats();
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", (int64_t)stats.nEntries));
+    ret.push_back(Pair("usage", (int64_t)stats.nBytes));
+    ret.push_back(Pair("bytesperentry", stats.nEntries ? (double)stats.nBytes / stats.nEntries : 0.0));
+    ret.push_back(Pair("lookups", (int64_t)stats.nLookups));
+    ret.push_back(Pair("hits", (int64_t)stats.nHits));
+    ret.push_back(Pair("hitrate", stats.nLookups ? (double)stats.nHits / stats.nLookups : 0.0));
+    return ret;
+}
+
 UniValue finalizeblock(const UniValue& params, bool fHelp) {
     if (fHelp || params.size() != 1) {
         throw std::runtime_error(
@@ -1359,6 +1413,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
+    { "blockchain",         "getsigcacheinfo",        &getsigcacheinfo,        true  },
     { "blockchain",         "gettxout",               &gettxout,               true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
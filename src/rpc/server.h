@@ -23,6 +23,8 @@
 class AsyncRPCQueue;
 class CRPCCommand;
 
+static const int DEFAULT_RPC_ASYNC_THREADS = 1;
+
 namespace RPCServer
 {
     void OnStarted(boost::function<void ()> slot);
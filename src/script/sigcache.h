@@ -8,11 +8,14 @@
 
 #include "script/interpreter.h"
 
+#include <stdint.h>
 #include <vector>
 
-// DoS prevention: limit cache size to less than 40MB (over 500000
-// entries on 64-bit systems).
+// DoS prevention: limit cache size to 40MiB (over 1300000 entries, as each
+// entry takes a little over 32 bytes).
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
+// Maximum sig cache size allowed
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
 class CPubKey;
 
@@ -27,4 +30,16 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Signature cache counters, reported by getsigcacheinfo */
+struct SignatureCacheStats
+{
+    uint32_t nEntries; //!< Slots in the cache table
+    size_t nBytes;     //!< Memory allocated for the table and its flags
+    uint64_t nLookups;
+    uint64_t nHits;
+};
+
+void InitSignatureCache();
+SignatureCacheStats GetSignatureCacheStats();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -534,4 +534,33 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     }
 }
 
+BOOST_AUTO_TEST_CASE(blocked_bloom_filter)
+{
+    CBlockedBloomFilter filter(10000);
+    BOOST_CHECK_EQUAL(filter.capacity(), 10000);
+    std::vector<uint256> data;
+    for (int i = 0; i < 10000; i++) {
+        data.push_back(GetRandHash());
+        filter.insert(data.back());
+    }
+    BOOST_CHECK_EQUAL(filter.size(), 10000);
+    // No false negatives:
+    for (size_t i = 0; i < data.size(); i++) {
+        BOOST_CHECK(filter.contains(data[i]));
+    }
+    // Below 0.5% false positives at capacity; more than 1% means something
+    // is broken.
+    int nHits = 0;
+    for (int i = 0; i < 10000; i++) {
+        if (filter.contains(GetRandHash()))
+            ++nHits;
+    }
+    BOOST_TEST_MESSAGE("BlockedBloomFilter got " << nHits << " false positives (<50 expected)");
+    BOOST_CHECK(nHits < 100);
+
+    // An empty filter contains nothing.
+    CBlockedBloomFilter empty;
+    BOOST_CHECK(!empty.contains(data[0]));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -27,7 +27,7 @@ class CCoinsViewTest : public CCoinsView
     uint256 hashBestBlock_;
     uint256 hashBestSproutAnchor_;
     uint256 hashBestSaplingAnchor_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
     std::map<uint256, SproutMerkleTree> mapSproutAnchors_;
     std::map<uint256, SaplingMerkleTree> mapSaplingAnchors_;
     std::map<uint256, bool> mapSproutNullifiers_;
@@ -107,29 +107,29 @@ public:
         }
     }
 
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
+    bool HaveCoin(const COutPoint& outpoint) const
     {
-        CCoins coins;
-        return GetCoins(txid, coins);
+        Coin coin;
+        return GetCoin(outpoint, coin);
     }
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    void BatchWriteNullifiers(CNullifiersMap& mapNullifiers, std::map<uint256, bool>& cacheNullifiers)
+    void BatchWriteNullifiers(CNullifiersMap& mapNullifiers, std::map<uint256, bool>& cacheNullifiers, bool fErase)
     {
         for (CNullifiersMap::iterator it = mapNullifiers.begin(); it != mapNullifiers.end(); ) {
             if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
@@ -140,12 +140,16 @@ public:
                     cacheNullifiers.erase(it->first);
                 }
             }
-            mapNullifiers.erase(it++);
+            if (fErase) {
+                mapNullifiers.erase(it++);
+            } else {
+                ++it;
+            }
         }
     }
 
     template<typename Tree, typename Map, typename MapEntry>
-    void BatchWriteAnchors(Map& mapAnchors, std::map<uint256, Tree>& cacheAnchors)
+    void BatchWriteAnchors(Map& mapAnchors, std::map<uint256, Tree>& cacheAnchors, bool fErase)
     {
         for (auto it = mapAnchors.begin(); it != mapAnchors.end(); ) {
             if (it->second.flags & MapEntry::DIRTY) {
@@ -159,7 +163,11 @@ public:
                     cacheAnchors.erase(it->first);
                 }
             }
-            mapAnchors.erase(it++);
+            if (fErase) {
+                mapAnchors.erase(it++);
+            } else {
+                ++it;
+            }
         }
     }
 
@@ -170,25 +178,30 @@ public:
                     CAnchorsSproutMap& mapSproutAnchors,
                     CAnchorsSaplingMap& mapSaplingAnchors,
                     CNullifiersMap& mapSproutNullifiers,
-                    CNullifiersMap& mapSaplingNullifiers)
+                    CNullifiersMap& mapSaplingNullifiers,
+                    bool fErase)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
                 // Same optimization used in CCoinsViewDB is to only write dirty entries.
-                map_[it->first] = it->second.coins;
-                if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && insecure_rand() % 3 == 0) {
                     // Randomly delete empty entries on write.
                     map_.erase(it->first);
                 }
             }
-            mapCoins.erase(it++);
+            if (fErase) {
+                mapCoins.erase(it++);
+            } else {
+                ++it;
+            }
         }
 
-        BatchWriteAnchors<SproutMerkleTree, CAnchorsSproutMap, CAnchorsSproutCacheEntry>(mapSproutAnchors, mapSproutAnchors_);
-        BatchWriteAnchors<SaplingMerkleTree, CAnchorsSaplingMap, CAnchorsSaplingCacheEntry>(mapSaplingAnchors, mapSaplingAnchors_);
+        BatchWriteAnchors<SproutMerkleTree, CAnchorsSproutMap, CAnchorsSproutCacheEntry>(mapSproutAnchors, mapSproutAnchors_, fErase);
+        BatchWriteAnchors<SaplingMerkleTree, CAnchorsSaplingMap, CAnchorsSaplingCacheEntry>(mapSaplingAnchors, mapSaplingAnchors_, fErase);
 
-        BatchWriteNullifiers(mapSproutNullifiers, mapSproutNullifiers_);
-        BatchWriteNullifiers(mapSaplingNullifiers, mapSaplingNullifiers_);
+        BatchWriteNullifiers(mapSproutNullifiers, mapSproutNullifiers_, fErase);
+        BatchWriteNullifiers(mapSaplingNullifiers, mapSaplingNullifiers_, fErase);
 
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
@@ -216,7 +229,7 @@ public:
                      memusage::DynamicUsage(cacheSproutNullifiers) +
                      memusage::DynamicUsage(cacheSaplingNullifiers);
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += it->second.coins.DynamicMemoryUsage();
+            ret += it->second.coin.DynamicMemoryUsage();
         }
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
@@ -768,7 +781,7 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
+// It will randomly create/update/delete Coin entries to a tip of caches, with
 // txids picked from a limited list of random 256-bit hashes. Occasionally, a
 // new tip is added to the stack of caches, or the tip is flushed and removed.
 //
@@ -780,13 +793,15 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool removed_all_caches = false;
     bool reached_4_caches = false;
     bool added_an_entry = false;
+    bool added_an_unspendable_entry = false;
     bool removed_an_entry = false;
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool synced_a_cache = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -804,36 +819,48 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         // Do a random modification.
         {
             uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
-                    added_an_entry = true;
+            Coin& coin = result[COutPoint(txid, 0)];
+            const Coin& entry = (insecure_rand() % 500 == 0) ? AccessByTxid(*stack.back(), txid) : stack.back()->AccessCoin(COutPoint(txid, 0));
+            BOOST_CHECK(coin == entry);
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                Coin newcoin;
+                newcoin.out.nValue = insecure_rand();
+                newcoin.nHeight = 1;
+                newcoin.nVersion = 1 + insecure_rand() % 4;
+                if (insecure_rand() % 16 == 0 && coin.IsSpent()) {
+                    newcoin.out.scriptPubKey.assign(1 + insecure_rand() % 64, OP_RETURN);
+                    BOOST_CHECK(newcoin.out.scriptPubKey.IsUnspendable());
+                    added_an_unspendable_entry = true;
                 } else {
-                    updated_an_entry = true;
+                    // Random sizes so we can test memory usage accounting
+                    newcoin.out.scriptPubKey.assign(insecure_rand() % 64, 0);
+                    if (coin.IsSpent()) {
+                        added_an_entry = true;
+                    } else {
+                        updated_an_entry = true;
+                    }
+                    coin = newcoin;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                stack.back()->AddCoin(COutPoint(txid, 0), std::move(newcoin), !coin.IsSpent() || insecure_rand() & 1);
             } else {
-                coins.Clear();
-                entry->Clear();
                 removed_an_entry = true;
+                coin.Clear();
+                stack.back()->SpendCoin(COutPoint(txid, 0));
             }
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    BOOST_CHECK(stack.back()->HaveCoinInCache(it->first));
+                    found_an_entry = true;
                 }
             }
             BOOST_FOREACH(const CCoinsViewCacheTest *test, stack) {
@@ -841,6 +868,18 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
             }
         }
 
+        if (insecure_rand() % 100 == 0) {
+            // Every 100 iterations, sync a cache while keeping its entries,
+            // and trim it to a random size.
+            if (stack.size() > 0 && insecure_rand() % 2 == 0) {
+                CCoinsViewCacheTest* cache = stack[insecure_rand() % stack.size()];
+                BOOST_CHECK(cache->Sync());
+                cache->Trim(insecure_rand() % (cache->DynamicMemoryUsage() + 1));
+                cache->SelfTest();
+                synced_a_cache = true;
+            }
+        }
+
         if (insecure_rand() % 100 == 0) {
             // Every 100 iterations, change the cache stack.
             if (stack.size() > 0 && insecure_rand() % 2 == 0) {
@@ -873,10 +912,69 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(removed_all_caches);
     BOOST_CHECK(reached_4_caches);
     BOOST_CHECK(added_an_entry);
+    BOOST_CHECK(added_an_unspendable_entry);
     BOOST_CHECK(removed_an_entry);
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(synced_a_cache);
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_sync_trim)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    uint256 txid = GetRandHash();
+    for (uint32_t i = 0; i < 8; i++) {
+        Coin coin;
+        coin.out.nValue = 1000 + i;
+        coin.out.scriptPubKey = CScript() << OP_TRUE;
+        cache.AddCoin(COutPoint(txid, i), std::move(coin), false);
+    }
+    cache.SpendCoin(COutPoint(txid, 7));
+
+    // Sync writes everything to the base but keeps the unspent entries.
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 7);
+    for (uint32_t i = 0; i < 7; i++) {
+        Coin coin;
+        BOOST_CHECK(base.GetCoin(COutPoint(txid, i), coin));
+        BOOST_CHECK_EQUAL(coin.out.nValue, 1000 + i);
+        BOOST_CHECK(cache.HaveCoinInCache(COutPoint(txid, i)));
+    }
+    BOOST_CHECK(!cache.HaveCoin(COutPoint(txid, 7)));
+    cache.SelfTest();
+
+    // Use the first outputs again so that they are the most recently used.
+    for (uint32_t i = 0; i < 3; i++) {
+        BOOST_CHECK(cache.HaveCoin(COutPoint(txid, i)));
+    }
+    // A dirty entry is never evicted.
+    Coin dirty;
+    dirty.out.nValue = 5;
+    cache.AddCoin(COutPoint(txid, 8), std::move(dirty), false);
+
+    // Trimming by a single byte evicts the least recently used coins only.
+    cache.Trim(cache.DynamicMemoryUsage() - 1);
+    cache.SelfTest();
+    BOOST_CHECK(!cache.HaveCoinInCache(COutPoint(txid, 3)));
+    for (uint32_t i = 0; i < 3; i++) {
+        BOOST_CHECK(cache.HaveCoinInCache(COutPoint(txid, i)));
+    }
+    BOOST_CHECK(cache.HaveCoinInCache(COutPoint(txid, 8)));
+
+    // Trimming everything keeps the dirty entry, and evicted coins are
+    // read back from the base.
+    cache.Trim(0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1);
+    BOOST_CHECK(cache.HaveCoinInCache(COutPoint(txid, 8)));
+    BOOST_CHECK_EQUAL(cache.AccessCoin(COutPoint(txid, 5)).out.nValue, 1005);
+
+    BOOST_CHECK(cache.Flush());
+    Coin coin;
+    BOOST_CHECK(base.GetCoin(COutPoint(txid, 8), coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, 5);
 }
 
 BOOST_AUTO_TEST_CASE(coins_coinbase_spends)
@@ -929,16 +1027,15 @@ BOOST_AUTO_TEST_CASE(coins_coinbase_spends)
 BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
 {
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
     std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
     stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
-    // Track the txids we've used and whether they have been spent or not
-    std::map<uint256, CAmount> coinbaseids;
-    std::set<uint256> alltxids;
+    // Track the outputs we've created that have not been spent yet
+    std::set<COutPoint> utxoset;
 
     for (unsigned int i = 0; i < NUM_SIMULATION_ITERATIONS; i++) {
         {
@@ -946,55 +1043,64 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
             tx.vin.resize(1);
             tx.vout.resize(1);
             tx.vout[0].nValue = i; //Keep txs unique
+            tx.nVersion = 1 + insecure_rand() % 2;
             unsigned int height = insecure_rand();
+            Coin spent;
 
             // 1/10 times create a coinbase
-            if (insecure_rand() % 10 == 0 || coinbaseids.size() < 10) {
-                coinbaseids[tx.GetHash()] = tx.vout[0].nValue;
+            if (insecure_rand() % 10 == 0 || utxoset.size() < 10) {
                 assert(CTransaction(tx).IsCoinBase());
             }
             // 9/10 times create a regular tx
             else {
-                uint256 prevouthash;
                 // equally likely to spend coinbase or non coinbase
-                std::set<uint256>::iterator txIt = alltxids.lower_bound(GetRandHash());
-                if (txIt == alltxids.end()) {
-                    txIt = alltxids.begin();
+                std::set<COutPoint>::iterator utxod = utxoset.lower_bound(COutPoint(GetRandHash(), 0));
+                if (utxod == utxoset.end()) {
+                    utxod = utxoset.begin();
                 }
-                prevouthash = *txIt;
 
-                // Construct the tx to spend the coins of prevouthash
-                tx.vin[0].prevout.hash = prevouthash;
-                tx.vin[0].prevout.n = 0;
+                // Construct the tx to spend the coin at utxod
+                tx.vin[0].prevout = *utxod;
 
-                // Update the expected result of prevouthash to know these coins are spent
-                CCoins& oldcoins = result[prevouthash];
-                oldcoins.Clear();
+                // Update the expected result to know this coin is spent
+                Coin& oldcoin = result[*utxod];
+                spent = oldcoin;
+                oldcoin.Clear();
 
-                alltxids.erase(prevouthash);
-                coinbaseids.erase(prevouthash);
+                utxoset.erase(utxod);
 
                 assert(!CTransaction(tx).IsCoinBase());
             }
-            // Track this tx to possibly spend later
-            alltxids.insert(tx.GetHash());
 
-            // Update the expected result to know about the new output coins
-            CCoins &coins = result[tx.GetHash()];
-            coins.FromTx(tx, height);
+            CTransaction ctx(tx);
+            COutPoint outpoint(ctx.GetHash(), 0);
+
+            // Track this output to possibly spend later
+            utxoset.insert(outpoint);
+
+            // Update the expected result to know about the new output coin
+            result[outpoint] = Coin(ctx.vout[0], height, ctx.IsCoinBase(), ctx.nVersion);
+
+            CTxUndo undo;
+            UpdateCoins(ctx, *(stack.back()), undo, height);
 
-            UpdateCoins(tx, *(stack.back()), height);
+            // The undo data must hold exactly the coin that was spent
+            if (ctx.IsCoinBase()) {
+                BOOST_CHECK(undo.vprevout.empty());
+            } else {
+                BOOST_CHECK_EQUAL(undo.vprevout.size(), 1);
+                BOOST_CHECK(undo.vprevout[0] == spent);
+                BOOST_CHECK(!undo.vprevout[0].IsSpent());
+            }
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                 } else {
-                    BOOST_CHECK(it->second.IsPruned());
-                 }
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
             }
         }
 
@@ -1022,57 +1128,48 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
     }
 }
 
-BOOST_AUTO_TEST_CASE(ccoins_serialization)
+BOOST_AUTO_TEST_CASE(coin_serialization)
 {
     // Good example
-    CDataStream ss1(ParseHex("0104835800816115944e077fe7c803cfa57f29b36bf87c1d358bb85e"), SER_DISK, CLIENT_VERSION);
-    CCoins cc1;
-    ss1 >> cc1;
-    BOOST_CHECK_EQUAL(cc1.nVersion, 1);
-    BOOST_CHECK_EQUAL(cc1.fCoinBase, false);
-    BOOST_CHECK_EQUAL(cc1.nHeight, 203998);
-    BOOST_CHECK_EQUAL(cc1.vout.size(), 2);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(0), false);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(1), true);
-    BOOST_CHECK_EQUAL(cc1.vout[1].nValue, 60000000000ULL);
-    BOOST_CHECK_EQUAL(HexStr(cc1.vout[1].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
+    CDataStream ss1(ParseHex("97f23c01835800816115944e077fe7c803cfa57f29b36bf87c1d35"), SER_DISK, CLIENT_VERSION);
+    Coin c1;
+    ss1 >> c1;
+    BOOST_CHECK_EQUAL(c1.IsCoinBase(), false);
+    BOOST_CHECK_EQUAL(c1.nHeight, 203998);
+    BOOST_CHECK_EQUAL(c1.nVersion, 1);
+    BOOST_CHECK_EQUAL(c1.out.nValue, 60000000000ULL);
+    BOOST_CHECK_EQUAL(HexStr(c1.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
 
     // Good example
-    CDataStream ss2(ParseHex("0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b"), SER_DISK, CLIENT_VERSION);
-    CCoins cc2;
-    ss2 >> cc2;
-    BOOST_CHECK_EQUAL(cc2.nVersion, 1);
-    BOOST_CHECK_EQUAL(cc2.fCoinBase, true);
-    BOOST_CHECK_EQUAL(cc2.nHeight, 120891);
-    BOOST_CHECK_EQUAL(cc2.vout.size(), 17);
-    for (int i = 0; i < 17; i++) {
-        BOOST_CHECK_EQUAL(cc2.IsAvailable(i), i == 4 || i == 16);
-    }
-    BOOST_CHECK_EQUAL(cc2.vout[4].nValue, 234925952);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[4].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("61b01caab50f1b8e9c50a5057eb43c2d9563a4ee"))))));
-    BOOST_CHECK_EQUAL(cc2.vout[16].nValue, 110397);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[16].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
+    CDataStream ss2(ParseHex("8ddf7702bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4"), SER_DISK, CLIENT_VERSION);
+    Coin c2;
+    ss2 >> c2;
+    BOOST_CHECK_EQUAL(c2.IsCoinBase(), true);
+    BOOST_CHECK_EQUAL(c2.nHeight, 120891);
+    BOOST_CHECK_EQUAL(c2.nVersion, 2);
+    BOOST_CHECK_EQUAL(c2.out.nValue, 110397);
+    BOOST_CHECK_EQUAL(HexStr(c2.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
+
+    // Round trip
+    CDataStream ss2out(SER_DISK, CLIENT_VERSION);
+    ss2out << c2;
+    BOOST_CHECK_EQUAL(HexStr(ss2out.begin(), ss2out.end()), "8ddf7702bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4");
 
     // Smallest possible example
-    CDataStream ssx(SER_DISK, CLIENT_VERSION);
-    BOOST_CHECK_EQUAL(HexStr(ssx.begin(), ssx.end()), "");
-
-    CDataStream ss3(ParseHex("0002000600"), SER_DISK, CLIENT_VERSION);
-    CCoins cc3;
-    ss3 >> cc3;
-    BOOST_CHECK_EQUAL(cc3.nVersion, 0);
-    BOOST_CHECK_EQUAL(cc3.fCoinBase, false);
-    BOOST_CHECK_EQUAL(cc3.nHeight, 0);
-    BOOST_CHECK_EQUAL(cc3.vout.size(), 1);
-    BOOST_CHECK_EQUAL(cc3.IsAvailable(0), true);
-    BOOST_CHECK_EQUAL(cc3.vout[0].nValue, 0);
-    BOOST_CHECK_EQUAL(cc3.vout[0].scriptPubKey.size(), 0);
+    CDataStream ss3(ParseHex("00000006"), SER_DISK, CLIENT_VERSION);
+    Coin c3;
+    ss3 >> c3;
+    BOOST_CHECK_EQUAL(c3.IsCoinBase(), false);
+    BOOST_CHECK_EQUAL(c3.nHeight, 0);
+    BOOST_CHECK_EQUAL(c3.nVersion, 0);
+    BOOST_CHECK_EQUAL(c3.out.nValue, 0);
+    BOOST_CHECK_EQUAL(c3.out.scriptPubKey.size(), 0);
 
     // scriptPubKey that ends beyond the end of the stream
-    CDataStream ss4(ParseHex("0002000800"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss4(ParseHex("00000007"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc4;
-        ss4 >> cc4;
+        Coin c4;
+        ss4 >> c4;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
     }
@@ -1082,10 +1179,41 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     uint64_t x = 3000000000ULL;
     tmp << VARINT(x);
     BOOST_CHECK_EQUAL(HexStr(tmp.begin(), tmp.end()), "8a95c0bb00");
-    CDataStream ss5(ParseHex("0002008a95c0bb0000"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss5(ParseHex("0000008a95c0bb0000"), SER_DISK, CLIENT_VERSION);
+    try {
+        Coin c5;
+        ss5 >> c5;
+        BOOST_CHECK_MESSAGE(false, "We should have thrown");
+    } catch (const std::ios_base::failure& e) {
+    }
+}
+
+BOOST_AUTO_TEST_CASE(txundo_serialization)
+{
+    // Spent coins that were the last unspent output of their transaction
+    // carry their metadata; the others are written with a zero height and
+    // read back with nVersion cleared.
+    CTxUndo undo;
+    CTxOut out;
+    out.nValue = 5000;
+    out.scriptPubKey = CScript() << OP_1;
+    undo.vprevout.push_back(Coin(out, 1234, true, 2));
+    undo.vprevout.push_back(Coin(out, 0, false, 0));
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << undo;
+    CTxUndo undo2;
+    ss >> undo2;
+    BOOST_CHECK_EQUAL(undo2.vprevout.size(), 2);
+    BOOST_CHECK(undo2.vprevout[0] == undo.vprevout[0]);
+    BOOST_CHECK(undo2.vprevout[1] == undo.vprevout[1]);
+
+    // An absurd number of records is rejected before allocating them
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    WriteCompactSize(ss2, MAX_INPUTS_PER_BLOCK + 1);
     try {
-        CCoins cc5;
-        ss5 >> cc5;
+        CTxUndo undo3;
+        ss2 >> undo3;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
     }
@@ -8,6 +8,8 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/muhash.h"
+#include "hash.h"
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
@@ -131,6 +133,22 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j) {
+            in[j] = insecure_rand();
+        }
+        for (int j = 0; j < i; ++j) {
+            CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+        }
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -248,4 +266,55 @@ BOOST_AUTO_TEST_CASE(hmac_sha512_testvectors) {
                    "b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58");
 }
 
+static std::string MuHashHex(MuHash3072 muhash)
+{
+    unsigned char out[MuHash3072::OUTPUT_SIZE];
+    muhash.Finalize(out);
+    return HexStr(out, out + sizeof(out));
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    const unsigned char a = 'a', b = 'b', c = 'c';
+
+    MuHash3072 empty;
+    BOOST_CHECK_EQUAL(MuHashHex(empty), "c85525462fdcf30a2c18d6f4b92923000974355c2477f59594d2c205a1d25add");
+
+    MuHash3072 ab;
+    ab.Insert(&a, 1).Insert(&b, 1);
+    BOOST_CHECK_EQUAL(MuHashHex(ab), "5693661efcb101a2faa5dd944dd8540d4ecf85d19ee953d6ad8a64c983c4d5f6");
+
+    // Order does not matter, and a removal may come before its insertion.
+    MuHash3072 bca;
+    bca.Remove(&c, 1).Insert(&b, 1).Insert(&c, 1).Insert(&a, 1);
+    BOOST_CHECK_EQUAL(MuHashHex(bca), MuHashHex(ab));
+
+    // Combining the hashes of two sets gives the hash of their union.
+    MuHash3072 justa, justb;
+    justa.Insert(&a, 1);
+    justb.Insert(&b, 1);
+    justa *= justb;
+    BOOST_CHECK_EQUAL(MuHashHex(justa), MuHashHex(ab));
+    justa /= justb;
+    justb.Insert(&a, 1).Remove(&b, 1);
+    BOOST_CHECK_EQUAL(MuHashHex(justa), MuHashHex(justb));
+
+    // The state survives a round trip, including a pending removal.
+    MuHash3072 pending;
+    pending.Insert(&a, 1).Insert(&b, 1).Remove(&c, 1);
+    unsigned char state[MuHash3072::STATE_SIZE];
+    pending.GetState(state);
+    MuHash3072 restored;
+    restored.SetState(state);
+    restored.Insert(&c, 1);
+    BOOST_CHECK_EQUAL(MuHashHex(restored), MuHashHex(ab));
+
+    // Finalize() normalizes the state, which still represents the same set.
+    MuHash3072 finalized = pending;
+    unsigned char out[MuHash3072::OUTPUT_SIZE];
+    finalized.Finalize(out);
+    finalized.Insert(&c, 1);
+    BOOST_CHECK_EQUAL(MuHashHex(finalized), MuHashHex(ab));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,113 @@
+// Copyright (c) 2026 The Zclassic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+#include "uint256.h"
+
+#include <cstring>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+class TestHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        uint32_t u;
+        std::memcpy(&u, key.begin() + 4 * hash_select, 4);
+        return u;
+    }
+};
+
+typedef CuckooCache::cache<uint256, TestHasher> test_cache;
+
+std::vector<uint256> RandomHashes(size_t n)
+{
+    std::vector<uint256> hashes(n);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < 8; j++) {
+            uint32_t r = insecure_rand();
+            std::memcpy(hashes[i].begin() + 4 * j, &r, 4);
+        }
+    }
+    return hashes;
+}
+
+}
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(cuckoocache_empty_and_insert)
+{
+    seed_insecure_rand(true);
+    test_cache cc;
+    cc.setup_bytes(1 << 16);
+    BOOST_CHECK_EQUAL(cc.capacity(), (1u << 16) / sizeof(uint256));
+
+    std::vector<uint256> hashes = RandomHashes(1000);
+    for (size_t i = 0; i < hashes.size(); i++)
+        BOOST_CHECK(!cc.contains(hashes[i], false));
+    for (size_t i = 0; i < hashes.size(); i++)
+        cc.insert(hashes[i]);
+
+    // Well under capacity, nothing should have been evicted
+    size_t nFound = 0;
+    for (size_t i = 0; i < hashes.size(); i++)
+        nFound += cc.contains(hashes[i], false);
+    BOOST_CHECK_EQUAL(nFound, hashes.size());
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_erase_is_lazy)
+{
+    seed_insecure_rand(true);
+    test_cache cc;
+    cc.setup(1 << 12);
+
+    std::vector<uint256> hashes = RandomHashes(1 << 11);
+    for (size_t i = 0; i < hashes.size(); i++)
+        cc.insert(hashes[i]);
+
+    // Erasing only marks an entry as reclaimable; it stays visible until an
+    // insert needs the slot.
+    for (size_t i = 0; i < hashes.size(); i++)
+        BOOST_CHECK(cc.contains(hashes[i], true));
+    for (size_t i = 0; i < hashes.size(); i++)
+        BOOST_CHECK(cc.contains(hashes[i], false));
+
+    // New entries should land in the erased slots rather than be dropped
+    std::vector<uint256> fresh = RandomHashes(3 << 10);
+    for (size_t i = 0; i < fresh.size(); i++)
+        cc.insert(fresh[i]);
+    size_t nFound = 0;
+    for (size_t i = 0; i < fresh.size(); i++)
+        nFound += cc.contains(fresh[i], false);
+    BOOST_CHECK_GT(nFound, fresh.size() * 95 / 100);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_keeps_recent_entries)
+{
+    seed_insecure_rand(true);
+    test_cache cc;
+    cc.setup(1 << 12);
+
+    // Insert four times the capacity without erasing anything; the most
+    // recent generation should survive almost entirely.
+    std::vector<uint256> hashes = RandomHashes(1 << 14);
+    for (size_t i = 0; i < hashes.size(); i++)
+        cc.insert(hashes[i]);
+
+    size_t nRecent = cc.capacity() * 45 / 100;
+    size_t nFound = 0;
+    for (size_t i = hashes.size() - nRecent; i < hashes.size(); i++)
+        nFound += cc.contains(hashes[i], false);
+    BOOST_CHECK_GT(nFound, nRecent * 95 / 100);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,111 @@
+// Copyright (c) 2026 The Zclassic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "memusage.h"
+#include "random.h"
+#include "support/allocators/pool.h"
+#include "test/test_bitcoin.h"
+
+#include <stdint.h>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(basic_allocating)
+{
+    PoolResource<8, 8> resource;
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0);
+
+    // first chunk is allocated on first use
+    void* block = resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+
+    // a freed block is handed out again
+    resource.Deallocate(block, 8, 8);
+    void* b = resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL(b, block);
+
+    // blocks of other sizes come from the same chunk; zero sized requests are served too
+    void* b0 = resource.Allocate(0, 1);
+    BOOST_CHECK(b0 != b);
+    void* b4 = resource.Allocate(4, 4);
+    BOOST_CHECK(b4 != b0 && b4 != b);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+
+    // too large or too strictly aligned requests bypass the pool
+    void* big = resource.Allocate(16, 8);
+    resource.Deallocate(big, 16, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+
+    resource.Deallocate(b4, 4, 4);
+    resource.Deallocate(b0, 0, 1);
+    resource.Deallocate(b, 8, 8);
+}
+
+BOOST_AUTO_TEST_CASE(chunk_exhaustion)
+{
+    PoolResource<16, 8> resource(64);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 64);
+
+    std::vector<void*> blocks;
+    for (int i = 0; i < 4; ++i) {
+        blocks.push_back(resource.Allocate(16, 8));
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+    BOOST_CHECK_EQUAL(resource.NumUnusedBytes(), 0);
+    blocks.push_back(resource.Allocate(16, 8));
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2);
+    BOOST_CHECK_EQUAL(resource.NumUnusedBytes(), 48);
+
+    // Returned blocks are reused before any new chunk is needed
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        resource.Deallocate(blocks[i], 16, 8);
+    }
+    BOOST_CHECK_EQUAL(resource.NumUnusedBytes(), 128);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        blocks[i] = resource.Allocate(16, 8);
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        resource.Deallocate(blocks[i], 16, 8);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coins_map_usage)
+{
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), memusage::MallocUsage(sizeof(void*) * map.bucket_count()));
+
+    uint256 txid = GetRandHash();
+    for (uint32_t i = 0; i < 10000; ++i) {
+        map[COutPoint(txid, i)].coin.out.nValue = i;
+    }
+    const size_t chunks = resource.NumAllocatedChunks();
+    BOOST_CHECK(chunks > 0);
+    const size_t usage = memusage::DynamicUsage(map);
+    BOOST_CHECK(usage <= chunks * (resource.ChunkSizeBytes() + memusage::MallocUsage(sizeof(void*) * 3)) + memusage::MallocUsage(sizeof(void*) * map.bucket_count()));
+
+    // Erased nodes stay in the pool but no longer count as used
+    for (uint32_t i = 0; i < 10000; i += 2) {
+        map.erase(COutPoint(txid, i));
+    }
+    BOOST_CHECK(memusage::DynamicUsage(map) < usage);
+
+    // Re-adding entries recycles the freed nodes
+    for (uint32_t i = 0; i < 10000; i += 2) {
+        map[COutPoint(txid, i + 10000)].coin.out.nValue = i;
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), chunks);
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), usage);
+    BOOST_CHECK_EQUAL(map.size(), 10000);
+    for (uint32_t i = 1; i < 10000; i += 2) {
+        BOOST_CHECK_EQUAL(map[COutPoint(txid, i)].coin.out.nValue, i);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
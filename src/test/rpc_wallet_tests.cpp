@@ -830,6 +830,117 @@ BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_parallel_cancel)
     BOOST_CHECK(ids.size()==0);
 }
 
+// SourceOperation tracks how many operations spending from "addr" run at once
+std::atomic<int> gSourceActive(0);
+std::atomic<int> gSourceMaxActive(0);
+
+class SourceOperation : public AsyncRPCOperation {
+public:
+    std::string source;
+    int naptime;
+    SourceOperation(std::string source, int t, OperationPriority priority = OperationPriority::NORMAL) : source(source), naptime(t) {
+        setPriority(priority);
+    }
+    virtual ~SourceOperation() {}
+    virtual std::string getInputSource() const {
+        return source;
+    }
+    virtual void main() {
+        set_state(OperationStatus::EXECUTING);
+        start_execution_clock();
+        const bool fTracked = (source == "addr");
+        if (fTracked) {
+            int active = ++gSourceActive;
+            int maxActive = gSourceMaxActive.load();
+            while (active > maxActive && !gSourceMaxActive.compare_exchange_weak(maxActive, active)) {}
+        }
+        bool cancelled = false;
+        try {
+            for (int i = 0; i < naptime; i += 50) {
+                throw_if_cancel_requested();
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+        } catch (const AsyncRPCOperationCancelled& e) {
+            cancelled = true;
+        }
+        if (fTracked) {
+            gSourceActive--;
+        }
+        stop_execution_clock();
+        set_state(cancelled ? OperationStatus::CANCELLED : OperationStatus::SUCCESS);
+    }
+};
+
+// This tests priorities, input sources and cancelling an executing operation
+BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_priority)
+{
+    gSourceActive = 0;
+    gSourceMaxActive = 0;
+
+    std::shared_ptr<AsyncRPCQueue> q = std::make_shared<AsyncRPCQueue>();
+    std::shared_ptr<AsyncRPCOperation> low(new SourceOperation("bulk", 5000, OperationPriority::LOW));
+    std::shared_ptr<AsyncRPCOperation> op1(new SourceOperation("addr", 500));
+    std::shared_ptr<AsyncRPCOperation> op2(new SourceOperation("addr", 500));
+    q->addOperation(low);
+    q->addOperation(op1);
+    q->addOperation(op2);
+
+    // NORMAL operations are queued ahead of LOW ones
+    BOOST_CHECK_EQUAL(q->getQueuePosition(op1->getId()), 0);
+    BOOST_CHECK_EQUAL(q->getQueuePosition(op2->getId()), 1);
+    BOOST_CHECK_EQUAL(q->getQueuePosition(low->getId()), 2);
+    BOOST_CHECK_EQUAL(q->getQueuePosition("opid-unknown"), -1);
+    BOOST_CHECK_EQUAL(q->getOperationCount(OperationPriority::NORMAL), 2);
+    BOOST_CHECK_EQUAL(q->getOperationCount(OperationPriority::LOW), 1);
+    BOOST_CHECK_EQUAL(q->getExecutingCount(OperationPriority::NORMAL), 0);
+    UniValue status = low->getStatus();
+    BOOST_CHECK_EQUAL(find_value(status, "priority").get_str(), "low");
+    BOOST_CHECK(find_value(status, "execution_secs").isNull());
+
+    // op2 waits for op1, which spends from the same source, so the LOW
+    // operation gets the other worker
+    q->addWorker();
+    q->addWorker();
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    BOOST_CHECK_EQUAL(op1->isExecuting(), true);
+    BOOST_CHECK_EQUAL(op2->isReady(), true);
+    BOOST_CHECK_EQUAL(low->isExecuting(), true);
+    BOOST_CHECK_EQUAL(q->getQueuePosition(op2->getId()), 0);
+    BOOST_CHECK_EQUAL(q->getOperationCount(OperationPriority::NORMAL), 1);
+    BOOST_CHECK_EQUAL(q->getOperationCount(OperationPriority::LOW), 0);
+    BOOST_CHECK_EQUAL(q->getExecutingCount(OperationPriority::NORMAL), 1);
+    BOOST_CHECK_EQUAL(q->getExecutingCount(OperationPriority::LOW), 1);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    BOOST_CHECK_EQUAL(op1->isSuccess(), true);
+    BOOST_CHECK_EQUAL(op2->isExecuting(), true);
+
+    // A second LOW operation may not take the last free worker...
+    std::shared_ptr<AsyncRPCOperation> low2(new SourceOperation("bulk2", 500, OperationPriority::LOW));
+    q->addOperation(low2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(750));
+    BOOST_CHECK_EQUAL(op2->isSuccess(), true);
+    BOOST_CHECK_EQUAL(low2->isReady(), true);
+
+    // ...which is kept for NORMAL operations
+    std::shared_ptr<AsyncRPCOperation> op3(new SourceOperation("other", 100));
+    q->addOperation(op3);
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    BOOST_CHECK_EQUAL(op3->isSuccess(), true);
+    BOOST_CHECK_EQUAL(low2->isReady(), true);
+
+    // An executing operation stops at its next checkpoint once cancelled
+    low->cancel();
+    BOOST_CHECK_EQUAL(low->isCancelRequested(), true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    BOOST_CHECK_EQUAL(low->isCancelled(), true);
+    BOOST_CHECK(!find_value(low->getStatus(), "execution_secs").isNull());
+
+    q->finishAndWait();
+    BOOST_CHECK_EQUAL(low2->isSuccess(), true);
+    BOOST_CHECK_EQUAL(gSourceMaxActive.load(), 1);
+}
+
 // This tests z_getoperationstatus, z_getoperationresult, z_listoperationids
 BOOST_AUTO_TEST_CASE(rpc_z_getoperations)
 {
@@ -849,6 +960,10 @@ BOOST_AUTO_TEST_CASE(rpc_z_getoperations)
     BOOST_CHECK_THROW(CallRPC("z_getoperationresult [] toomanyargs"), runtime_error);
     BOOST_CHECK_THROW(CallRPC("z_getoperationresult not_an_array"), runtime_error);
 
+    BOOST_CHECK_THROW(CallRPC("z_canceloperation"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("z_canceloperation opid-1234 toomanyargs"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("z_canceloperation opid-1234"), runtime_error);
+
     std::shared_ptr<AsyncRPCOperation> op1 = std::make_shared<AsyncRPCOperation>();
     q->addOperation(op1);
     std::shared_ptr<AsyncRPCOperation> op2 = std::make_shared<AsyncRPCOperation>();
@@ -881,6 +996,9 @@ BOOST_AUTO_TEST_CASE(rpc_z_getoperations)
         UniValue obj = v.get_obj();
         UniValue id = find_value(obj, "id");
 
+        // a finished operation cannot be cancelled
+        BOOST_CHECK_THROW(CallRPC("z_canceloperation " + id.get_str()), runtime_error);
+
         UniValue result;
         // removes result from internal storage
         BOOST_CHECK_NO_THROW(result = CallRPC("z_getoperationresult [\"" + id.get_str() + "\"]"));
@@ -1249,6 +1367,59 @@ BOOST_AUTO_TEST_CASE(rpc_z_sendmany_internals)
         } catch (const std::runtime_error & e) {
             BOOST_CHECK( string(e.what()).find("error verifying joinsplit")!= string::npos);
         }
+
+        // Independent joinsplits pass on the first failure of any proof
+        // and leave the transaction untouched
+        std::vector<AsyncJoinSplitInfo> infos(3);
+        try {
+            proxy.perform_joinsplits(infos);
+            BOOST_FAIL("Should have caused an error");
+        } catch (const std::runtime_error & e) {
+            BOOST_CHECK( string(e.what()).find("error verifying joinsplit")!= string::npos);
+        }
+        BOOST_CHECK_EQUAL(proxy.getTx().vjoinsplit.size(), 0);
+    }
+
+    // A batch of independent joinsplits proven in parallel is added to the
+    // transaction in order, with payment disclosure data for each index
+    {
+        CMutableTransaction saplingMtx = mtx;
+        saplingMtx.fOverwintered = true;
+        saplingMtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+        saplingMtx.nVersion = SAPLING_TX_VERSION;
+
+        std::vector<SendManyRecipient> recipients = { SendManyRecipient(zaddr1, 0.0005, "ABCD") };
+        std::shared_ptr<AsyncRPCOperation> operation( new AsyncRPCOperation_sendmany(boost::none, saplingMtx, zaddr1, {}, recipients, 1) );
+        std::shared_ptr<AsyncRPCOperation_sendmany> ptr = std::dynamic_pointer_cast<AsyncRPCOperation_sendmany> (operation);
+        TEST_FRIEND_AsyncRPCOperation_sendmany proxy(ptr);
+
+        const size_t nJoinSplits = 3;
+        std::vector<AsyncJoinSplitInfo> infos(nJoinSplits);
+        for (size_t i = 0; i < nJoinSplits; i++) {
+            infos[i].vpub_old = (i + 1) * 1000;
+            infos[i].vjsout.push_back(JSOutput(pa, infos[i].vpub_old));
+        }
+        BOOST_CHECK_NO_THROW(proxy.perform_joinsplits(infos));
+
+        CTransaction tx = proxy.getTx();
+        BOOST_REQUIRE_EQUAL(tx.vjoinsplit.size(), nJoinSplits);
+        for (size_t i = 0; i < nJoinSplits; i++) {
+            BOOST_CHECK_EQUAL(tx.vjoinsplit[i].vpub_old, (i + 1) * 1000);
+        }
+
+        std::vector<PaymentDisclosureKeyInfo> pdData = proxy.getPaymentDisclosureData();
+        BOOST_REQUIRE_EQUAL(pdData.size(), nJoinSplits * ZC_NUM_JS_OUTPUTS);
+        for (size_t i = 0; i < nJoinSplits; i++) {
+            int nToRecipient = 0;
+            for (size_t j = 0; j < ZC_NUM_JS_OUTPUTS; j++) {
+                const PaymentDisclosureKeyInfo& item = pdData[i * ZC_NUM_JS_OUTPUTS + j];
+                BOOST_CHECK_EQUAL(item.first.js, i);
+                if (item.second.zaddr == pa) {
+                    nToRecipient++;
+                }
+            }
+            BOOST_CHECK_EQUAL(nToRecipient, 1);
+        }
     }
 
 }
@@ -184,6 +184,8 @@ TransactionBuilderResult TransactionBuilder::Build()
     // Sapling spends and outputs
     //
 
+    // Proofs are created one at a time: each one adds its value commitment
+    // randomness to ctx, which librustzcash cannot share between threads.
     auto ctx = librustzcash_sapling_proving_ctx_init();
 
     // Create Sapling SpendDescriptions
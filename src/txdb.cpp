@@ -7,6 +7,7 @@
 
 #include "chainparams.h"
 #include "hash.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
 #include "ui_interface.h"
@@ -14,6 +15,13 @@
 
 #include <stdint.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -24,6 +32,7 @@ static const char DB_SPROUT_ANCHOR = 'A';
 static const char DB_SAPLING_ANCHOR = 'Z';
 static const char DB_NULLIFIER = 's';
 static const char DB_SAPLING_NULLIFIER = 'S';
+static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
@@ -35,17 +44,350 @@ static const char DB_BEST_SAPLING_ANCHOR = 'z';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_UTXO_COMMITMENT = 'U';
+
+namespace {
+
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN) {}
+
+    template<typename Stream>
+    void Serialize(Stream &s) const {
+        s << key;
+        s << outpoint->hash;
+        s << VARINT(outpoint->n);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        s >> key;
+        s >> outpoint->hash;
+        s >> VARINT(outpoint->n);
+    }
+};
+
+/**
+ * A chainstate record in the per-transaction format ('c' prefix) that
+ * predates the per-output one. Only read, by Upgrade() and by GetStats()
+ * on a chainstate that has not been converted yet.
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nCode)
+ * - unspentness bitvector, for vout[2] and further; least significant byte first
+ * - the non-spent CTxOuts (via CTxOutCompressor)
+ * - VARINT(nHeight)
+ *
+ * The nCode value consists of:
+ * - bit 1: IsCoinBase()
+ * - bit 2: vout[0] is not spent
+ * - bit 4: vout[1] is not spent
+ * - The higher bits encode N, the number of non-zero bytes in the following bitvector.
+ *   - In case both bit 2 and bit 4 are unset, they encode N-1, as there must be at
+ *     least one non-spent output).
+ */
+class CCoins
+{
+public:
+    bool fCoinBase;
+    std::vector<CTxOut> vout;
+    int nHeight;
+    int nVersion;
+
+    CCoins() : fCoinBase(false), vout(0), nHeight(0), nVersion(0) { }
+
+    template<typename Stream>
+    void Unserialize(Stream &s) {
+        unsigned int nCode = 0;
+        // version
+        ::Unserialize(s, VARINT(this->nVersion));
+        // header code
+        ::Unserialize(s, VARINT(nCode));
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 2) != 0;
+        vAvail[1] = (nCode & 4) != 0;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])));
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight));
+    }
+};
+
+/** The unspent outputs of one transaction, as GetStats() folds them. */
+struct CStatsTx
+{
+    uint256 txid;
+    int nHeight;
+    bool fCoinBase;
+    int nVersion;
+    std::vector<std::pair<uint32_t, CTxOut> > vout;
+    size_t nSerializedSize;
+
+    CStatsTx() : nHeight(0), fCoinBase(false), nVersion(0), nSerializedSize(0) {}
+};
+
+bool CompareOutputIndex(const std::pair<uint32_t, CTxOut>& a, const std::pair<uint32_t, CTxOut>& b)
+{
+    return a.first < b.first;
+}
+
+/**
+ * Read the outputs of the next transaction from a cursor over the per-output
+ * records. Returns false at the end of the prefix, or with fError set if a
+ * record cannot be parsed. The VARINT output index does not sort
+ * numerically, so the outputs are put back in index order here.
+ */
+bool ReadNextCoinTx(CDBIterator* pcursor, CStatsTx& tx, bool& fError)
+{
+    tx.vout.clear();
+    tx.nSerializedSize = 0;
+    COutPoint outpoint;
+    CoinEntry entry(&outpoint);
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (!pcursor->GetKey(entry) || entry.key != DB_COIN)
+            break;
+        if (!tx.vout.empty() && outpoint.hash != tx.txid)
+            break;
+        Coin coin;
+        if (!pcursor->GetValue(coin)) {
+            fError = true;
+            return false;
+        }
+        tx.txid = outpoint.hash;
+        tx.nHeight = coin.nHeight;
+        tx.fCoinBase = coin.fCoinBase;
+        tx.nVersion = coin.nVersion;
+        tx.vout.push_back(std::make_pair(outpoint.n, coin.out));
+        tx.nSerializedSize += 32 + pcursor->GetValueSize();
+        pcursor->Next();
+    }
+    std::sort(tx.vout.begin(), tx.vout.end(), CompareOutputIndex);
+    return !tx.vout.empty();
+}
+
+/** As ReadNextCoinTx(), for a not yet upgraded per-transaction record. */
+bool ReadNextLegacyTx(CDBIterator* pcursor, CStatsTx& tx, bool& fError)
+{
+    std::pair<char, uint256> key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_COINS)
+        return false;
+    CCoins coins;
+    if (!pcursor->GetValue(coins)) {
+        fError = true;
+        return false;
+    }
+    tx.txid = key.second;
+    tx.nHeight = coins.nHeight;
+    tx.fCoinBase = coins.fCoinBase;
+    tx.nVersion = coins.nVersion;
+    tx.vout.clear();
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        if (!coins.vout[i].IsNull())
+            tx.vout.push_back(std::make_pair(i, coins.vout[i]));
+    }
+    tx.nSerializedSize = 32 + pcursor->GetValueSize();
+    pcursor->Next();
+    return true;
+}
+
+/**
+ * GetStats() splits the chainstate into ranges by key prefix and the first
+ * byte of the txid, root or nullifier that follows it: first the coin ranges,
+ * then those of each shielded key prefix. The ranges are scanned in parallel,
+ * each into a buffer holding exactly the bytes the commitments hash for it,
+ * and the buffers are hashed strictly in range order, so the result is the
+ * same as that of one pass over the database in key order.
+ */
+const char STATS_SHIELDED_PREFIXES[] = { DB_SPROUT_ANCHOR, DB_SAPLING_ANCHOR,
+                                         DB_NULLIFIER, DB_SAPLING_NULLIFIER };
+const int STATS_RANGES_PER_PREFIX = 256;
+const int STATS_RANGES = (1 + sizeof(STATS_SHIELDED_PREFIXES)) * STATS_RANGES_PER_PREFIX;
+//! Ranges a worker may scan ahead of the one being hashed; bounds the memory
+//! held by finished but not yet hashed ranges.
+const int STATS_RANGES_AHEAD_PER_THREAD = 4;
+//! The scan is bound by database reads, which stop scaling well before this.
+const int MAX_STATS_THREADS = 8;
+
+/** What one range contributes to the GetStats() results. */
+struct CStatsRange
+{
+    //! For a coin range the hashSerialized input, for a shielded one the keys
+    //! as folded into hashSerializedFull.
+    CDataStream ss;
+    CDataStream ssMeta;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nSerializedSize;
+    CAmount nTotalAmount;
+
+    CStatsRange() : ss(SER_GETHASH, PROTOCOL_VERSION), ssMeta(SER_GETHASH, PROTOCOL_VERSION),
+                    nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+};
+
+uint256 StatsRangeStart(int nRange)
+{
+    uint256 start;
+    *start.begin() = nRange % STATS_RANGES_PER_PREFIX;
+    return start;
+}
+
+bool InStatsRange(const uint256& hash, int nRange)
+{
+    return *hash.begin() == nRange % STATS_RANGES_PER_PREFIX;
+}
+
+/** Scan the unspent outputs of the transactions in a coin range. */
+bool ScanStatsCoinRange(const CDBSnapshot& snapshot, int nRange, CStatsRange& range, const std::atomic<bool>& fAbort)
+{
+    const uint256 start = StatsRangeStart(nRange);
+    boost::scoped_ptr<CDBIterator> pcursor(snapshot.NewIterator());
+    pcursor->Seek(make_pair(DB_COIN, start));
+    // A chainstate that has not been through Upgrade() (or was interrupted
+    // half-way) still holds per-transaction records; walk both prefixes in
+    // txid order so the commitments do not depend on the on-disk layout.
+    boost::scoped_ptr<CDBIterator> plegacy(snapshot.NewIterator());
+    plegacy->Seek(make_pair(DB_COINS, start));
+
+    bool fError = false;
+    CStatsTx txCoin, txLegacy;
+    bool fCoin = ReadNextCoinTx(pcursor.get(), txCoin, fError) && InStatsRange(txCoin.txid, nRange);
+    bool fLegacy = ReadNextLegacyTx(plegacy.get(), txLegacy, fError) && InStatsRange(txLegacy.txid, nRange);
+    while (!fError && !fAbort && (fCoin || fLegacy)) {
+        CStatsTx& tx = (fCoin && (!fLegacy || !(txLegacy.txid < txCoin.txid))) ? txCoin : txLegacy;
+        if (fCoin && fLegacy && txCoin.txid == txLegacy.txid) {
+            txCoin.vout.insert(txCoin.vout.end(), txLegacy.vout.begin(), txLegacy.vout.end());
+            std::sort(txCoin.vout.begin(), txCoin.vout.end(), CompareOutputIndex);
+            txCoin.nSerializedSize += txLegacy.nSerializedSize;
+            fLegacy = ReadNextLegacyTx(plegacy.get(), txLegacy, fError) && InStatsRange(txLegacy.txid, nRange);
+            continue;
+        }
+        range.nTransactions++;
+        // Fold the consensus-relevant per-coin metadata (once per transaction,
+        // in leveldb sorted-key order so it is identical on every node holding
+        // the same chainstate). nHeight is always >= 0; the tx version is a
+        // small non-negative value in this chain.
+        range.ssMeta << VARINT(tx.nHeight);
+        range.ssMeta << static_cast<uint8_t>(tx.fCoinBase ? 1 : 0);
+        range.ssMeta << VARINT(static_cast<uint32_t>(tx.nVersion));
+        for (size_t i = 0; i < tx.vout.size(); i++) {
+            const CTxOut &out = tx.vout[i].second;
+            range.nTransactionOutputs++;
+            range.ss << VARINT(tx.vout[i].first + 1);
+            range.ss << out;
+            range.nTotalAmount += out.nValue;
+        }
+        range.nSerializedSize += tx.nSerializedSize;
+        range.ss << VARINT(0);
+        if (&tx == &txCoin)
+            fCoin = ReadNextCoinTx(pcursor.get(), txCoin, fError) && InStatsRange(txCoin.txid, nRange);
+        else
+            fLegacy = ReadNextLegacyTx(plegacy.get(), txLegacy, fError) && InStatsRange(txLegacy.txid, nRange);
+    }
+    return !fError;
+}
+
+/** Collect the keys of a shielded (anchor or nullifier) range. */
+void ScanStatsKeyRange(const CDBSnapshot& snapshot, int nRange, CStatsRange& range, const std::atomic<bool>& fAbort)
+{
+    const char prefix = STATS_SHIELDED_PREFIXES[nRange / STATS_RANGES_PER_PREFIX - 1];
+    boost::scoped_ptr<CDBIterator> it(snapshot.NewIterator());
+    for (it->Seek(make_pair(prefix, StatsRangeStart(nRange))); it->Valid() && !fAbort; it->Next()) {
+        std::pair<char, uint256> key;
+        if (!it->GetKey(key) || key.first != prefix || !InStatsRange(key.second, nRange))
+            break;
+        range.ss << key.second;
+    }
+}
+
+//! Scans running in GetStats(), and how far the latest one has got, in
+//! weighted ranges.
+std::atomic<int> nStatsScans(0);
+std::atomic<int> nStatsProgress(0);
+//! A coin range holds far more data than one of shielded keys.
+const int STATS_COIN_RANGE_WEIGHT = 4;
+const int STATS_TOTAL_WEIGHT = STATS_RANGES_PER_PREFIX * STATS_COIN_RANGE_WEIGHT +
+                               (STATS_RANGES - STATS_RANGES_PER_PREFIX);
+
+/** Publishes the progress of one GetStats() scan for GetCoinsStatsProgress(). */
+class CStatsScanProgress
+{
+public:
+    CStatsScanProgress() { nStatsProgress = 0; nStatsScans++; }
+    ~CStatsScanProgress() { nStatsScans--; }
+
+    void Hashed(int nRange)
+    {
+        nStatsProgress = nRange < STATS_RANGES_PER_PREFIX
+            ? (nRange + 1) * STATS_COIN_RANGE_WEIGHT
+            : STATS_RANGES_PER_PREFIX * STATS_COIN_RANGE_WEIGHT + (nRange + 1 - STATS_RANGES_PER_PREFIX);
+    }
+};
+
+}
+
+double GetCoinsStatsProgress()
+{
+    if (nStatsScans == 0)
+        return -1;
+    return (double)nStatsProgress / STATS_TOTAL_WEIGHT;
+}
 
 
 CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
+    LoadNullifierFilter(SPROUT);
+    LoadNullifierFilter(SAPLING);
 }
 
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
 {
+    LoadNullifierFilter(SPROUT);
+    LoadNullifierFilter(SAPLING);
 }
 
 CCoinsViewDB::CCoinsViewDB(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe) : db(path, nCacheSize, fMemory, fWipe)
 {
+    LoadNullifierFilter(SPROUT);
+    LoadNullifierFilter(SAPLING);
+}
+
+void CCoinsViewDB::LoadNullifierFilter(ShieldedType type) {
+    const char dbChar = type == SPROUT ? DB_NULLIFIER : DB_SAPLING_NULLIFIER;
+    std::vector<uint256> nullifiers;
+    boost::scoped_ptr<CDBIterator> it(db.NewIterator());
+    for (it->Seek(make_pair(dbChar, uint256())); it->Valid(); it->Next()) {
+        std::pair<char, uint256> key;
+        if (!it->GetKey(key) || key.first != dbChar)
+            break;
+        nullifiers.push_back(key.second);
+    }
+    // Leave room to grow; BatchWrite() rebuilds the filter once it is full.
+    CBlockedBloomFilter filter(std::max<size_t>(2 * nullifiers.size(), MIN_NULLIFIER_FILTER_ELEMENTS));
+    for (size_t i = 0; i < nullifiers.size(); i++) {
+        filter.insert(nullifiers[i]);
+    }
+    (type == SPROUT ? sproutNullifierFilter : saplingNullifierFilter) = filter;
+    LogPrint("coindb", "Loaded %u %s nullifiers into the nullifier filter\n",
+             nullifiers.size(), type == SPROUT ? "Sprout" : "Sapling");
 }
 
 
@@ -56,9 +398,12 @@ bool CCoinsViewDB::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree)
         return true;
     }
 
-    bool read = db.Read(make_pair(DB_SPROUT_ANCHOR, rt), tree);
-
-    return read;
+    if (sproutAnchorCache.Get(rt, tree))
+        return true;
+    if (!db.Read(make_pair(DB_SPROUT_ANCHOR, rt), tree))
+        return false;
+    sproutAnchorCache.Put(rt, tree);
+    return true;
 }
 
 bool CCoinsViewDB::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
@@ -68,33 +413,41 @@ bool CCoinsViewDB::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree
         return true;
     }
 
-    bool read = db.Read(make_pair(DB_SAPLING_ANCHOR, rt), tree);
-
-    return read;
+    if (saplingAnchorCache.Get(rt, tree))
+        return true;
+    if (!db.Read(make_pair(DB_SAPLING_ANCHOR, rt), tree))
+        return false;
+    saplingAnchorCache.Put(rt, tree);
+    return true;
 }
 
 bool CCoinsViewDB::GetNullifier(const uint256 &nf, ShieldedType type) const {
     bool spent = false;
     char dbChar;
+    const CBlockedBloomFilter* filter;
     switch (type) {
         case SPROUT:
             dbChar = DB_NULLIFIER;
+            filter = &sproutNullifierFilter;
             break;
         case SAPLING:
             dbChar = DB_SAPLING_NULLIFIER;
+            filter = &saplingNullifierFilter;
             break;
         default:
             throw runtime_error("Unknown shielded type");
     }
+    if (!filter->contains(nf))
+        return false;
     return db.Read(make_pair(dbChar, nf), spent);
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -123,37 +476,45 @@ uint256 CCoinsViewDB::GetBestAnchor(ShieldedType type) const {
     return hashBestAnchor;
 }
 
-void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char& dbChar)
+void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char& dbChar, CBlockedBloomFilter& filter, bool fErase)
 {
     for (CNullifiersMap::iterator it = mapToUse.begin(); it != mapToUse.end();) {
         if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
-            if (!it->second.entered)
+            // An erased nullifier stays in the filter until it is rebuilt,
+            // which only costs a database read if it is looked up again.
+            if (!it->second.entered) {
                 batch.Erase(make_pair(dbChar, it->first));
-            else
+            } else {
+                filter.insert(it->first);
                 batch.Write(make_pair(dbChar, it->first), true);
+            }
             // TODO: changed++? ... See comment in CCoinsViewDB::BatchWrite. If this is needed we could return an int
         }
         CNullifiersMap::iterator itOld = it++;
-        mapToUse.erase(itOld);
+        if (fErase)
+            mapToUse.erase(itOld);
     }
 }
 
 template<typename Map, typename MapIterator, typename MapEntry, typename Tree>
-void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
+void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar, CAnchorTreeCache<Tree>& cache, bool fErase)
 {
     for (MapIterator it = mapToUse.begin(); it != mapToUse.end();) {
         if (it->second.flags & MapEntry::DIRTY) {
-            if (!it->second.entered)
+            if (!it->second.entered) {
+                cache.Erase(it->first);
                 batch.Erase(make_pair(dbChar, it->first));
-            else {
+            } else {
                 if (it->first != Tree::empty_root()) {
+                    cache.Put(it->first, it->second.tree);
                     batch.Write(make_pair(dbChar, it->first), it->second.tree);
                 }
             }
             // TODO: changed++?
         }
         MapIterator itOld = it++;
-        mapToUse.erase(itOld);
+        if (fErase)
+            mapToUse.erase(itOld);
     }
 }
 
@@ -164,28 +525,31 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
                               CAnchorsSproutMap &mapSproutAnchors,
                               CAnchorsSaplingMap &mapSaplingAnchors,
                               CNullifiersMap &mapSproutNullifiers,
-                              CNullifiersMap &mapSaplingNullifiers) {
+                              CNullifiersMap &mapSaplingNullifiers,
+                              bool fErase) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
             else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+                batch.Write(entry, it->second.coin);
             changed++;
         }
         count++;
         CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase)
+            mapCoins.erase(itOld);
     }
 
-    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(batch, mapSproutAnchors, DB_SPROUT_ANCHOR);
-    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
+    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(batch, mapSproutAnchors, DB_SPROUT_ANCHOR, sproutAnchorCache, fErase);
+    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR, saplingAnchorCache, fErase);
 
-    ::BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER);
-    ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER);
+    ::BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER, sproutNullifierFilter, fErase);
+    ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER, saplingNullifierFilter, fErase);
 
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
@@ -194,8 +558,13 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
     if (!hashSaplingAnchor.IsNull())
         batch.Write(DB_BEST_SAPLING_ANCHOR, hashSaplingAnchor);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    LogPrint("coindb", "Committing %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    bool ret = db.WriteBatch(batch);
+    if (sproutNullifierFilter.size() > sproutNullifierFilter.capacity())
+        LoadNullifierFilter(SPROUT);
+    if (saplingNullifierFilter.size() > saplingNullifierFilter.capacity())
+        LoadNullifierFilter(SAPLING);
+    return ret;
 }
 
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
@@ -229,14 +598,14 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 }
 
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
-    /* It seems that there are no "const iterators" for LevelDB.  Since we
-       only need read operations on it, use a const-cast to get around
-       that restriction.  */
-    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    pcursor->Seek(DB_COINS);
+    // Every range is read through the same snapshot, so the scan sees a single
+    // chainstate even if the tip is flushed while it runs.
+    CDBSnapshot snapshot(db);
+    CStatsScanProgress progress;
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
+    if (!snapshot.Read(DB_BEST_BLOCK, stats.hashBlock))
+        stats.hashBlock = uint256();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
     // Per-coin consensus metadata (creation height, coinbase flag, tx version)
@@ -248,50 +617,6 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     // ship forged coinbase-maturity metadata that hashes identically to the honest
     // set — a consensus partition with no attacker hashpower. Bind it here.
     CHashWriter ssMeta(SER_GETHASH, PROTOCOL_VERSION);
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && key.first == DB_COINS) {
-            if (pcursor->GetValue(coins)) {
-                stats.nTransactions++;
-                // Fold the consensus-relevant per-coin metadata (once per CCoins
-                // entry, in leveldb sorted-key order so it is identical on every
-                // node holding the same chainstate). nHeight is always >= 0; the tx
-                // version is a small non-negative value in this chain.
-                ssMeta << VARINT(coins.nHeight);
-                ssMeta << static_cast<uint8_t>(coins.fCoinBase ? 1 : 0);
-                ssMeta << VARINT(static_cast<uint32_t>(coins.nVersion));
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + pcursor->GetValueSize();
-                ss << VARINT(0);
-            } else {
-                return error("CCoinsViewDB::GetStats() : unable to read value");
-            }
-        } else {
-            break;
-        }
-        pcursor->Next();
-    }
-    {
-        LOCK(cs_main);
-        // Defensive: a scratch / frozen-copy chainstate (option B) can carry a
-        // best block this node's index does not (yet) hold. Leave nHeight at its
-        // default rather than dereference end(); the normal chainstate's best
-        // block is always present, so gettxoutsetinfo is unaffected.
-        BlockMap::const_iterator it = mapBlockIndex.find(stats.hashBlock);
-        if (it != mapBlockIndex.end() && it->second)
-            stats.nHeight = it->second->nHeight;
-    }
-    stats.hashSerialized = ss.GetHash();
 
     // Full-chainstate commitment: fold the transparent commitment together with the
     // shielded state so the bootstrap anchor binds the Sprout/Sapling note-commitment
@@ -308,25 +633,139 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     // is itself bound here for the following block. leveldb iterates each key prefix in
     // sorted order, so this digest is identical on every node holding the same chainstate.
     CHashWriter ssFull(SER_GETHASH, PROTOCOL_VERSION);
-    ssFull << stats.hashSerialized;
-    // Bind the per-coin consensus metadata digest (height/coinbase-flag/version)
-    // accumulated above, so the bootstrap anchor commitment covers coinbase-maturity
-    // inputs, not just transparent output value+script.
-    ssFull << ssMeta.GetHash();
-    ssFull << GetBestAnchor(SPROUT);
-    ssFull << GetBestAnchor(SAPLING);
-    const char shieldedPrefixes[] = { DB_SPROUT_ANCHOR, DB_SAPLING_ANCHOR,
-                                      DB_NULLIFIER, DB_SAPLING_NULLIFIER };
-    for (size_t p = 0; p < sizeof(shieldedPrefixes); p++) {
-        const char prefix = shieldedPrefixes[p];
-        boost::scoped_ptr<CDBIterator> it2(const_cast<CDBWrapper*>(&db)->NewIterator());
-        for (it2->Seek(make_pair(prefix, uint256())); it2->Valid(); it2->Next()) {
-            boost::this_thread::interruption_point();
-            std::pair<char, uint256> key2;
-            if (!it2->GetKey(key2) || key2.first != prefix)
-                break;
-            ssFull << key2.second;
+
+    // Workers scan ranges in index order, at most nAhead past the last one
+    // hashed, and the calling thread folds the finished ranges in that same
+    // order.
+    const int nThreads = std::max(1, std::min(GetNumCores(), MAX_STATS_THREADS));
+    const int nAhead = nThreads * STATS_RANGES_AHEAD_PER_THREAD;
+    std::vector<std::unique_ptr<CStatsRange> > ranges(STATS_RANGES);
+    std::vector<bool> vDone(STATS_RANGES, false);
+    int nNextRange = 0;
+    int nHashed = 0;
+    std::atomic<bool> fAbort(false);
+    bool fError = false;
+    std::exception_ptr firstError;
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    auto worker = [&]() {
+        while (true) {
+            int nRange;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!fAbort && nNextRange < STATS_RANGES && nNextRange >= nHashed + nAhead)
+                    cond.wait(lock);
+                if (fAbort || nNextRange == STATS_RANGES)
+                    return;
+                nRange = nNextRange++;
+            }
+            std::unique_ptr<CStatsRange> range(new CStatsRange());
+            bool fOk = true;
+            try {
+                if (nRange < STATS_RANGES_PER_PREFIX)
+                    fOk = ScanStatsCoinRange(snapshot, nRange, *range, fAbort);
+                else
+                    ScanStatsKeyRange(snapshot, nRange, *range, fAbort);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!firstError)
+                    firstError = std::current_exception();
+                fOk = false;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                fError |= !fOk;
+                ranges[nRange] = std::move(range);
+                vDone[nRange] = true;
+            }
+            cond.notify_all();
+        }
+    };
+
+    boost::thread_group group;
+    for (int i = 0; i < nThreads; i++) {
+        group.create_thread(worker);
+    }
+    // Always stop and join the workers, also when this thread is interrupted
+    // while waiting for them.
+    try {
+        for (int nRange = 0; nRange < STATS_RANGES; nRange++) {
+            std::unique_ptr<CStatsRange> range;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!vDone[nRange] && !fError) {
+                    cond.wait_for(lock, std::chrono::milliseconds(100));
+                    boost::this_thread::interruption_point();
+                }
+                if (fError)
+                    break;
+                range = std::move(ranges[nRange]);
+            }
+            if (nRange == STATS_RANGES_PER_PREFIX) {
+                // All coins are in; the rest of the ranges are shielded keys.
+                stats.hashSerialized = ss.GetHash();
+                ssFull << stats.hashSerialized;
+                // Bind the per-coin consensus metadata digest (height/coinbase-flag/version)
+                // accumulated above, so the bootstrap anchor commitment covers coinbase-maturity
+                // inputs, not just transparent output value+script.
+                ssFull << ssMeta.GetHash();
+                uint256 hashBestSproutAnchor, hashBestSaplingAnchor;
+                if (!snapshot.Read(DB_BEST_SPROUT_ANCHOR, hashBestSproutAnchor))
+                    hashBestSproutAnchor = SproutMerkleTree::empty_root();
+                if (!snapshot.Read(DB_BEST_SAPLING_ANCHOR, hashBestSaplingAnchor))
+                    hashBestSaplingAnchor = SaplingMerkleTree::empty_root();
+                ssFull << hashBestSproutAnchor;
+                ssFull << hashBestSaplingAnchor;
+            }
+            if (!range->ss.empty()) {
+                if (nRange < STATS_RANGES_PER_PREFIX)
+                    ss.write(&range->ss[0], range->ss.size());
+                else
+                    ssFull.write(&range->ss[0], range->ss.size());
+            }
+            if (!range->ssMeta.empty())
+                ssMeta.write(&range->ssMeta[0], range->ssMeta.size());
+            stats.nTransactions += range->nTransactions;
+            stats.nTransactionOutputs += range->nTransactionOutputs;
+            stats.nSerializedSize += range->nSerializedSize;
+            nTotalAmount += range->nTotalAmount;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                nHashed = nRange + 1;
+            }
+            cond.notify_all();
+            progress.Hashed(nRange);
         }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            fAbort = true;
+        }
+        cond.notify_all();
+        group.join_all();
+        throw;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fAbort = true;
+    }
+    cond.notify_all();
+    group.join_all();
+    if (firstError)
+        std::rethrow_exception(firstError);
+    if (fError)
+        return error("CCoinsViewDB::GetStats() : unable to read value");
+
+    {
+        LOCK(cs_main);
+        // Defensive: a scratch / frozen-copy chainstate (option B) can carry a
+        // best block this node's index does not (yet) hold. Leave nHeight at its
+        // default rather than dereference end(); the normal chainstate's best
+        // block is always present, so gettxoutsetinfo is unaffected.
+        BlockMap::const_iterator it = mapBlockIndex.find(stats.hashBlock);
+        if (it != mapBlockIndex.end() && it->second)
+            stats.nHeight = it->second->nHeight;
     }
     stats.hashSerializedFull = ssFull.GetHash();
 
@@ -334,6 +773,112 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     return true;
 }
 
+bool CCoinsViewDB::GetUtxoCommitment(CUtxoCommitment &commitment) const {
+    commitment = CUtxoCommitment();
+    // The commitment is a set hash, so the two record layouts can be walked
+    // one after the other and need no merging.
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    pcursor->Seek(DB_COIN);
+    boost::scoped_ptr<CDBIterator> plegacy(const_cast<CDBWrapper*>(&db)->NewIterator());
+    plegacy->Seek(DB_COINS);
+    bool fError = false;
+    CStatsTx tx;
+    while (ReadNextCoinTx(pcursor.get(), tx, fError) || (!fError && ReadNextLegacyTx(plegacy.get(), tx, fError))) {
+        for (size_t i = 0; i < tx.vout.size(); i++) {
+            commitment.AddCoin(COutPoint(tx.txid, tx.vout[i].first), Coin(tx.vout[i].second, tx.nHeight, tx.fCoinBase, tx.nVersion));
+        }
+    }
+    if (fError)
+        return error("CCoinsViewDB::GetUtxoCommitment() : unable to read value");
+
+    const std::pair<char, ShieldedType> shieldedPrefixes[] = {
+        std::make_pair(DB_SPROUT_ANCHOR, SPROUT), std::make_pair(DB_SAPLING_ANCHOR, SAPLING),
+        std::make_pair(DB_NULLIFIER, SPROUT), std::make_pair(DB_SAPLING_NULLIFIER, SAPLING) };
+    for (size_t p = 0; p < 4; p++) {
+        const char prefix = shieldedPrefixes[p].first;
+        const ShieldedType type = shieldedPrefixes[p].second;
+        boost::scoped_ptr<CDBIterator> it(const_cast<CDBWrapper*>(&db)->NewIterator());
+        for (it->Seek(make_pair(prefix, uint256())); it->Valid(); it->Next()) {
+            boost::this_thread::interruption_point();
+            std::pair<char, uint256> key;
+            if (!it->GetKey(key) || key.first != prefix)
+                break;
+            if (prefix == DB_SPROUT_ANCHOR || prefix == DB_SAPLING_ANCHOR)
+                commitment.AddAnchor(key.second, type);
+            else
+                commitment.AddNullifier(key.second, type);
+        }
+    }
+    commitment.SetBestAnchors(GetBestAnchor(SPROUT), GetBestAnchor(SAPLING));
+    return true;
+}
+
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    std::pair<char, uint256> key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_COINS) {
+        return true;
+    }
+
+    int64_t count = 0;
+    LogPrintf("Upgrading utxo-set database...\n");
+    LogPrintf("[0%%]...");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    size_t batch_size = 1 << 24;
+    CDBBatch batch(db);
+    int reportDone = 0;
+    std::pair<char, uint256> prev_key = make_pair(DB_COINS, uint256());
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            break;
+        }
+        if (pcursor->GetKey(key) && key.first == DB_COINS) {
+            if (count++ % 256 == 0) {
+                uint32_t high = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
+                int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+                uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone);
+                if (reportDone < percentageDone/10) {
+                    // report max. every 10% step
+                    LogPrintf("[%d%%]...", percentageDone);
+                    reportDone = percentageDone/10;
+                }
+            }
+            CCoins old_coins;
+            if (!pcursor->GetValue(old_coins)) {
+                return error("%s: cannot parse CCoins record", __func__);
+            }
+            COutPoint outpoint(key.second, 0);
+            for (size_t i = 0; i < old_coins.vout.size(); ++i) {
+                if (!old_coins.vout[i].IsNull() && !old_coins.vout[i].scriptPubKey.IsUnspendable()) {
+                    Coin newcoin(std::move(old_coins.vout[i]), old_coins.nHeight, old_coins.fCoinBase, old_coins.nVersion);
+                    outpoint.n = i;
+                    CoinEntry entry(&outpoint);
+                    batch.Write(entry, newcoin);
+                }
+            }
+            // The outputs and the erasure of their old record land in the same
+            // batch, so an interrupted upgrade resumes cleanly at the next one.
+            batch.Erase(key);
+            if (batch.SizeEstimate() > batch_size) {
+                db.WriteBatch(batch);
+                batch.Clear();
+                db.CompactRange(prev_key, key);
+                prev_key = key;
+            }
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+    db.WriteBatch(batch);
+    db.CompactRange(make_pair(DB_COINS, uint256()), key);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
+    return !ShutdownRequested();
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
@@ -354,6 +899,21 @@ bool CBlockTreeDB::EraseBatchSync(const std::vector<const CBlockIndex*>& blockin
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::ReadUtxoCommitment(const uint256 &hashBlock, CUtxoCommitment &commitment) {
+    return Read(make_pair(DB_UTXO_COMMITMENT, hashBlock), commitment);
+}
+
+bool CBlockTreeDB::WriteUtxoCommitments(const std::vector<std::pair<uint256, const CUtxoCommitment*> > &vWrite, const std::vector<uint256> &vErase) {
+    CDBBatch batch(*this);
+    for (std::vector<uint256>::const_iterator it = vErase.begin(); it != vErase.end(); it++) {
+        batch.Erase(make_pair(DB_UTXO_COMMITMENT, *it));
+    }
+    for (std::vector<std::pair<uint256, const CUtxoCommitment*> >::const_iterator it = vWrite.begin(); it != vWrite.end(); it++) {
+        batch.Write(make_pair(DB_UTXO_COMMITMENT, it->first), *it->second);
+    }
+    return WriteBatch(batch);
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair(DB_TXINDEX, txid), pos);
 }
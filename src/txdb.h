@@ -6,9 +6,12 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "bloom.h"
 #include "coins.h"
 #include "dbwrapper.h"
+#include "sync.h"
 
+#include <list>
 #include <map>
 #include <string>
 #include <utility>
@@ -26,13 +29,91 @@ static const int64_t nDefaultDbCache = 450;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! Smallest number of nullifiers a CCoinsViewDB nullifier filter is sized for
+static const unsigned int MIN_NULLIFIER_FILTER_ELEMENTS = 1 << 16;
+
+//! Note commitment trees a CCoinsViewDB keeps deserialized, per pool
+static const size_t ANCHOR_CACHE_ENTRIES = 128;
+
+/**
+ * The note commitment trees stored under the most recently used anchors.
+ * Blocks and mempool transactions keep spending against the same few recent
+ * anchors, and each database read of one deserializes a whole tree frontier.
+ */
+template<typename Tree>
+class CAnchorTreeCache
+{
+private:
+    typedef std::list<std::pair<uint256, Tree> > List;
+
+    mutable CCriticalSection cs;
+    //! Most recently used first.
+    List entries;
+    boost::unordered_map<uint256, typename List::iterator, CCoinsKeyHasher> index;
+
+public:
+    bool Get(const uint256 &rt, Tree &tree)
+    {
+        LOCK(cs);
+        typename boost::unordered_map<uint256, typename List::iterator, CCoinsKeyHasher>::iterator it = index.find(rt);
+        if (it == index.end())
+            return false;
+        entries.splice(entries.begin(), entries, it->second);
+        tree = it->second->second;
+        return true;
+    }
+
+    void Put(const uint256 &rt, const Tree &tree)
+    {
+        LOCK(cs);
+        typename boost::unordered_map<uint256, typename List::iterator, CCoinsKeyHasher>::iterator it = index.find(rt);
+        if (it != index.end()) {
+            entries.splice(entries.begin(), entries, it->second);
+            it->second->second = tree;
+            return;
+        }
+        entries.push_front(std::make_pair(rt, tree));
+        index[rt] = entries.begin();
+        if (entries.size() > ANCHOR_CACHE_ENTRIES) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+    void Erase(const uint256 &rt)
+    {
+        LOCK(cs);
+        typename boost::unordered_map<uint256, typename List::iterator, CCoinsKeyHasher>::iterator it = index.find(rt);
+        if (it != index.end()) {
+            entries.erase(it->second);
+            index.erase(it);
+        }
+    }
+};
+
+//! Fraction [0..1] of the chainstate scanned so far by the latest running
+//! CCoinsViewDB::GetStats(), or -1 if no scan is running.
+double GetCoinsStatsProgress();
 
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+    //! Filters over the nullifiers in the database. Most nullifiers looked up
+    //! are those of new spends, which are not there; the filters answer those
+    //! without a database read. Built when the database is opened and kept
+    //! up to date by BatchWrite().
+    CBlockedBloomFilter sproutNullifierFilter;
+    CBlockedBloomFilter saplingNullifierFilter;
+    //! Shared by every view of the chainstate (the tip, the mempool, block
+    //! validation); BatchWrite() updates it with the anchors it writes or
+    //! erases, so a disconnected anchor is never served from it.
+    mutable CAnchorTreeCache<SproutMerkleTree> sproutAnchorCache;
+    mutable CAnchorTreeCache<SaplingMerkleTree> saplingAnchorCache;
+
     CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    void LoadNullifierFilter(ShieldedType type);
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
     //! Open a coin database at an arbitrary path (not under GetDataDir()/chainstate).
@@ -42,8 +123,8 @@ public:
     bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
     bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
     bool GetNullifier(const uint256 &nf, ShieldedType type) const;
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
     uint256 GetBestAnchor(ShieldedType type) const;
     bool BatchWrite(CCoinsMap &mapCoins,
@@ -53,8 +134,19 @@ public:
                     CAnchorsSproutMap &mapSproutAnchors,
                     CAnchorsSaplingMap &mapSaplingAnchors,
                     CNullifiersMap &mapSproutNullifiers,
-                    CNullifiersMap &mapSaplingNullifiers);
+                    CNullifiersMap &mapSaplingNullifiers,
+                    bool fErase);
+    //! Scans the whole chainstate, split into ranges that are read in
+    //! parallel from one database snapshot.
     bool GetStats(CCoinsStats &stats) const;
+    //! Compute the rolling chainstate commitment from scratch with a scan of
+    //! the whole database.
+    bool GetUtxoCommitment(CUtxoCommitment &commitment) const;
+
+    //! Convert a chainstate that still stores one record per transaction to
+    //! one record per output. Resumable and interruptible; returns false if
+    //! the conversion did not complete (shutdown requested or a bad record).
+    bool Upgrade();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -76,6 +168,9 @@ public:
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
+    //! Rolling chainstate commitment as of the given block, kept for recent blocks.
+    bool ReadUtxoCommitment(const uint256 &hashBlock, CUtxoCommitment &commitment);
+    bool WriteUtxoCommitments(const std::vector<std::pair<uint256, const CUtxoCommitment*> > &vWrite, const std::vector<uint256> &vErase);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool WriteFlag(const std::string &name, bool fValue);
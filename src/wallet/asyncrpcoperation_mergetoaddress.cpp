@@ -137,10 +137,7 @@ void AsyncRPCOperation_mergetoaddress::main()
     start_execution_clock();
 
     bool success = false;
-
-#ifdef ENABLE_MINING
-    GenerateBitcoins(false, 0, Params());
-#endif
+    bool cancelled = false;
 
     try {
         success = main_impl();
@@ -149,6 +146,8 @@ void AsyncRPCOperation_mergetoaddress::main()
         std::string message = find_value(objError, "message").get_str();
         set_error_code(code);
         set_error_message(message);
+    } catch (const AsyncRPCOperationCancelled& e) {
+        cancelled = true;
     } catch (const runtime_error& e) {
         set_error_code(-1);
         set_error_message("runtime error: " + string(e.what()));
@@ -163,14 +162,12 @@ void AsyncRPCOperation_mergetoaddress::main()
         set_error_message("unknown error");
     }
 
-#ifdef ENABLE_MINING
-    GenerateBitcoins(GetBoolArg("-gen", false), GetArg("-genproclimit", 1), Params());
-#endif
-
     stop_execution_clock();
 
     if (success) {
         set_state(OperationStatus::SUCCESS);
+    } else if (cancelled) {
+        set_state(OperationStatus::CANCELLED);
     } else {
         set_state(OperationStatus::FAILED);
     }
@@ -365,6 +362,7 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
 
 
         // Build the transaction
+        throw_if_cancel_requested();
         tx_ = builder_.Build().GetTxOrThrow();
 
         // Send the transaction
@@ -758,6 +756,9 @@ extern UniValue signrawtransaction(const UniValue& params, bool fHelp);
  */
 void AsyncRPCOperation_mergetoaddress::sign_send_raw_transaction(UniValue obj)
 {
+    // Nothing has been broadcast yet, so a cancelled operation can still stop here
+    throw_if_cancel_requested();
+
     // Sign the raw transaction
     UniValue rawtxnValue = find_value(obj, "rawtxn");
     if (rawtxnValue.isNull()) {
@@ -847,6 +848,9 @@ UniValue AsyncRPCOperation_mergetoaddress::perform_joinsplit(
     std::vector<boost::optional<SproutWitness>> witnesses,
     uint256 anchor)
 {
+    // Each proof can take over a minute, so stop between them when cancelled
+    throw_if_cancel_requested();
+
     if (anchor.IsNull()) {
         throw std::runtime_error("anchor is null");
     }
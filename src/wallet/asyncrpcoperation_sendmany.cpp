@@ -28,13 +28,18 @@
 #include "wallet/paymentdisclosuredb.h"
 
 #include <array>
+#include <atomic>
 #include <iostream>
 #include <chrono>
+#include <mutex>
 #include <thread>
 #include <string>
 
 using namespace libzcash;
 
+// Maximum number of independent joinsplit proofs generated at once
+static const int MAX_JOINSPLIT_PROOF_THREADS = 4;
+
 extern UniValue signrawtransaction(const UniValue& params, bool fHelp);
 extern UniValue sendrawtransaction(const UniValue& params, bool fHelp);
 
@@ -133,10 +138,7 @@ void AsyncRPCOperation_sendmany::main() {
     start_execution_clock();
 
     bool success = false;
-
-#ifdef ENABLE_MINING
-    GenerateBitcoins(false, 0, Params());
-#endif
+    bool cancelled = false;
 
     try {
         success = main_impl();
@@ -145,6 +147,8 @@ void AsyncRPCOperation_sendmany::main() {
         std::string message = find_value(objError, "message").get_str();
         set_error_code(code);
         set_error_message(message);
+    } catch (const AsyncRPCOperationCancelled& e) {
+        cancelled = true;
     } catch (const runtime_error& e) {
         set_error_code(-1);
         set_error_message("runtime error: " + string(e.what()));
@@ -159,14 +163,12 @@ void AsyncRPCOperation_sendmany::main() {
         set_error_message("unknown error");
     }
 
-#ifdef ENABLE_MINING
-    GenerateBitcoins(GetBoolArg("-gen", false), GetArg("-genproclimit", 1), Params());
-#endif
-
     stop_execution_clock();
 
     if (success) {
         set_state(OperationStatus::SUCCESS);
+    } else if (cancelled) {
+        set_state(OperationStatus::CANCELLED);
     } else {
         set_state(OperationStatus::FAILED);
     }
@@ -465,6 +467,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         }
 
         // Build the transaction
+        throw_if_cancel_requested();
         tx_ = builder_.Build().GetTxOrThrow();
 
         // Send the transaction
@@ -610,7 +613,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         }
 
         // Create joinsplits, where each output represents a zaddr recipient.
-        UniValue obj(UniValue::VOBJ);
+        std::vector<AsyncJoinSplitInfo> infos;
         while (zOutputsDeque.size() > 0) {
             AsyncJoinSplitInfo info;
             info.vpub_old = 0;
@@ -633,8 +636,9 @@ bool AsyncRPCOperation_sendmany::main_impl() {
                 // Funds are removed from the value pool and enter the private pool
                 info.vpub_old += value;
             }
-            obj = perform_joinsplit(info);
+            infos.push_back(info);
         }
+        UniValue obj = perform_joinsplits(infos);
         sign_send_raw_transaction(obj);
         return true;
     }
@@ -924,6 +928,9 @@ bool AsyncRPCOperation_sendmany::main_impl() {
  */
 void AsyncRPCOperation_sendmany::sign_send_raw_transaction(UniValue obj)
 {   
+    // Nothing has been broadcast yet, so a cancelled operation can still stop here
+    throw_if_cancel_requested();
+
     // Sign the raw transaction
     UniValue rawtxnValue = find_value(obj, "rawtxn");
     if (rawtxnValue.isNull()) {
@@ -1118,6 +1125,79 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
         std::vector<boost::optional < SproutWitness>> witnesses,
         uint256 anchor)
 {
+    return add_joinsplit(prove_joinsplit(info, witnesses, anchor, tx_.vjoinsplit.size()));
+}
+
+UniValue AsyncRPCOperation_sendmany::perform_joinsplits(std::vector<AsyncJoinSplitInfo> & infos) {
+    uint256 anchor;
+    {
+        LOCK(cs_main);
+        anchor = pcoinsTip->GetBestAnchor(SPROUT);    // As there are no inputs, ask the wallet for the best anchor
+    }
+
+    // Sprout proofs made with libsnark are generated one at a time, as its
+    // prover is not thread safe. Each Groth prover reads its own copy of the
+    // Sprout parameters, which bounds how many can run at once.
+    int nWorkers = 1;
+    if (tx_.fOverwintered && tx_.nVersion >= SAPLING_TX_VERSION) {
+        nWorkers = std::min(std::min(GetNumCores(), MAX_JOINSPLIT_PROOF_THREADS), (int)infos.size());
+        nWorkers = std::max(1, nWorkers);
+    }
+
+    std::vector<AsyncJoinSplitProof> proofs(infos.size());
+    std::atomic<size_t> next(0);
+    std::mutex errMutex;
+    std::exception_ptr firstError;
+    size_t jsIndex = tx_.vjoinsplit.size();
+    auto worker = [&]() {
+        for (;;) {
+            size_t i = next.fetch_add(1);
+            if (i >= infos.size()) {
+                break;
+            }
+            try {
+                std::vector<boost::optional < SproutWitness>> witnesses;
+                proofs[i] = prove_joinsplit(infos[i], witnesses, anchor, jsIndex + i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errMutex);
+                if (!firstError) {
+                    firstError = std::current_exception();
+                }
+                next = infos.size(); // stop handing out the remaining joinsplits
+                break;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < nWorkers; i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread & t : workers) {
+        t.join();
+    }
+    if (firstError) {
+        std::rethrow_exception(firstError);
+    }
+
+    // Add the joinsplits in order; the signature over the last one covers them all
+    UniValue obj(UniValue::VOBJ);
+    for (const AsyncJoinSplitProof & proof : proofs) {
+        obj = add_joinsplit(proof);
+    }
+    return obj;
+}
+
+AsyncJoinSplitProof AsyncRPCOperation_sendmany::prove_joinsplit(
+        AsyncJoinSplitInfo & info,
+        std::vector<boost::optional < SproutWitness>> witnesses,
+        uint256 anchor,
+        size_t jsIndex) const
+{
+    // Each proof can take over a minute, so stop between them when cancelled
+    throw_if_cancel_requested();
+
     if (anchor.IsNull()) {
         throw std::runtime_error("anchor is null");
     }
@@ -1146,11 +1226,9 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
         throw runtime_error("unsupported joinsplit input/output counts");
     }
 
-    CMutableTransaction mtx(tx_);
-
     LogPrint("zrpcunsafe", "%s: creating joinsplit at index %d (vpub_old=%s, vpub_new=%s, in[0]=%s, in[1]=%s, out[0]=%s, out[1]=%s)\n",
             getId(),
-            tx_.vjoinsplit.size(),
+            jsIndex,
             FormatMoney(info.vpub_old), FormatMoney(info.vpub_new),
             FormatMoney(info.vjsin[0].note.value()), FormatMoney(info.vjsin[1].note.value()),
             FormatMoney(info.vjsout[0].value), FormatMoney(info.vjsout[1].value)
@@ -1159,33 +1237,38 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
     // Generate the proof, this can take over a minute.
     std::array<libzcash::JSInput, ZC_NUM_JS_INPUTS> inputs
             {info.vjsin[0], info.vjsin[1]};
-    std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> outputs
-            {info.vjsout[0], info.vjsout[1]};
-    std::array<size_t, ZC_NUM_JS_INPUTS> inputMap;
-    std::array<size_t, ZC_NUM_JS_OUTPUTS> outputMap;
+    AsyncJoinSplitProof proof;
+    proof.outputs = {info.vjsout[0], info.vjsout[1]};
 
-    uint256 esk; // payment disclosure - secret
-
-    JSDescription jsdesc = JSDescription::Randomized(
-            mtx.fOverwintered && (mtx.nVersion >= SAPLING_TX_VERSION),
+    proof.jsdesc = JSDescription::Randomized(
+            tx_.fOverwintered && (tx_.nVersion >= SAPLING_TX_VERSION),
             *pzcashParams,
             joinSplitPubKey_,
             anchor,
             inputs,
-            outputs,
-            inputMap,
-            outputMap,
+            proof.outputs,
+            proof.inputMap,
+            proof.outputMap,
             info.vpub_old,
             info.vpub_new,
             !this->testmode,
-            &esk); // parameter expects pointer to esk, so pass in address
+            &proof.esk); // parameter expects pointer to esk, so pass in address
     {
         auto verifier = libzcash::ProofVerifier::Strict();
-        if (!(jsdesc.Verify(*pzcashParams, verifier, joinSplitPubKey_))) {
+        if (!(proof.jsdesc.Verify(*pzcashParams, verifier, joinSplitPubKey_))) {
             throw std::runtime_error("error verifying joinsplit");
         }
     }
 
+    return proof;
+}
+
+UniValue AsyncRPCOperation_sendmany::add_joinsplit(const AsyncJoinSplitProof & proof) {
+    const JSDescription & jsdesc = proof.jsdesc;
+    const std::array<size_t, ZC_NUM_JS_INPUTS> & inputMap = proof.inputMap;
+    const std::array<size_t, ZC_NUM_JS_OUTPUTS> & outputMap = proof.outputMap;
+
+    CMutableTransaction mtx(tx_);
     mtx.vjoinsplit.push_back(jsdesc);
 
     // Empty output script.
@@ -1259,9 +1342,9 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
         uint8_t mapped_index = outputMap[i];
         // placeholder for txid will be filled in later when tx has been finalized and signed.
         PaymentDisclosureKey pdKey = {placeholder, js_index, mapped_index};
-        JSOutput output = outputs[mapped_index];
+        JSOutput output = proof.outputs[mapped_index];
         libzcash::SproutPaymentAddress zaddr = output.addr;  // randomized output
-        PaymentDisclosureInfo pdInfo = {PAYMENT_DISCLOSURE_VERSION_EXPERIMENTAL, esk, joinSplitPrivKey, zaddr};
+        PaymentDisclosureInfo pdInfo = {PAYMENT_DISCLOSURE_VERSION_EXPERIMENTAL, proof.esk, joinSplitPrivKey, zaddr};
         paymentDisclosureData_.push_back(PaymentDisclosureKeyInfo(pdKey, pdInfo));
 
         LogPrint("paymentdisclosure", "%s: Payment Disclosure: js=%d, n=%d, zaddr=%s\n", getId(), js_index, int(mapped_index), EncodePaymentAddress(zaddr));
@@ -44,6 +44,16 @@ struct AsyncJoinSplitInfo
     CAmount vpub_new = 0;
 };
 
+// A joinsplit whose proof has been generated, ready to be added to the transaction.
+struct AsyncJoinSplitProof
+{
+    JSDescription jsdesc;
+    std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> outputs;
+    std::array<size_t, ZC_NUM_JS_INPUTS> inputMap;
+    std::array<size_t, ZC_NUM_JS_OUTPUTS> outputMap;
+    uint256 esk; // payment disclosure - secret
+};
+
 // A struct to help us track the witness and anchor for a given JSOutPoint
 struct WitnessAnchorData {
 	boost::optional<SproutWitness> witness;
@@ -73,6 +83,11 @@ public:
 
     virtual UniValue getStatus() const;
 
+    // Inputs are selected from the from address when the operation executes
+    virtual std::string getInputSource() const {
+        return fromaddress_;
+    }
+
     bool testmode = false;  // Set to true to disable sending txs and generating proofs
 
     bool paymentDisclosureMode = false; // Set to true to save esk for encrypted notes in payment disclosure database.
@@ -127,6 +142,21 @@ private:
         std::vector<boost::optional < SproutWitness>> witnesses,
         uint256 anchor);
 
+    // JoinSplits without any input notes to spend, which do not depend on
+    // each other, so their proofs are generated in parallel
+    UniValue perform_joinsplits(std::vector<AsyncJoinSplitInfo> & infos);
+
+    // Generate and verify the proof of a joinsplit at index jsIndex, without
+    // touching tx_
+    AsyncJoinSplitProof prove_joinsplit(
+        AsyncJoinSplitInfo & info,
+        std::vector<boost::optional < SproutWitness>> witnesses,
+        uint256 anchor,
+        size_t jsIndex) const;
+
+    // Add a proven joinsplit to tx_ and sign it
+    UniValue add_joinsplit(const AsyncJoinSplitProof & proof);
+
     void sign_send_raw_transaction(UniValue obj);     // throws exception if there was an error
 
     // payment disclosure!
@@ -148,6 +178,10 @@ public:
     void setTx(CTransaction tx) {
         delegate->tx_ = tx;
     }
+
+    std::vector<PaymentDisclosureKeyInfo> getPaymentDisclosureData() {
+        return delegate->paymentDisclosureData_;
+    }
     
     // Delegated methods
     
@@ -191,6 +225,10 @@ public:
         return delegate->perform_joinsplit(info, witnesses, anchor);
     }
 
+    UniValue perform_joinsplits(std::vector<AsyncJoinSplitInfo> &infos) {
+        return delegate->perform_joinsplits(infos);
+    }
+
     void sign_send_raw_transaction(UniValue obj) {
         delegate->sign_send_raw_transaction(obj);
     }
@@ -107,10 +107,7 @@ void AsyncRPCOperation_shieldcoinbase::main() {
     start_execution_clock();
 
     bool success = false;
-
-#ifdef ENABLE_MINING
-    GenerateBitcoins(false, 0, Params());
-#endif
+    bool cancelled = false;
 
     try {
         success = main_impl();
@@ -119,6 +116,8 @@ void AsyncRPCOperation_shieldcoinbase::main() {
         std::string message = find_value(objError, "message").get_str();
         set_error_code(code);
         set_error_message(message);
+    } catch (const AsyncRPCOperationCancelled& e) {
+        cancelled = true;
     } catch (const runtime_error& e) {
         set_error_code(-1);
         set_error_message("runtime error: " + string(e.what()));
@@ -133,14 +132,12 @@ void AsyncRPCOperation_shieldcoinbase::main() {
         set_error_message("unknown error");
     }
 
-#ifdef ENABLE_MINING
-    GenerateBitcoins(GetBoolArg("-gen",false), GetArg("-genproclimit", 1), Params());
-#endif
-
     stop_execution_clock();
 
     if (success) {
         set_state(OperationStatus::SUCCESS);
+    } else if (cancelled) {
+        set_state(OperationStatus::CANCELLED);
     } else {
         set_state(OperationStatus::FAILED);
     }
@@ -265,6 +262,7 @@ bool ShieldToAddress::operator()(const libzcash::SaplingPaymentAddress &zaddr) c
     m_op->builder_.SendChangeTo(zaddr, ovk);
 
     // Build the transaction
+    m_op->throw_if_cancel_requested();
     m_op->tx_ = m_op->builder_.Build().GetTxOrThrow();
 
     // Send the transaction
@@ -306,6 +304,9 @@ bool ShieldToAddress::operator()(const libzcash::InvalidEncoding& no) const {
  */
 void AsyncRPCOperation_shieldcoinbase::sign_send_raw_transaction(UniValue obj)
 {
+    // Nothing has been broadcast yet, so a cancelled operation can still stop here
+    throw_if_cancel_requested();
+
     // Sign the raw transaction
     UniValue rawtxnValue = find_value(obj, "rawtxn");
     if (rawtxnValue.isNull()) {
@@ -368,6 +369,8 @@ void AsyncRPCOperation_shieldcoinbase::sign_send_raw_transaction(UniValue obj)
 
 
 UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInfo & info) {
+    throw_if_cancel_requested();
+
     uint32_t consensusBranchId;
     uint256 anchor;
     {
@@ -14,12 +14,14 @@
 #include "transaction_builder.h"
 #include "utiltest.h"
 #include "wallet/wallet.h"
+#include "wallet/walletdb.h"
 #include "zcash/JoinSplit.hpp"
 #include "zcash/Note.hpp"
 #include "zcash/NoteEncryption.hpp"
 
 #include <boost/filesystem.hpp>
 
+using ::testing::An;
 using ::testing::Return;
 
 extern ZCJoinSplit* params;
@@ -37,6 +39,22 @@ public:
     MOCK_METHOD2(WriteTx, bool(uint256 hash, const CWalletTx& wtx));
     MOCK_METHOD1(WriteWitnessCacheSize, bool(int64_t nWitnessCacheSize));
     MOCK_METHOD1(WriteBestBlock, bool(const CBlockLocator& loc));
+
+    MOCK_METHOD3(WriteNoteWitness, bool(const JSOutPoint& op, int height, const SproutWitness& witness));
+    MOCK_METHOD3(WriteNoteWitness, bool(const SaplingOutPoint& op, int height, const SaplingWitness& witness));
+    MOCK_METHOD2(EraseNoteWitness, bool(const JSOutPoint& op, int height));
+    MOCK_METHOD2(EraseNoteWitness, bool(const SaplingOutPoint& op, int height));
+    MOCK_METHOD3(WriteNoteWitnessHeight, bool(const JSOutPoint& op, int height, int nWitnesses));
+    MOCK_METHOD3(WriteNoteWitnessHeight, bool(const SaplingOutPoint& op, int height, int nWitnesses));
+
+    MockWalletDB() {
+        ON_CALL(*this, WriteNoteWitness(An<const JSOutPoint&>(), ::testing::_, ::testing::_)).WillByDefault(Return(true));
+        ON_CALL(*this, WriteNoteWitness(An<const SaplingOutPoint&>(), ::testing::_, ::testing::_)).WillByDefault(Return(true));
+        ON_CALL(*this, EraseNoteWitness(An<const JSOutPoint&>(), ::testing::_)).WillByDefault(Return(true));
+        ON_CALL(*this, EraseNoteWitness(An<const SaplingOutPoint&>(), ::testing::_)).WillByDefault(Return(true));
+        ON_CALL(*this, WriteNoteWitnessHeight(An<const JSOutPoint&>(), ::testing::_, ::testing::_)).WillByDefault(Return(true));
+        ON_CALL(*this, WriteNoteWitnessHeight(An<const SaplingOutPoint&>(), ::testing::_, ::testing::_)).WillByDefault(Return(true));
+    }
 };
 
 template void CWallet::SetBestChainINTERNAL<MockWalletDB>(
@@ -82,7 +100,22 @@ public:
         pScanSaplingBatch = p;
     }
     bool ScanBatchIsNull() const {
-        return pScanSaplingBatch == nullptr;
+        return pScanSaplingBatch == nullptr && pScanSproutBatch == nullptr;
+    }
+    void CallBuildSproutScanBatch(
+        const std::vector<std::pair<CBlockIndex*, CBlock>>& window,
+        int nWorkers,
+        std::map<JSOutPoint, SproutOutputMatch>& out) {
+        CWallet::BuildSproutScanBatch(window, nWorkers, out);
+    }
+    void CallBuildSproutScanBatch(
+        const std::vector<const CBlock*>& blocks,
+        int nWorkers,
+        std::map<JSOutPoint, SproutOutputMatch>& out) {
+        CWallet::BuildSproutScanBatch(blocks, nWorkers, out);
+    }
+    void SetScanSproutBatch(const std::map<JSOutPoint, SproutOutputMatch>* p) {
+        pScanSproutBatch = p;
     }
 };
 
@@ -413,6 +446,298 @@ TEST(WalletTests, FindUnspentSproutNotes) {
 }
 
 
+TEST(WalletTests, FilteredNotesFollowDisconnectedSpends) {
+    SelectParams(CBaseChainParams::TESTNET);
+    CWallet wallet;
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    auto wtx = GetValidSproutReceive(sk, 10, true);
+    auto note = GetSproutNote(sk, wtx, 0, 1);
+    auto nullifier = note.nullifier(sk);
+
+    mapSproutNoteData_t noteData;
+    JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+    SproutNoteData nd {sk.address(), nullifier};
+    noteData[jsoutpt] = nd;
+    wtx.SetSproutNoteData(noteData);
+
+    // Fake-mine the transaction
+    CBlock block;
+    block.vtx.push_back(wtx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    auto blockHash = block.GetHash();
+    CBlockIndex fakeIndex {block};
+    mapBlockIndex.insert(std::make_pair(blockHash, &fakeIndex));
+    chainActive.SetTip(&fakeIndex);
+    wtx.SetMerkleBranch(block);
+    wallet.AddToWallet(wtx, true, NULL);
+
+    std::vector<CSproutNotePlaintextEntry> sproutEntries;
+    std::vector<SaplingNoteEntry> saplingEntries;
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, "", 1);
+    EXPECT_EQ(1, sproutEntries.size());
+    sproutEntries.clear();
+
+    // Fake-mine a spend transaction
+    auto wtx2 = GetValidSproutSpend(sk, note, 5);
+    CBlock block2;
+    block2.vtx.push_back(wtx2);
+    block2.hashMerkleRoot = block2.BuildMerkleTree();
+    block2.hashPrevBlock = blockHash;
+    auto blockHash2 = block2.GetHash();
+    CBlockIndex fakeIndex2 {block2};
+    mapBlockIndex.insert(std::make_pair(blockHash2, &fakeIndex2));
+    fakeIndex2.nHeight = 1;
+    fakeIndex2.pprev = &fakeIndex;
+    chainActive.SetTip(&fakeIndex2);
+    wtx2.SetMerkleBranch(block2);
+    wallet.AddToWallet(wtx2, true, NULL);
+
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, "", 1);
+    EXPECT_EQ(0, sproutEntries.size());
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, "", 1, false);
+    EXPECT_EQ(1, sproutEntries.size());
+    sproutEntries.clear();
+
+    // Disconnecting the block with the spend makes the note spendable again
+    chainActive.SetTip(&fakeIndex);
+    wallet.nWitnessCacheSize = 2;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+    wallet.ChainTip(&fakeIndex2, &block2, sproutTree, saplingTree, false);
+    EXPECT_FALSE(wallet.IsSproutSpent(nullifier));
+
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, "", 1);
+    EXPECT_EQ(1, sproutEntries.size());
+    sproutEntries.clear();
+
+    // Notes are only returned for the addresses asked for
+    std::set<libzcash::PaymentAddress> filterAddresses {sk.address()};
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, filterAddresses, 1);
+    EXPECT_EQ(1, sproutEntries.size());
+    sproutEntries.clear();
+    std::set<libzcash::PaymentAddress> otherAddresses {libzcash::SproutSpendingKey::random().address()};
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, otherAddresses, 1);
+    EXPECT_EQ(0, sproutEntries.size());
+
+    // Tear down
+    chainActive.SetTip(NULL);
+    mapBlockIndex.erase(blockHash);
+    mapBlockIndex.erase(blockHash2);
+}
+
+TEST(WalletTests, AvailableCoinsFollowDisconnectedSpends) {
+    SelectParams(CBaseChainParams::TESTNET);
+    CWallet wallet;
+    CKey tsk = AddTestCKeyToKeyStore(wallet);
+    auto scriptPubKey = GetScriptForDestination(tsk.GetPubKey().GetID());
+    CKey otherKey;
+    otherKey.MakeNewKey(true);
+    auto otherScript = GetScriptForDestination(otherKey.GetPubKey().GetID());
+
+    // The second output pays a script the wallet does not know yet
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(uint256S("0000000000000000000000000000000000000000000000000000000000000001"), 0);
+    mtx.vout.resize(2);
+    mtx.vout[0].nValue = 50000;
+    mtx.vout[0].scriptPubKey = scriptPubKey;
+    mtx.vout[1].nValue = 30000;
+    mtx.vout[1].scriptPubKey = otherScript;
+    CWalletTx wtx {&wallet, mtx};
+
+    // Fake-mine the transaction
+    CBlock block;
+    block.vtx.push_back(wtx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    auto blockHash = block.GetHash();
+    CBlockIndex fakeIndex {block};
+    mapBlockIndex.insert(std::make_pair(blockHash, &fakeIndex));
+    chainActive.SetTip(&fakeIndex);
+    wtx.SetMerkleBranch(block);
+    wallet.AddToWallet(wtx, true, NULL);
+
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins, true);
+    EXPECT_EQ(1, vCoins.size());
+
+    // Fake-mine a spend transaction paying someone else
+    CMutableTransaction mtx2;
+    mtx2.vin.resize(1);
+    mtx2.vin[0].prevout = COutPoint(wtx.GetHash(), 0);
+    mtx2.vout.resize(1);
+    mtx2.vout[0].nValue = 40000;
+    mtx2.vout[0].scriptPubKey = otherScript;
+    CWalletTx wtx2 {&wallet, mtx2};
+    CBlock block2;
+    block2.vtx.push_back(wtx2);
+    block2.hashMerkleRoot = block2.BuildMerkleTree();
+    block2.hashPrevBlock = blockHash;
+    auto blockHash2 = block2.GetHash();
+    CBlockIndex fakeIndex2 {block2};
+    mapBlockIndex.insert(std::make_pair(blockHash2, &fakeIndex2));
+    fakeIndex2.nHeight = 1;
+    fakeIndex2.pprev = &fakeIndex;
+    chainActive.SetTip(&fakeIndex2);
+    wtx2.SetMerkleBranch(block2);
+    wallet.AddToWallet(wtx2, true, NULL);
+
+    wallet.AvailableCoins(vCoins, true);
+    EXPECT_EQ(0, vCoins.size());
+
+    // Disconnecting the block with the spend makes the coin available again
+    chainActive.SetTip(&fakeIndex);
+    wallet.nWitnessCacheSize = 2;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+    wallet.ChainTip(&fakeIndex2, &block2, sproutTree, saplingTree, false);
+
+    wallet.AvailableCoins(vCoins, true);
+    ASSERT_EQ(1, vCoins.size());
+    EXPECT_EQ(wtx.GetHash(), vCoins[0].tx->GetHash());
+    EXPECT_TRUE(vCoins[0].fSpendable);
+
+    // Watching a script picks up the wallet outputs already paying to it
+    wallet.AddWatchOnly(otherScript);
+    wallet.AvailableCoins(vCoins, true);
+    ASSERT_EQ(2, vCoins.size());
+    EXPECT_EQ(1, std::count_if(vCoins.begin(), vCoins.end(), [](const COutput& out) { return !out.fSpendable; }));
+
+    // Tear down
+    chainActive.SetTip(NULL);
+    mapBlockIndex.erase(blockHash);
+    mapBlockIndex.erase(blockHash2);
+}
+
+TEST(WalletTests, LoadWalletDecodesRecordsInParallel) {
+    SelectParams(CBaseChainParams::TESTNET);
+    const std::string strWalletFile = "wallet_loadparallel.dat";
+    const int nTxs = 2500;
+
+    // Enough transactions for several decoding batches, the first of which
+    // carries a note with a cached witness in the witness records
+    auto sk = libzcash::SproutSpendingKey::random();
+    SproutMerkleTree tree;
+    tree.append(GetRandHash());
+    SproutWitness witness1 = tree.witness();
+    tree.append(GetRandHash());
+    SproutWitness witness2 = tree.witness();
+    JSOutPoint jsoutpt;
+    {
+        CWalletDB db(strWalletFile, "cr+");
+        for (int i = 0; i < nTxs; i++) {
+            CMutableTransaction mtx;
+            mtx.vin.resize(1);
+            mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+            mtx.vout.resize(1);
+            mtx.vout[0].nValue = i + 1;
+            CWalletTx wtx {NULL, mtx};
+            wtx.nOrderPos = i;
+            if (i == 0) {
+                jsoutpt = JSOutPoint(wtx.GetHash(), 0, 1);
+                wtx.mapSproutNoteData[jsoutpt] = SproutNoteData {sk.address(), uint256()};
+            }
+            ASSERT_TRUE(db.WriteTx(wtx.GetHash(), wtx));
+        }
+        ASSERT_TRUE(db.WriteNoteWitness(jsoutpt, 5, witness1));
+        ASSERT_TRUE(db.WriteNoteWitness(jsoutpt, 6, witness2));
+        ASSERT_TRUE(db.WriteNoteWitnessHeight(jsoutpt, 6, 2));
+        // Records of a transaction no longer in the wallet are skipped
+        JSOutPoint orphan {GetRandHash(), 0, 0};
+        ASSERT_TRUE(db.WriteNoteWitness(orphan, 6, witness2));
+        ASSERT_TRUE(db.WriteNoteWitnessHeight(orphan, 6, 1));
+    }
+
+    bool fFirstRun;
+    CWallet serialWallet(strWalletFile);
+    ASSERT_EQ(DB_LOAD_OK, serialWallet.LoadWallet(fFirstRun, 0));
+    CWallet parallelWallet(strWalletFile);
+    ASSERT_EQ(DB_LOAD_OK, parallelWallet.LoadWallet(fFirstRun, 4));
+
+    ASSERT_EQ(nTxs, serialWallet.mapWallet.size());
+    ASSERT_EQ(nTxs, parallelWallet.mapWallet.size());
+    for (const auto& item : serialWallet.mapWallet) {
+        auto it = parallelWallet.mapWallet.find(item.first);
+        ASSERT_TRUE(it != parallelWallet.mapWallet.end());
+        EXPECT_EQ(item.second.nOrderPos, it->second.nOrderPos);
+        EXPECT_EQ(item.second.vout, it->second.vout);
+    }
+
+    for (CWallet* pwallet : {&serialWallet, &parallelWallet}) {
+        const SproutNoteData& nd = pwallet->mapWallet[jsoutpt.hash].mapSproutNoteData[jsoutpt];
+        EXPECT_EQ(6, nd.witnessHeight);
+        ASSERT_EQ(2, nd.witnesses.size());
+        EXPECT_EQ(witness2, nd.witnesses.front());
+        EXPECT_EQ(witness1, nd.witnesses.back());
+        EXPECT_TRUE(nd.witnessRecords.fStored);
+    }
+}
+
+
+TEST(WalletTests, RemovingTransactionErasesWitnessRecords) {
+    SelectParams(CBaseChainParams::TESTNET);
+    const std::string strWalletFile = "wallet_erasewitnesses.dat";
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    SproutMerkleTree tree;
+    tree.append(GetRandHash());
+    SproutWitness witness1 = tree.witness();
+    tree.append(GetRandHash());
+    SproutWitness witness2 = tree.witness();
+
+    auto writeTxWithWitnesses = [&](int nOrderPos, bool fWitnesses) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(uint256S("1"), nOrderPos);
+        CWalletTx wtx {NULL, mtx};
+        wtx.nOrderPos = nOrderPos;
+        JSOutPoint jsoutpt(wtx.GetHash(), 0, 1);
+        wtx.mapSproutNoteData[jsoutpt] = SproutNoteData {sk.address(), uint256()};
+        CWalletDB db(strWalletFile, "cr+");
+        EXPECT_TRUE(db.WriteTx(wtx.GetHash(), wtx));
+        if (fWitnesses) {
+            EXPECT_TRUE(db.WriteNoteWitness(jsoutpt, 5, witness1));
+            EXPECT_TRUE(db.WriteNoteWitness(jsoutpt, 6, witness2));
+            EXPECT_TRUE(db.WriteNoteWitnessHeight(jsoutpt, 6, 2));
+        }
+        return jsoutpt;
+    };
+    auto storedWitnesses = [&](const JSOutPoint& jsoutpt) {
+        bool fFirstRun;
+        CWallet wallet(strWalletFile);
+        EXPECT_EQ(DB_LOAD_OK, wallet.LoadWallet(fFirstRun));
+        const SproutNoteData& nd = wallet.mapWallet[jsoutpt.hash].mapSproutNoteData[jsoutpt];
+        EXPECT_EQ(nd.witnessRecords.fStored, nd.witnesses.size() > 0);
+        return nd.witnesses.size();
+    };
+
+    // EraseFromWallet takes the records with the transaction, so a later
+    // copy of it does not pick up the old witnesses
+    JSOutPoint erased = writeTxWithWitnesses(0, true);
+    EXPECT_EQ(2, storedWitnesses(erased));
+    {
+        bool fFirstRun;
+        CWallet wallet(strWalletFile);
+        ASSERT_EQ(DB_LOAD_OK, wallet.LoadWallet(fFirstRun));
+        wallet.EraseFromWallet(erased.hash);
+    }
+    writeTxWithWitnesses(0, false);
+    EXPECT_EQ(0, storedWitnesses(erased));
+
+    // So does ZapWalletTx, for every transaction it removes
+    JSOutPoint zapped = writeTxWithWitnesses(1, true);
+    EXPECT_EQ(2, storedWitnesses(zapped));
+    {
+        CWallet wallet(strWalletFile);
+        std::vector<CWalletTx> vWtx;
+        ASSERT_EQ(DB_LOAD_OK, wallet.ZapWalletTx(vWtx));
+        EXPECT_EQ(2, vWtx.size());
+    }
+    writeTxWithWitnesses(1, false);
+    EXPECT_EQ(0, storedWitnesses(zapped));
+}
+
 TEST(WalletTests, SetSproutNoteAddrsInCWalletTx) {
     auto sk = libzcash::SproutSpendingKey::random();
     auto wtx = GetValidSproutReceive(sk, 10, true);
@@ -1028,6 +1353,143 @@ TEST(WalletTests, FindMySproutNotes) {
     EXPECT_EQ(nd, noteMap[jsoutpt]);
 }
 
+// The parallel Sprout batch must give FindMySproutNotes exactly the note data
+// of the serial path, for every worker count.
+TEST(WalletTests, ParallelSproutScanBatchParity) {
+    TestWallet wallet;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+    auto sk2 = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk2);
+
+    auto wtx = GetValidSproutReceive(sk, 10, true);
+    auto other = GetValidSproutReceive(libzcash::SproutSpendingKey::random(), 10, true);
+
+    auto serial = wallet.FindMySproutNotes(wtx);
+    ASSERT_EQ(2, serial.size());
+
+    // Enough JoinSplits to cross the parallel threshold, most of them not ours.
+    CBlock block;
+    block.vtx.push_back(wtx);
+    for (int i = 0; i < 40; i++) {
+        block.vtx.push_back(other);
+    }
+    std::vector<const CBlock*> blocks(1, &block);
+
+    for (int w : {1, 2, 4, 8}) {
+        std::map<JSOutPoint, SproutOutputMatch> batch;
+        wallet.CallBuildSproutScanBatch(blocks, w, batch);
+        EXPECT_EQ(2, batch.size()) << "workers=" << w;
+
+        wallet.SetScanSproutBatch(&batch);
+        auto par = wallet.FindMySproutNotes(wtx);
+        EXPECT_EQ(0, wallet.FindMySproutNotes(other).size());
+        wallet.SetScanSproutBatch(nullptr);
+
+        ASSERT_EQ(serial.size(), par.size()) << "workers=" << w;
+        for (const auto& kv : serial) {
+            ASSERT_EQ(1, par.count(kv.first)) << "workers=" << w;
+            EXPECT_EQ(kv.second, par[kv.first]);
+            EXPECT_TRUE(kv.second.value == par[kv.first].value);
+        }
+    }
+}
+
+// Windowed Sprout rescan: however the chain is cut into windows and however
+// many workers decrypt them, every wallet key finds the notes it finds on the
+// serial path, and nothing else.
+TEST(WalletTests, ParallelSproutScanWindowedParity) {
+    TestWallet wallet;
+
+    std::vector<libzcash::SproutSpendingKey> keys;
+    for (int i = 0; i < 3; i++) {
+        keys.push_back(libzcash::SproutSpendingKey::random());
+        wallet.AddSproutSpendingKey(keys.back());
+    }
+    auto stranger = libzcash::SproutSpendingKey::random();
+
+    std::vector<std::pair<CBlockIndex*, CBlock>> chain;
+    for (int h = 0; h < 6; h++) {
+        CBlock block;
+        block.vtx.push_back(GetValidSproutReceive(keys[h % keys.size()], 10 + h, true));
+        block.vtx.push_back(GetValidSproutReceive(stranger, 10, true));
+        chain.push_back(std::make_pair((CBlockIndex*)nullptr, block));
+    }
+
+    mapSproutNoteData_t serial;
+    for (const auto& wb : chain) {
+        for (const CTransaction& tx : wb.second.vtx) {
+            auto found = wallet.FindMySproutNotes(tx);
+            serial.insert(found.begin(), found.end());
+        }
+    }
+    ASSERT_EQ(12, serial.size());
+
+    for (size_t windowBlocks : {(size_t)1, (size_t)4, (size_t)6}) {
+        for (int w : {1, 2, 4}) {
+            mapSproutNoteData_t par;
+            for (size_t i = 0; i < chain.size(); i += windowBlocks) {
+                std::vector<std::pair<CBlockIndex*, CBlock>> window(
+                    chain.begin() + i, chain.begin() + std::min(chain.size(), i + windowBlocks));
+                std::map<JSOutPoint, SproutOutputMatch> batch;
+                wallet.CallBuildSproutScanBatch(window, w, batch);
+
+                wallet.SetScanSproutBatch(&batch);
+                for (const auto& wb : window) {
+                    for (const CTransaction& tx : wb.second.vtx) {
+                        auto found = wallet.FindMySproutNotes(tx);
+                        par.insert(found.begin(), found.end());
+                    }
+                }
+                wallet.SetScanSproutBatch(nullptr);
+            }
+
+            ASSERT_EQ(serial.size(), par.size()) << "windowBlocks=" << windowBlocks << " workers=" << w;
+            for (const auto& kv : serial) {
+                ASSERT_EQ(1, par.count(kv.first));
+                EXPECT_EQ(kv.second, par[kv.first]);
+                EXPECT_TRUE(kv.second.value == par[kv.first].value);
+            }
+        }
+    }
+}
+
+// Transactions of a connected block go through the block's trial-decryption
+// batch and end up in the wallet exactly as with the serial path.
+TEST(WalletTests, SyncTransactionUsesBlockScanBatch) {
+    auto sk = libzcash::SproutSpendingKey::random();
+    auto wtx = GetValidSproutReceive(sk, 10, true);
+    auto note = GetSproutNote(sk, wtx, 0, 1);
+
+    CBlock block;
+    block.vtx.push_back(wtx);
+    for (int i = 0; i < 20; i++) {
+        block.vtx.push_back(GetValidSproutReceive(libzcash::SproutSpendingKey::random(), 10, true));
+    }
+
+    int nScriptCheckThreadsOld = nScriptCheckThreads;
+    for (int threads : {0, 4}) {
+        nScriptCheckThreads = threads;
+        TestWallet wallet;
+        wallet.AddSproutSpendingKey(sk);
+
+        for (const CTransaction& tx : block.vtx) {
+            wallet.SyncTransaction(tx, &block);
+        }
+        EXPECT_TRUE(wallet.ScanBatchIsNull());
+
+        ASSERT_EQ(1, wallet.mapWallet.size()) << "threads=" << threads;
+        auto& noteData = wallet.mapWallet[wtx.GetHash()].mapSproutNoteData;
+        ASSERT_EQ(2, noteData.size());
+        JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+        SproutNoteData nd {sk.address(), note.nullifier(sk)};
+        EXPECT_EQ(nd, noteData[jsoutpt]);
+        EXPECT_TRUE(noteData[jsoutpt].value == CAmount(note.value()));
+    }
+    nScriptCheckThreads = nScriptCheckThreadsOld;
+}
+
 TEST(WalletTests, FindMySproutNotesInEncryptedWallet) {
     TestWallet wallet;
     uint256 r {GetRandHash()};
@@ -1919,6 +2381,43 @@ TEST(WalletTests, CachedWitnessesCleanIndex) {
     }
 }
 
+TEST(WalletTests, CachedWitnessesDropOnInconsistentTree) {
+    TestWallet wallet;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    CBlock block1;
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    auto outpts = CreateValidBlock(wallet, sk, index1, block1, sproutTree, saplingTree);
+
+    std::vector<JSOutPoint> sproutNotes {outpts.first};
+    std::vector<SaplingOutPoint> saplingNotes {outpts.second};
+    std::vector<boost::optional<SproutWitness>> sproutWitnesses;
+    std::vector<boost::optional<SaplingWitness>> saplingWitnesses;
+    GetWitnessesAndAnchors(wallet, sproutNotes, saplingNotes, sproutWitnesses, saplingWitnesses);
+    EXPECT_TRUE((bool) sproutWitnesses[0]);
+
+    // A tree the cached witness was never part of cannot advance it
+    SproutMerkleTree otherTree {sproutTree};
+    for (int i = 0; i < 5; i++) {
+        otherTree.append(GetRandHash());
+    }
+    CBlock block2;
+    block2.hashPrevBlock = block1.GetHash();
+    CBlockIndex index2(block2);
+    index2.nHeight = 2;
+    EXPECT_NO_THROW(wallet.IncrementNoteWitnesses(&index2, &block2, otherTree, saplingTree));
+
+    // The note's cache is dropped rather than left half advanced
+    GetWitnessesAndAnchors(wallet, sproutNotes, saplingNotes, sproutWitnesses, saplingWitnesses);
+    EXPECT_FALSE((bool) sproutWitnesses[0]);
+    EXPECT_EQ(0, wallet.mapWallet[outpts.first.hash].mapSproutNoteData[outpts.first].witnesses.size());
+}
+
 TEST(WalletTests, ClearNoteWitnessCache) {
     TestWallet wallet;
 
@@ -2143,6 +2642,91 @@ TEST(WalletTests, SetBestChainIgnoresTxsWithoutShieldedData) {
     wallet.SetBestChain(walletdb, loc);
 }
 
+TEST(WalletTests, SetBestChainWritesWitnessDeltas) {
+    TestWallet wallet;
+    MockWalletDB walletdb;
+    CBlockLocator loc;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    EXPECT_CALL(walletdb, TxnBegin())
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteWitnessCacheSize(::testing::_))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteBestBlock(loc))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, TxnCommit())
+        .WillRepeatedly(Return(true));
+
+    CBlock block1;
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    auto outpts = CreateValidBlock(wallet, sk, index1, block1, sproutTree, saplingTree);
+    JSOutPoint jsoutpt = outpts.first;
+
+    // The first write stores the transaction, the witness and its height
+    EXPECT_CALL(walletdb, WriteTx(jsoutpt.hash, ::testing::_))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitness(jsoutpt, 1, An<const SproutWitness&>()))
+        .Times(1);
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(jsoutpt, 1, 1))
+        .Times(1);
+    EXPECT_CALL(walletdb, EraseNoteWitness(An<const JSOutPoint&>(), ::testing::_))
+        .Times(0);
+    wallet.SetBestChain(walletdb, loc);
+    ::testing::Mock::VerifyAndClearExpectations(&walletdb);
+
+    // A new block only adds the witness at the new tip
+    CBlock block2;
+    CBlockIndex index2(block2);
+    index2.nHeight = 2;
+    wallet.IncrementNoteWitnesses(&index2, &block2, sproutTree, saplingTree);
+
+    EXPECT_CALL(walletdb, WriteTx(::testing::_, ::testing::_))
+        .Times(0);
+    EXPECT_CALL(walletdb, WriteNoteWitness(jsoutpt, 1, An<const SproutWitness&>()))
+        .Times(0);
+    EXPECT_CALL(walletdb, WriteNoteWitness(jsoutpt, 2, An<const SproutWitness&>()))
+        .Times(1);
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(jsoutpt, 2, 2))
+        .Times(1);
+    EXPECT_CALL(walletdb, EraseNoteWitness(An<const JSOutPoint&>(), ::testing::_))
+        .Times(0);
+    wallet.SetBestChain(walletdb, loc);
+    ::testing::Mock::VerifyAndClearExpectations(&walletdb);
+
+    // Replacing the tip rewrites its witness even though the range is unchanged
+    wallet.DecrementNoteWitnesses(&index2);
+    wallet.IncrementNoteWitnesses(&index2, &block2, sproutTree, saplingTree);
+
+    EXPECT_CALL(walletdb, WriteTx(::testing::_, ::testing::_))
+        .Times(0);
+    EXPECT_CALL(walletdb, WriteNoteWitness(jsoutpt, 1, An<const SproutWitness&>()))
+        .Times(0);
+    EXPECT_CALL(walletdb, WriteNoteWitness(jsoutpt, 2, An<const SproutWitness&>()))
+        .Times(1);
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(An<const JSOutPoint&>(), ::testing::_, ::testing::_))
+        .Times(0);
+    wallet.SetBestChain(walletdb, loc);
+    ::testing::Mock::VerifyAndClearExpectations(&walletdb);
+
+    // Disconnecting the tip erases its witness
+    wallet.DecrementNoteWitnesses(&index2);
+
+    EXPECT_CALL(walletdb, WriteTx(::testing::_, ::testing::_))
+        .Times(0);
+    EXPECT_CALL(walletdb, WriteNoteWitness(An<const JSOutPoint&>(), ::testing::_, ::testing::_))
+        .Times(0);
+    EXPECT_CALL(walletdb, EraseNoteWitness(jsoutpt, 2))
+        .Times(1);
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(jsoutpt, 1, 1))
+        .Times(1);
+    wallet.SetBestChain(walletdb, loc);
+}
+
 TEST(WalletTests, UpdateSproutNullifierNoteMap) {
     TestWallet wallet;
     uint256 r {GetRandHash()};
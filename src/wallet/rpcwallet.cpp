@@ -2757,7 +2757,25 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
                 sample_times.push_back(std::accumulate(vals.begin(), vals.end(), 0.0) / (nThreads*nThreads));
             }
         } else if (benchmarktype == "verifyjoinsplit") {
-            sample_times.push_back(benchmark_verify_joinsplit(samplejoinsplit));
+            if (params.size() < 4) {
+                sample_times.push_back(benchmark_verify_joinsplit(samplejoinsplit));
+            } else {
+                int nThreads = params[3].get_int();
+                std::vector<double> vals = benchmark_verify_joinsplit_threaded(samplejoinsplit, nThreads);
+                // Divide by nThreads^2 to get average seconds per JoinSplit because
+                // we are verifying one JoinSplit per thread.
+                sample_times.push_back(std::accumulate(vals.begin(), vals.end(), 0.0) / (nThreads*nThreads));
+            }
+        } else if (benchmarktype == "verifyjoinsplitsigs") {
+            int nTxs = params[2].get_int();
+            int nThreads = 1;
+            if (params.size() >= 4) {
+                nThreads = params[3].get_int();
+            }
+            if (nTxs <= 0 || nThreads <= 0) {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Invalid transaction or thread count");
+            }
+            sample_times.push_back(benchmark_verify_joinsplit_sigs(nTxs, nThreads));
 #ifdef ENABLE_MINING
         } else if (benchmarktype == "solveequihash") {
             if (params.size() < 3) {
@@ -2804,7 +2822,14 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             if (Params().NetworkIDString() != "regtest") {
                 throw JSONRPCError(RPC_TYPE_ERROR, "Benchmark must be run in regtest mode");
             }
-            sample_times.push_back(benchmark_loadwallet());
+            int nThreads = -1;
+            if (params.size() >= 3) {
+                nThreads = params[2].get_int();
+                if (nThreads < 0) {
+                    throw JSONRPCError(RPC_TYPE_ERROR, "Invalid thread count");
+                }
+            }
+            sample_times.push_back(benchmark_loadwallet(nThreads));
         } else if (benchmarktype == "listunspent") {
             sample_times.push_back(benchmark_listunspent());
         } else if (benchmarktype == "createsaplingspend") {
@@ -3638,6 +3663,13 @@ UniValue z_getoperationstatus(const UniValue& params, bool fHelp)
             "1. \"operationid\"         (array, optional) A list of operation ids we are interested in.  If not provided, examine all operations known to the node.\n"
             "\nResult:\n"
             "\"    [object, ...]\"      (array) A list of JSON objects\n"
+            "\nEach object includes the operation's priority (\"normal\" or \"low\"), the seconds it spent queued\n"
+            "(queued_secs) and executing (execution_secs), and while queued, the number of operations ahead of it (queue_position).\n"
+            "It also includes the depth of the whole queue when the call was made:\n"
+            "  \"queue\": {\n"
+            "    \"queued\": {\"normal\": n, \"low\": n},     (numeric) Operations waiting for a worker, per priority\n"
+            "    \"executing\": {\"normal\": n, \"low\": n}   (numeric) Operations running on a worker, per priority\n"
+            "  }\n"
             "\nExamples:\n"
             + HelpExampleCli("z_getoperationstatus", "'[\"operationid\", ... ]'")
             + HelpExampleRpc("z_getoperationstatus", "'[\"operationid\", ... ]'")
@@ -3649,8 +3681,6 @@ UniValue z_getoperationstatus(const UniValue& params, bool fHelp)
 
 UniValue z_getoperationstatus_IMPL(const UniValue& params, bool fRemoveFinishedOperations=false)
 {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     std::set<AsyncRPCOperationId> filter;
     if (params.size()==1) {
         UniValue ids = params[0].get_array();
@@ -3664,6 +3694,16 @@ UniValue z_getoperationstatus_IMPL(const UniValue& params, bool fRemoveFinishedO
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
     std::vector<AsyncRPCOperationId> ids = q->getAllOperationIds();
 
+    UniValue queued(UniValue::VOBJ);
+    UniValue executing(UniValue::VOBJ);
+    queued.push_back(Pair("normal", (uint64_t)q->getOperationCount(OperationPriority::NORMAL)));
+    queued.push_back(Pair("low", (uint64_t)q->getOperationCount(OperationPriority::LOW)));
+    executing.push_back(Pair("normal", (uint64_t)q->getExecutingCount(OperationPriority::NORMAL)));
+    executing.push_back(Pair("low", (uint64_t)q->getExecutingCount(OperationPriority::LOW)));
+    UniValue depth(UniValue::VOBJ);
+    depth.push_back(Pair("queued", queued));
+    depth.push_back(Pair("executing", executing));
+
     for (auto id : ids) {
         if (useFilter && !filter.count(id))
             continue;
@@ -3676,7 +3716,15 @@ UniValue z_getoperationstatus_IMPL(const UniValue& params, bool fRemoveFinishedO
         }
 
         UniValue obj = operation->getStatus();
+        obj.push_back(Pair("queue", depth));
         std::string s = obj["status"].get_str();
+        if ("queued"==s) {
+            // Number of queued operations ahead of this one
+            int position = q->getQueuePosition(id);
+            if (position >= 0) {
+                obj.push_back(Pair("queue_position", position));
+            }
+        }
         if (fRemoveFinishedOperations) {
             // Caller is only interested in retrieving finished results
             if ("success"==s || "failed"==s || "cancelled"==s) {
@@ -3705,6 +3753,42 @@ UniValue z_getoperationstatus_IMPL(const UniValue& params, bool fRemoveFinishedO
 }
 
 
+UniValue z_canceloperation(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "z_canceloperation \"operationid\"\n"
+            "\nCancel an operation that has not finished.  A queued operation is cancelled at once.  An executing"
+            "\noperation stops at its next checkpoint, between proofs, so a proof already under way is completed first."
+            "\nPoll z_getoperationstatus until its status is \"cancelled\"; it may still finish if it had no checkpoint left.\n"
+            + HelpRequiringPassphrase() + "\n"
+            "\nArguments:\n"
+            "1. \"operationid\"         (string, required) The operation id to cancel.\n"
+            "\nResult:\n"
+            "{ ... }                   (json object) The status of the operation after the request, as in z_getoperationstatus\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_canceloperation", "\"operationid\"")
+            + HelpExampleRpc("z_canceloperation", "\"operationid\"")
+        );
+
+    // Only the queue is consulted, so a cancel is not held up by block
+    // connection or a rescan holding the chain or wallet locks
+    std::shared_ptr<AsyncRPCOperation> operation = getAsyncRPCQueue()->getOperationForId(params[0].get_str());
+    if (!operation) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "No operation exists for that id.");
+    }
+    if (operation->isCancelled() || operation->isFailed() || operation->isSuccess()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Operation has already finished.");
+    }
+
+    operation->cancel();
+    return operation->getStatus();
+}
+
+
 // JSDescription size depends on the transaction version
 #define V3_JS_DESCRIPTION_SIZE    (GetSerializeSize(JSDescription(), SER_NETWORK, (OVERWINTER_TX_VERSION | (1 << 31))))
 // Here we define the maximum number of zaddr outputs that can be included in a transaction.
@@ -3717,6 +3801,10 @@ UniValue z_getoperationstatus_IMPL(const UniValue& params, bool fRemoveFinishedO
 #define CTXIN_SPEND_DUST_SIZE   148
 #define CTXOUT_REGULAR_SIZE     34
 
+// Payments to more recipients than this are queued as low priority, so that
+// large batch payouts do not hold up small withdrawals.
+#define Z_SENDMANY_BULK_RECIPIENTS 10
+
 UniValue z_sendmany(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -3729,6 +3817,7 @@ UniValue z_sendmany(const UniValue& params, bool fHelp)
             "\nChange generated from a taddr flows to a new taddr address, while change generated from a zaddr returns to itself."
             "\nWhen sending coinbase UTXOs to a zaddr, change is not allowed. The entire value of the UTXO(s) must be consumed."
             + strprintf("\nBefore Sapling activates, the maximum number of zaddr outputs is %d due to transaction size limits.\n", Z_SENDMANY_MAX_ZADDR_OUTPUTS_BEFORE_SAPLING)
+            + strprintf("Payments to more than %d recipients run at low priority, behind smaller payments.\n", Z_SENDMANY_BULK_RECIPIENTS)
             + HelpRequiringPassphrase() + "\n"
             "\nArguments:\n"
             "1. \"fromaddress\"         (string, required) The taddr or zaddr to send the funds from.\n"
@@ -3984,6 +4073,9 @@ UniValue z_sendmany(const UniValue& params, bool fHelp)
     // Create operation and add to global queue
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
     std::shared_ptr<AsyncRPCOperation> operation( new AsyncRPCOperation_sendmany(builder, contextualTx, fromaddress, taddrRecipients, zaddrRecipients, nMinDepth, nFee, contextInfo) );
+    if (taddrRecipients.size() + zaddrRecipients.size() > Z_SENDMANY_BULK_RECIPIENTS) {
+        operation->setPriority(OperationPriority::LOW);
+    }
     q->addOperation(operation);
     AsyncRPCOperationId operationId = operation->getId();
     return operationId;
@@ -4195,6 +4287,7 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
     // Create operation and add to global queue
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
     std::shared_ptr<AsyncRPCOperation> operation( new AsyncRPCOperation_shieldcoinbase(builder, contextualTx, inputs, destaddress, nFee, contextInfo) );
+    operation->setPriority(OperationPriority::LOW); // consolidation, not a payment
     q->addOperation(operation);
     AsyncRPCOperationId operationId = operation->getId();
 
@@ -4605,6 +4698,7 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
     std::shared_ptr<AsyncRPCOperation> operation(
         new AsyncRPCOperation_mergetoaddress(builder, contextualTx, utxoInputs, sproutNoteInputs, saplingNoteInputs, recipient, nFee, contextInfo) );
+    operation->setPriority(OperationPriority::LOW); // consolidation, not a payment
     q->addOperation(operation);
     AsyncRPCOperationId operationId = operation->getId();
 
@@ -4745,6 +4839,7 @@ static const CRPCCommand commands[] =
     { "wallet",             "z_getoperationstatus",     &z_getoperationstatus,     true  },
     { "wallet",             "z_getoperationresult",     &z_getoperationresult,     true  },
     { "wallet",             "z_listoperationids",       &z_listoperationids,       true  },
+    { "wallet",             "z_canceloperation",        &z_canceloperation,        true  },
     { "wallet",             "z_getnewaddress",          &z_getnewaddress,          true  },
     { "wallet",             "z_listaddresses",          &z_listaddresses,          true  },
     { "wallet",             "z_exportkey",              &z_exportkey,              true  },
@@ -247,16 +247,18 @@ CPubKey CWallet::GenerateNewKey()
     if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
         nTimeFirstKey = nCreationTime;
 
-    if (!AddKeyPubKey(secret, pubkey))
+    if (!AddKeyPubKey(secret, pubkey, true))
         throw std::runtime_error("CWallet::GenerateNewKey(): AddKey failed");
     return pubkey;
 }
 
-bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
+bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey, bool fNewKey)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    if (!fNewKey)
+        InvalidateOutputIndex();
 
     // check if we need to remove from watch-only
     CScript script;
@@ -440,6 +442,7 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    InvalidateOutputIndex();
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -465,6 +468,7 @@ bool CWallet::AddWatchOnly(const CScript &dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    InvalidateOutputIndex();
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
@@ -563,6 +567,35 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
                        SaplingMerkleTree saplingTree, 
                        bool added)
 {
+    {
+        // Every transaction of the block has been through SyncTransaction
+        LOCK(cs_wallet);
+        blockScanBatch = BlockScanBatch();
+        if (!added) {
+            // Coins and notes spent in the disconnected block may be unspent again
+            for (const CTransaction& tx : pblock->vtx) {
+                for (const CTxIn& txin : tx.vin) {
+                    if (mapWallet.count(txin.prevout.hash)) {
+                        MarkOutputIndexDirty(txin.prevout.hash);
+                    }
+                }
+                for (const JSDescription& jsdesc : tx.vjoinsplit) {
+                    for (const uint256& nullifier : jsdesc.nullifiers) {
+                        auto note = mapSproutNullifiersToNotes.find(nullifier);
+                        if (note != mapSproutNullifiersToNotes.end()) {
+                            MarkOutputIndexDirty(note->second.hash);
+                        }
+                    }
+                }
+                for (const SpendDescription& spend : tx.vShieldedSpend) {
+                    auto note = mapSaplingNullifiersToNotes.find(spend.nullifier);
+                    if (note != mapSaplingNullifiersToNotes.end()) {
+                        MarkOutputIndexDirty(note->second.hash);
+                    }
+                }
+            }
+        }
+    }
     if (added) {
         IncrementNoteWitnesses(pindex, pblock, sproutTree, saplingTree);
     } else {
@@ -900,6 +933,10 @@ void CWallet::AddToTransparentSpends(const COutPoint& outpoint, const uint256& w
     pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
     SyncMetaData<COutPoint>(range);
+
+    if (mapWallet.count(outpoint.hash)) {
+        MarkOutputIndexDirty(outpoint.hash);
+    }
 }
 
 void CWallet::AddToSproutSpends(const uint256& nullifier, const uint256& wtxid)
@@ -909,6 +946,11 @@ void CWallet::AddToSproutSpends(const uint256& nullifier, const uint256& wtxid)
     pair<TxNullifiers::iterator, TxNullifiers::iterator> range;
     range = mapTxSproutNullifiers.equal_range(nullifier);
     SyncMetaData<uint256>(range);
+
+    auto note = mapSproutNullifiersToNotes.find(nullifier);
+    if (note != mapSproutNullifiersToNotes.end()) {
+        MarkOutputIndexDirty(note->second.hash);
+    }
 }
 
 void CWallet::AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid)
@@ -918,6 +960,11 @@ void CWallet::AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid)
     pair<TxNullifiers::iterator, TxNullifiers::iterator> range;
     range = mapTxSaplingNullifiers.equal_range(nullifier);
     SyncMetaData<uint256>(range);
+
+    auto note = mapSaplingNullifiersToNotes.find(nullifier);
+    if (note != mapSaplingNullifiersToNotes.end()) {
+        MarkOutputIndexDirty(note->second.hash);
+    }
 }
 
 void CWallet::AddToSpends(const uint256& wtxid)
@@ -940,6 +987,145 @@ void CWallet::AddToSpends(const uint256& wtxid)
     }
 }
 
+template <class T>
+bool CWallet::HaveWalletSpend(const T& spent, const TxSpendMap<T>& spends) const
+{
+    auto range = spends.equal_range(spent);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (mapWallet.count(it->second)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <class T>
+bool CWallet::HaveMinedSpend(const T& spent, const TxSpendMap<T>& spends) const
+{
+    auto range = spends.equal_range(spent);
+    for (auto it = range.first; it != range.second; ++it) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CWallet::MarkOutputIndexDirty(const uint256& hash)
+{
+    LOCK(cs_wallet);
+    if (fOutputIndexBuilt) {
+        setOutputIndexDirtyTxs.insert(hash);
+    }
+}
+
+void CWallet::InvalidateOutputIndex()
+{
+    LOCK(cs_wallet);
+    fOutputIndexBuilt = false;
+}
+
+/**
+ * (Re)index the coins and notes of a wallet transaction. An output that some
+ * wallet transaction spends goes in as SPEND_PENDING; UpdateOutputIndex
+ * promotes it once that spend is mined.
+ */
+void CWallet::IndexTxOutputs(const uint256& hash) const
+{
+    auto it = mapWallet.find(hash);
+    if (it == mapWallet.end()) {
+        return;
+    }
+    const CWalletTx& wtx = it->second;
+
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        COutPoint out(hash, i);
+        if (IsMine(wtx.vout[i]) == ISMINE_NO) {
+            coinIndex.Erase(out);
+            continue;
+        }
+        bool fSpent = HaveWalletSpend(out, mapTxSpends);
+        coinIndex.Set(out, wtx.IsCoinBase(), fSpent ? CoinIndex::SPEND_PENDING : CoinIndex::UNSPENT);
+    }
+
+    for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
+        bool fSpent = item.second.nullifier && HaveWalletSpend(*item.second.nullifier, mapTxSproutNullifiers);
+        sproutNoteIndex.Set(item.first, item.second.address,
+                            fSpent ? SproutNoteIndex::SPEND_PENDING : SproutNoteIndex::UNSPENT);
+    }
+
+    for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+        const SaplingOutPoint& op = item.first;
+        const SaplingNoteData& nd = item.second;
+        bool fSpent = nd.nullifier && HaveWalletSpend(*nd.nullifier, mapTxSaplingNullifiers);
+        const SaplingPaymentAddress* pIndexed = saplingNoteIndex.GetKey(op);
+        if (pIndexed) {
+            saplingNoteIndex.Set(op, *pIndexed,
+                                 fSpent ? SaplingNoteIndex::SPEND_PENDING : SaplingNoteIndex::UNSPENT);
+            continue;
+        }
+
+        // The payment address of a Sapling note is only known by decrypting it
+        auto maybe_pt = SaplingNotePlaintext::decrypt(
+            wtx.vShieldedOutput[op.n].encCiphertext,
+            nd.ivk,
+            wtx.vShieldedOutput[op.n].ephemeralKey,
+            wtx.vShieldedOutput[op.n].cm);
+        assert(static_cast<bool>(maybe_pt));
+        auto maybe_pa = nd.ivk.address(maybe_pt.get().d);
+        assert(static_cast<bool>(maybe_pa));
+        saplingNoteIndex.Set(op, maybe_pa.get(),
+                             fSpent ? SaplingNoteIndex::SPEND_PENDING : SaplingNoteIndex::UNSPENT);
+    }
+}
+
+void CWallet::UpdateOutputIndex() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (!fOutputIndexBuilt) {
+        coinIndex.Clear();
+        sproutNoteIndex.Clear();
+        saplingNoteIndex.Clear();
+        for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+            IndexTxOutputs(wtxItem.first);
+        }
+        fOutputIndexBuilt = true;
+    } else {
+        for (const uint256& hash : setOutputIndexDirtyTxs) {
+            IndexTxOutputs(hash);
+        }
+    }
+    setOutputIndexDirtyTxs.clear();
+
+    // Promote the pending spends that have been mined since the last query
+    std::vector<COutPoint> coinsPending;
+    coinIndex.GetPendingSpends(coinsPending);
+    for (const COutPoint& out : coinsPending) {
+        if (HaveMinedSpend(out, mapTxSpends)) {
+            coinIndex.Set(out, *coinIndex.GetKey(out), CoinIndex::SPENT);
+        }
+    }
+    std::vector<JSOutPoint> sproutPending;
+    sproutNoteIndex.GetPendingSpends(sproutPending);
+    for (const JSOutPoint& op : sproutPending) {
+        const SproutNoteData& nd = mapWallet.at(op.hash).mapSproutNoteData.at(op);
+        if (nd.nullifier && HaveMinedSpend(*nd.nullifier, mapTxSproutNullifiers)) {
+            sproutNoteIndex.Set(op, nd.address, SproutNoteIndex::SPENT);
+        }
+    }
+    std::vector<SaplingOutPoint> saplingPending;
+    saplingNoteIndex.GetPendingSpends(saplingPending);
+    for (const SaplingOutPoint& op : saplingPending) {
+        const SaplingNoteData& nd = mapWallet.at(op.hash).mapSaplingNoteData.at(op);
+        if (nd.nullifier && HaveMinedSpend(*nd.nullifier, mapTxSaplingNullifiers)) {
+            saplingNoteIndex.Set(op, *saplingNoteIndex.GetKey(op), SaplingNoteIndex::SPENT);
+        }
+    }
+}
+
 void CWallet::ClearNoteWitnessCache()
 {
     LOCK(cs_wallet);
@@ -947,10 +1133,12 @@ void CWallet::ClearNoteWitnessCache()
         for (mapSproutNoteData_t::value_type& item : wtxItem.second.mapSproutNoteData) {
             item.second.witnesses.clear();
             item.second.witnessHeight = -1;
+            item.second.witnessRecords.MarkDirtyFrom(std::numeric_limits<int>::min());
         }
         for (mapSaplingNoteData_t::value_type& item : wtxItem.second.mapSaplingNoteData) {
             item.second.witnesses.clear();
             item.second.witnessHeight = -1;
+            item.second.witnessRecords.MarkDirtyFrom(std::numeric_limits<int>::min());
         }
     }
     nWitnessCacheSize = 0;
@@ -983,8 +1171,8 @@ void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nW
     }
 }
 
-template<typename NoteDataMap>
-void AppendNoteCommitment(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const uint256& note_commitment)
+template<typename NoteDataMap, typename WitnessBatch>
+void AppendNoteCommitments(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, WitnessBatch& batch)
 {
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
@@ -992,7 +1180,22 @@ void AppendNoteCommitment(NoteDataMap& noteDataMap, int indexHeight, int64_t nWi
             // Check the validity of the cache
             // See comment in CopyPreviousWitnesses about validity.
             assert(nWitnessCacheSize >= nd->witnesses.size());
-            nd->witnesses.front().append(note_commitment);
+            try {
+                batch.advance(nd->witnesses.front());
+            } catch (const std::runtime_error& e) {
+                // A witness the batch cannot advance does not line up with
+                // the tree this block was appended to, so the whole cache for
+                // the note is suspect. Drop it rather than abort connecting
+                // the block; the note is witnessed again on rescan.
+                // The witness may be half advanced, so its root is not logged.
+                LogPrintf("Inconsistent witness cache state found for %s\n- Cache size: %d\n- Top (height %d)\n- New (height %d): %s\n",
+                            item.first.ToString(), nd->witnesses.size(),
+                            nd->witnessHeight,
+                            indexHeight,
+                            e.what());
+                nd->witnesses.clear();
+                nd->witnessRecords.MarkDirtyFrom(std::numeric_limits<int>::min());
+            }
         }
     }
 }
@@ -1018,6 +1221,7 @@ void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeigh
                         indexHeight,
                         witness.root().GetHex());
             nd->witnesses.clear();
+            nd->witnessRecords.MarkDirtyFrom(std::numeric_limits<int>::min());
         }
         nd->witnesses.push_front(witness);
         // Set height to one less than pindex so it gets incremented
@@ -1064,6 +1268,14 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
         pblock = &block;
     }
 
+    // Witnesses are brought up to date once the whole block has been seen,
+    // from subtrees of its commitments that all of them share, rather than
+    // by appending every commitment to every witness.
+    uint64_t sproutStartSize = sproutTree.size();
+    uint64_t saplingStartSize = saplingTree.size();
+    std::vector<libzcash::SHA256Compress> sproutCommitments;
+    std::vector<libzcash::PedersenHash> saplingCommitments;
+
     for (const CTransaction& tx : pblock->vtx) {
         auto hash = tx.GetHash();
         bool txIsOurs = mapWallet.count(hash);
@@ -1073,11 +1285,7 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
             for (uint8_t j = 0; j < jsdesc.commitments.size(); j++) {
                 const uint256& note_commitment = jsdesc.commitments[j];
                 sproutTree.append(note_commitment);
-
-                // Increment existing witnesses
-                for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                    ::AppendNoteCommitment(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, note_commitment);
-                }
+                sproutCommitments.push_back(note_commitment);
 
                 // If this is our note, witness it
                 if (txIsOurs) {
@@ -1090,11 +1298,7 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
         for (uint32_t i = 0; i < tx.vShieldedOutput.size(); i++) {
             const uint256& note_commitment = tx.vShieldedOutput[i].cm;
             saplingTree.append(note_commitment);
-
-            // Increment existing witnesses
-            for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                ::AppendNoteCommitment(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, note_commitment);
-            }
+            saplingCommitments.push_back(note_commitment);
 
             // If this is our note, witness it
             if (txIsOurs) {
@@ -1104,6 +1308,14 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
         }
     }
 
+    // Increment existing witnesses, including those of notes witnessed above
+    SproutWitnessBatch sproutBatch(sproutStartSize, sproutCommitments);
+    SaplingWitnessBatch saplingBatch(saplingStartSize, saplingCommitments);
+    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        ::AppendNoteCommitments(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, sproutBatch);
+        ::AppendNoteCommitments(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, saplingBatch);
+    }
+
     // Update witness heights
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
         ::UpdateWitnessHeights(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
@@ -1132,6 +1344,8 @@ void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t n
             assert((nd->witnessHeight == -1) || (nd->witnessHeight == indexHeight));
             if (nd->witnesses.size() > 0) {
                 nd->witnesses.pop_front();
+                // A different block may be connected at this height next
+                nd->witnessRecords.MarkDirtyFrom(indexHeight);
             }
             // indexHeight is the height of the block being removed, so 
             // the new witness cache height is one below it.
@@ -1374,6 +1588,7 @@ void CWallet::UpdateNullifierNoteMapWithTx(const CWalletTx& wtx)
                 mapSaplingNullifiersToNotes[*item.second.nullifier] = item.first;
             }
         }
+        MarkOutputIndexDirty(wtx.GetHash());
     }
 }
 
@@ -1425,6 +1640,7 @@ void CWallet::UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx) {
             item.second.nullifier = nullifier;
         }
     }
+    MarkOutputIndexDirty(wtx.GetHash());
 }
 
 /**
@@ -1449,10 +1665,12 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
 
     if (fFromLoadWallet)
     {
-        mapWallet[hash] = wtxIn;
-        mapWallet[hash].BindWallet(this);
-        UpdateNullifierNoteMapWithTx(mapWallet[hash]);
+        CWalletTx& wtx = mapWallet[hash];
+        wtx = wtxIn;
+        wtx.BindWallet(this);
+        UpdateNullifierNoteMapWithTx(wtx);
         AddToSpends(hash);
+        MarkOutputIndexDirty(hash);
     }
     else
     {
@@ -1551,6 +1769,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        MarkOutputIndexDirty(hash);
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -1580,6 +1799,7 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
                         nd.second.witnesses.cbegin(), nd.second.witnesses.cend());
             }
             tmp.at(nd.first).witnessHeight = nd.second.witnessHeight;
+            tmp.at(nd.first).witnessRecords = nd.second.witnessRecords;
         }
         // Now copy over the updated note data
         wtx.mapSproutNoteData = tmp;
@@ -1596,6 +1816,7 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
                         nd.second.witnesses.cbegin(), nd.second.witnesses.cend());
             }
             tmp.at(nd.first).witnessHeight = nd.second.witnessHeight;
+            tmp.at(nd.first).witnessRecords = nd.second.witnessRecords;
         }
 
         // Now copy over the updated note data
@@ -1658,9 +1879,35 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
     return false;
 }
 
+namespace {
+// RAII: clear the wallet's transient scan-batch pointers on EVERY exit from a
+// window's apply phase (normal return OR exception unwinding), so they can never
+// be left dangling past the stack-local batch maps they point at. Declared
+// AFTER the maps so it destructs first (reverse declaration order).
+struct ScanBatchPtrGuard {
+    const std::map<SaplingOutPoint, SaplingOutputMatch>** saplingSlot;
+    const std::map<JSOutPoint, SproutOutputMatch>** sproutSlot;
+    ~ScanBatchPtrGuard() { *saplingSlot = nullptr; *sproutSlot = nullptr; }
+};
+} // namespace
+
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
 {
+    // The transactions of a connected block arrive here one at a time. The
+    // first one trial-decrypts the outputs of the whole block in parallel,
+    // before cs_wallet is taken; the others read their matches from that.
+    uint256 hashBlock;
+    if (pblock) {
+        hashBlock = pblock->GetHash();
+        PrepareBlockScanBatch(*pblock, hashBlock);
+    }
+
     LOCK(cs_wallet);
+    ScanBatchPtrGuard batchGuard{&pScanSaplingBatch, &pScanSproutBatch};
+    if (pblock && HaveBlockScanBatch(hashBlock)) {
+        pScanSaplingBatch = &blockScanBatch.sapling;
+        pScanSproutBatch = &blockScanBatch.sprout;
+    }
     if (!AddToWalletIfInvolvingMe(tx, pblock, true))
         return; // Not one of ours
 
@@ -1701,8 +1948,27 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
-            CWalletDB(strWalletFile).EraseTx(hash);
+        auto it = mapWallet.find(hash);
+        if (it != mapWallet.end()) {
+            for (unsigned int i = 0; i < it->second.vout.size(); i++) {
+                coinIndex.Erase(COutPoint(hash, i));
+            }
+            // Outputs the transaction spent are no longer spent by the wallet
+            for (const CTxIn& txin : it->second.vin) {
+                MarkOutputIndexDirty(txin.prevout.hash);
+            }
+            CWalletDB walletdb(strWalletFile);
+            for (const mapSproutNoteData_t::value_type& item : it->second.mapSproutNoteData) {
+                sproutNoteIndex.Erase(item.first);
+                walletdb.EraseNoteWitnesses(item.first);
+            }
+            for (const mapSaplingNoteData_t::value_type& item : it->second.mapSaplingNoteData) {
+                saplingNoteIndex.Erase(item.first);
+                walletdb.EraseNoteWitnesses(item.first);
+            }
+            mapWallet.erase(it);
+            walletdb.EraseTx(hash);
+        }
     }
     return;
 }
@@ -1765,6 +2031,27 @@ mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
 
     mapSproutNoteData_t noteData;
     for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
+        // The trial decryption was already done in parallel (windowed rescan
+        // or connected block); only the nullifier is left to compute.
+        if (pScanSproutBatch != nullptr) {
+            for (uint8_t j = 0; j < tx.vjoinsplit[i].ciphertexts.size(); j++) {
+                JSOutPoint jsoutpt {hash, i, j};
+                auto bit = pScanSproutBatch->find(jsoutpt);
+                if (bit == pScanSproutBatch->end()) {
+                    continue;
+                }
+                const SproutOutputMatch& match = bit->second;
+                SproutNoteData nd {match.address};
+                libzcash::SproutSpendingKey key;
+                if (GetSproutSpendingKey(match.address, key)) {
+                    nd.nullifier = match.note.nullifier(key);
+                }
+                nd.value = CAmount(match.note.value());
+                noteData.insert(std::make_pair(jsoutpt, nd));
+            }
+            continue;
+        }
+
         auto hSig = tx.vjoinsplit[i].h_sig(*pzcashParams, tx.joinSplitPubKey);
         for (uint8_t j = 0; j < tx.vjoinsplit[i].ciphertexts.size(); j++) {
             for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors) {
@@ -2466,7 +2753,7 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
         uint256 current_anchor = tree.root();
 
         // Consistency check: we should be able to find the current tree
-        // in our CCoins view.
+        // in our coins view.
         SproutMerkleTree dummy_tree;
         assert(pcoinsTip->GetSproutAnchorAt(current_anchor, dummy_tree));
 
@@ -2495,10 +2782,101 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
 static const size_t WALLET_SCAN_WINDOW_BLOCKS = 4096;
 static const size_t WALLET_SCAN_WINDOW_BYTES  = 32 * 1024 * 1024; // 32 MiB
 
+namespace {
+// Run decryptCell(k) for every k in [0, nCells). Parallelized only when it
+// pays off: the dominant per-cell cost is the ka_agree EC op (tens of
+// microseconds), so even a few dozen cells amortize the one-time thread spawn.
+// Below that (or with <2 workers) the cells are decrypted on this thread.
+template<typename DecryptCell>
+void RunTrialDecryption(size_t nCells, int nWorkers, const DecryptCell& decryptCell)
+{
+    if (nWorkers < 2 || nCells < (size_t)(nWorkers * 4)) {
+        for (size_t k = 0; k < nCells; ++k) {
+            decryptCell(k);
+        }
+        return;
+    }
+
+    // W workers pull cell indices from a shared atomic counter; each writes
+    // its OWN results slot (no shared mutable state -> no mutex). Workers
+    // take NO locks (the key snapshot is a local copy), so they cannot
+    // deadlock against the caller's held LOCK2(cs_main, cs_wallet).
+    std::atomic<size_t> next(0);
+    const int W = std::min<int>(nWorkers, (int)nCells);
+
+    // First exception raised by any worker, captured for re-throw after the
+    // group is joined. The trial decryptions return boost::none on a normal
+    // non-match and NEVER throw for one, so a throw here is always a genuine
+    // failure (e.g. std::bad_alloc). The serial path (FindMySaplingNotes
+    // calls TrialDecryptSaplingOutput with no catch) lets such a failure abort
+    // the scan; we reproduce that fail-loud behaviour instead of swallowing it
+    // into a non-match, which would silently drop a real note -> a too-low local
+    // shielded balance. Capturing rather than letting a *spawned* thread's
+    // exception escape its functor (which would std::terminate) lets all workers
+    // surface a clean throw identically to the serial path.
+    std::mutex errMutex;
+    std::exception_ptr firstError;
+
+    auto worker = [&]() {
+        for (;;) {
+            size_t idx = next.fetch_add(1);
+            if (idx >= nCells) break;
+            try {
+                decryptCell(idx);
+            } catch (const boost::thread_interrupted&) {
+                throw; // propagate shutdown promptly (handled by the caller)
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errMutex);
+                if (!firstError) {
+                    firstError = std::current_exception();
+                }
+                return; // stop pulling more cells; the run is aborting
+            }
+        }
+    };
+
+    boost::thread_group group;
+    for (int w = 0; w < W - 1; ++w) {
+        group.create_thread(worker);
+    }
+    // Always join spawned workers, even if this thread's share throws
+    // (a ~thread_group with unjoined threads would std::terminate). The only
+    // escapee here is a re-thrown boost::thread_interrupted, which cannot occur
+    // on the non-interruptible rescan thread, but this keeps the invariant if
+    // rescans ever move onto an interruptible thread.
+    try {
+        worker(); // this thread takes a share too
+    } catch (...) {
+        group.join_all();
+        throw;
+    }
+    group.join_all();
+
+    // Re-raise the first genuine failure (if any) after every worker has
+    // joined, so the scan aborts loudly exactly like the serial path.
+    if (firstError) {
+        std::rethrow_exception(firstError);
+    }
+}
+} // namespace
+
 void CWallet::BuildSaplingScanBatch(
     const std::vector<std::pair<CBlockIndex*, CBlock>>& window,
     int nWorkers,
     std::map<SaplingOutPoint, SaplingOutputMatch>& out) const
+{
+    std::vector<const CBlock*> blocks;
+    blocks.reserve(window.size());
+    for (const auto& wb : window) {
+        blocks.push_back(&wb.second);
+    }
+    BuildSaplingScanBatch(blocks, nWorkers, out);
+}
+
+void CWallet::BuildSaplingScanBatch(
+    const std::vector<const CBlock*>& blocks,
+    int nWorkers,
+    std::map<SaplingOutPoint, SaplingOutputMatch>& out) const
 {
     // Freeze the ivk set once for the whole window, in deterministic map-key
     // order. mapSaplingFullViewingKeys does not change during a rescan (no
@@ -2521,8 +2899,8 @@ void CWallet::BuildSaplingScanBatch(
     // pointers reference the caller-owned blocks, which outlive this call.
     struct Cell { SaplingOutPoint op; const OutputDescription* output; };
     std::vector<Cell> cells;
-    for (const auto& wb : window) {
-        for (const CTransaction& tx : wb.second.vtx) {
+    for (const CBlock* block : blocks) {
+        for (const CTransaction& tx : block->vtx) {
             if (tx.vShieldedOutput.empty()) {
                 continue;
             }
@@ -2537,78 +2915,108 @@ void CWallet::BuildSaplingScanBatch(
     }
 
     std::vector<boost::optional<SaplingOutputMatch>> results(cells.size());
+    RunTrialDecryption(cells.size(), nWorkers, [&](size_t k) {
+        results[k] = TrialDecryptSaplingOutput(*cells[k].output, ivks);
+    });
 
-    // Parallelize only when it pays off: the dominant per-cell cost is the
-    // ka_agree EC op (tens of microseconds), so even a few dozen cells amortize
-    // the one-time per-window thread spawn.
-    if (nWorkers >= 2 && cells.size() >= (size_t)(nWorkers * 4)) {
-        // W workers pull cell indices from a shared atomic counter; each writes
-        // its OWN results slot (no shared mutable state -> no mutex). Workers
-        // take NO locks (the ivk snapshot is a local copy), so they cannot
-        // deadlock against the caller's held LOCK2(cs_main, cs_wallet).
-        std::atomic<size_t> next(0);
-        const int W = std::min<int>(nWorkers, (int)cells.size());
-
-        // First exception raised by any worker, captured for re-throw after the
-        // group is joined. TrialDecryptSaplingOutput returns boost::none on a
-        // normal non-match and NEVER throws for one (SaplingNotePlaintext::decrypt
-        // returns an empty optional on every miss), so a throw here is always a
-        // genuine failure (e.g. std::bad_alloc). The serial path (FindMySaplingNotes
-        // calls TrialDecryptSaplingOutput with no catch) lets such a failure abort
-        // the rescan; we reproduce that fail-loud behaviour instead of swallowing it
-        // into a non-match, which would silently drop a real note -> a too-low local
-        // shielded balance. Capturing rather than letting a *spawned* thread's
-        // exception escape its functor (which would std::terminate) lets all workers
-        // surface a clean throw identically to the serial path.
-        std::mutex errMutex;
-        std::exception_ptr firstError;
-
-        auto worker = [&]() {
-            for (;;) {
-                size_t idx = next.fetch_add(1);
-                if (idx >= cells.size()) break;
-                try {
-                    results[idx] = TrialDecryptSaplingOutput(*cells[idx].output, ivks);
-                } catch (const boost::thread_interrupted&) {
-                    throw; // propagate shutdown promptly (handled by the caller)
-                } catch (...) {
-                    std::lock_guard<std::mutex> lock(errMutex);
-                    if (!firstError) {
-                        firstError = std::current_exception();
-                    }
-                    return; // stop pulling more cells; the run is aborting
-                }
-            }
-        };
-
-        boost::thread_group group;
-        for (int w = 0; w < W - 1; ++w) {
-            group.create_thread(worker);
+    for (size_t k = 0; k < cells.size(); ++k) {
+        if (results[k]) {
+            out.emplace(cells[k].op, results[k].get());
         }
-        // Always join spawned workers, even if this thread's share throws
-        // (a ~thread_group with unjoined threads would std::terminate). The only
-        // escapee here is a re-thrown boost::thread_interrupted, which cannot occur
-        // on the non-interruptible rescan thread, but this keeps the invariant if
-        // rescans ever move onto an interruptible thread.
+    }
+}
+
+boost::optional<SproutOutputMatch> CWallet::TrialDecryptSproutOutput(
+    const JSDescription& jsdesc,
+    const uint256& hSig,
+    uint8_t n,
+    const std::vector<std::pair<SproutPaymentAddress, ZCNoteDecryption>>& decryptors) const
+{
+    for (const auto& item : decryptors) {
         try {
-            worker(); // this thread takes a share too
-        } catch (...) {
-            group.join_all();
-            throw;
+            auto note_pt = libzcash::SproutNotePlaintext::decrypt(
+                item.second,
+                jsdesc.ciphertexts[n],
+                jsdesc.ephemeralKey,
+                hSig,
+                (unsigned char) n);
+            auto note = note_pt.note(item.first);
+            // Check note plaintext against note commitment, as
+            // GetSproutNoteNullifier does
+            if (note.cm() != jsdesc.commitments[n]) {
+                continue;
+            }
+            return SproutOutputMatch{item.first, note};
+        } catch (const note_decryption_failed &err) {
+            // Couldn't decrypt with this decryptor
+        } catch (const std::exception &exc) {
+            // Unexpected failure
+            LogPrintf("TrialDecryptSproutOutput(): Unexpected error while testing decrypt:\n");
+            LogPrintf("%s\n", exc.what());
         }
-        group.join_all();
+    }
+    return boost::none;
+}
 
-        // Re-raise the first genuine failure (if any) after every worker has
-        // joined, so the rescan aborts loudly exactly like the serial path.
-        if (firstError) {
-            std::rethrow_exception(firstError);
-        }
-    } else {
-        // Single-threaded fill (tiny window or concurrency disabled).
-        for (size_t k = 0; k < cells.size(); ++k) {
-            results[k] = TrialDecryptSaplingOutput(*cells[k].output, ivks);
+void CWallet::BuildSproutScanBatch(
+    const std::vector<std::pair<CBlockIndex*, CBlock>>& window,
+    int nWorkers,
+    std::map<JSOutPoint, SproutOutputMatch>& out) const
+{
+    std::vector<const CBlock*> blocks;
+    blocks.reserve(window.size());
+    for (const auto& wb : window) {
+        blocks.push_back(&wb.second);
+    }
+    BuildSproutScanBatch(blocks, nWorkers, out);
+}
+
+void CWallet::BuildSproutScanBatch(
+    const std::vector<const CBlock*>& blocks,
+    int nWorkers,
+    std::map<JSOutPoint, SproutOutputMatch>& out) const
+{
+    // Same snapshot reasoning as BuildSaplingScanBatch, in mapNoteDecryptors
+    // order.
+    std::vector<std::pair<SproutPaymentAddress, ZCNoteDecryption>> decryptors;
+    {
+        LOCK(cs_SpendingKeyStore);
+        decryptors.assign(mapNoteDecryptors.begin(), mapNoteDecryptors.end());
+    }
+    if (decryptors.empty()) {
+        return;
+    }
+
+    // Flatten every JoinSplit ciphertext in the window into a cell list, so
+    // the work spreads evenly however the outputs are grouped into
+    // transactions. hSig is shared by the outputs of a JoinSplit and cheap
+    // next to the decryption, so it is computed here, once per JoinSplit.
+    struct Cell { JSOutPoint op; const JSDescription* jsdesc; size_t hSigIndex; };
+    std::vector<Cell> cells;
+    std::vector<uint256> hSigs;
+    for (const CBlock* block : blocks) {
+        for (const CTransaction& tx : block->vtx) {
+            if (tx.vjoinsplit.empty()) {
+                continue;
+            }
+            const uint256 hash = tx.GetHash();
+            for (size_t i = 0; i < tx.vjoinsplit.size(); ++i) {
+                const JSDescription& jsdesc = tx.vjoinsplit[i];
+                hSigs.push_back(jsdesc.h_sig(*pzcashParams, tx.joinSplitPubKey));
+                for (uint8_t j = 0; j < jsdesc.ciphertexts.size(); ++j) {
+                    cells.push_back(Cell{ JSOutPoint{hash, i, j}, &jsdesc, hSigs.size() - 1 });
+                }
+            }
         }
     }
+    if (cells.empty()) {
+        return;
+    }
+
+    std::vector<boost::optional<SproutOutputMatch>> results(cells.size());
+    RunTrialDecryption(cells.size(), nWorkers, [&](size_t k) {
+        results[k] = TrialDecryptSproutOutput(*cells[k].jsdesc, hSigs[cells[k].hSigIndex], cells[k].op.n, decryptors);
+    });
 
     for (size_t k = 0; k < cells.size(); ++k) {
         if (results[k]) {
@@ -2617,16 +3025,46 @@ void CWallet::BuildSaplingScanBatch(
     }
 }
 
-namespace {
-// RAII: clear the wallet's transient scan-batch pointer on EVERY exit from a
-// window's apply phase (normal return OR exception unwinding), so it can never
-// be left dangling past the stack-local batchMatches it points at. Declared
-// AFTER batchMatches so it destructs first (reverse declaration order).
-struct ScanBatchPtrGuard {
-    const std::map<SaplingOutPoint, SaplingOutputMatch>** slot;
-    ~ScanBatchPtrGuard() { *slot = nullptr; }
-};
-} // namespace
+void CWallet::PrepareBlockScanBatch(const CBlock& block, const uint256& hashBlock)
+{
+    int nWorkers = GetBoolArg("-nowalletparallel", false) ? 0 : nScriptCheckThreads;
+    if (nWorkers < 2) {
+        return; // FindMy*Notes decrypt serially, as before
+    }
+    {
+        LOCK(cs_wallet);
+        if (HaveBlockScanBatch(hashBlock)) {
+            return;
+        }
+    }
+
+    BlockScanBatch batch;
+    batch.hashBlock = hashBlock;
+    {
+        // Counted before the keys are snapshotted, so a key added meanwhile
+        // makes the batch unusable rather than silently incomplete.
+        LOCK(cs_SpendingKeyStore);
+        batch.nSaplingKeys = mapSaplingFullViewingKeys.size();
+        batch.nSproutKeys = mapNoteDecryptors.size();
+    }
+    std::vector<const CBlock*> blocks(1, &block);
+    BuildSaplingScanBatch(blocks, nWorkers, batch.sapling);
+    BuildSproutScanBatch(blocks, nWorkers, batch.sprout);
+
+    LOCK(cs_wallet);
+    std::swap(blockScanBatch, batch);
+}
+
+bool CWallet::HaveBlockScanBatch(const uint256& hashBlock) const
+{
+    AssertLockHeld(cs_wallet);
+    if (blockScanBatch.hashBlock.IsNull() || blockScanBatch.hashBlock != hashBlock) {
+        return false;
+    }
+    LOCK(cs_SpendingKeyStore);
+    return blockScanBatch.nSaplingKeys == mapSaplingFullViewingKeys.size() &&
+           blockScanBatch.nSproutKeys == mapNoteDecryptors.size();
+}
 
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
@@ -2693,7 +3131,7 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 
         if (nWorkers >= 2) {
             // Windowed parallel path: read a bounded window of blocks, trial-
-            // decrypt all their Sapling outputs in parallel off the apply
+            // decrypt all their shielded outputs in parallel off the apply
             // thread, then apply each block serially in chain order. The apply
             // phase reads the precomputed matches via pScanSaplingBatch, so the
             // expensive ka_agree EC ops never run on the apply thread.
@@ -2712,11 +3150,14 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 
                 std::map<SaplingOutPoint, SaplingOutputMatch> batchMatches;
                 BuildSaplingScanBatch(window, nWorkers, batchMatches);
+                std::map<JSOutPoint, SproutOutputMatch> sproutBatchMatches;
+                BuildSproutScanBatch(window, nWorkers, sproutBatchMatches);
 
                 pScanSaplingBatch = &batchMatches;
+                pScanSproutBatch = &sproutBatchMatches;
                 // Reset on EVERY exit (incl. an exception out of applyBlock),
-                // before batchMatches is destroyed, so the pointer can't dangle.
-                ScanBatchPtrGuard batchGuard{&pScanSaplingBatch};
+                // before the maps are destroyed, so the pointers can't dangle.
+                ScanBatchPtrGuard batchGuard{&pScanSaplingBatch, &pScanSproutBatch};
                 for (auto& wb : window) {
                     applyBlock(wb.first, wb.second);
                     reportProgress(wb.first);
@@ -3154,34 +3595,37 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (!CheckFinalTx(*pcoin))
-                continue;
-
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
-
-            if (pcoin->IsCoinBase() && !fIncludeCoinBase)
-                continue;
 
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
-
-            int nDepth = pcoin->GetDepthInMainChain();
-            if (nDepth < 0)
+        // Only visit our outputs that no mined wallet transaction spends
+        UpdateOutputIndex();
+        std::set<COutPoint> coins;
+        bool fCoinBase = false;
+        coinIndex.GetOutputs(fIncludeCoinBase ? nullptr : &fCoinBase, false, coins);
+
+        // Outpoints are ordered by txid, so each transaction is checked once
+        const CWalletTx* pcoin = nullptr;
+        bool fTxAvailable = false;
+        int nDepth = 0;
+        for (const COutPoint& out : coins) {
+            const uint256& wtxid = out.hash;
+            unsigned int i = out.n;
+
+            if (!pcoin || pcoin->GetHash() != wtxid) {
+                pcoin = &mapWallet.at(wtxid);
+                nDepth = pcoin->GetDepthInMainChain();
+                fTxAvailable = CheckFinalTx(*pcoin) &&
+                               (!fOnlyConfirmed || pcoin->IsTrusted()) &&
+                               !(pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0) &&
+                               nDepth >= 0;
+            }
+            if (!fTxAvailable)
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                isminetype mine = IsMine(pcoin->vout[i]);
-                if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected((*it).first, i)))
-                        vCoins.push_back(COutput(pcoin, i, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
-            }
+            isminetype mine = IsMine(pcoin->vout[i]);
+            if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
+                !IsLockedCoin(wtxid, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
+                (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(wtxid, i)))
+                    vCoins.push_back(COutput(pcoin, i, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
         }
     }
 }
@@ -3337,8 +3781,12 @@ bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*
 {
     // Output parameter fOnlyCoinbaseCoinsRet is set to true when the only available coins are coinbase utxos.
     vector<COutput> vCoinsNoCoinbase, vCoinsWithCoinbase;
-    AvailableCoins(vCoinsNoCoinbase, true, coinControl, false, false);
     AvailableCoins(vCoinsWithCoinbase, true, coinControl, false, true);
+    for (const COutput& out : vCoinsWithCoinbase) {
+        if (!out.tx->IsCoinBase()) {
+            vCoinsNoCoinbase.push_back(out);
+        }
+    }
     fOnlyCoinbaseCoinsRet = vCoinsNoCoinbase.size() == 0 && vCoinsWithCoinbase.size() > 0;
 
     // If coinbase utxos can only be sent to zaddrs, exclude any coinbase utxos from coin selection.
@@ -3871,12 +4319,12 @@ CAmount CWallet::GetMinimumFee(unsigned int nTxBytes, unsigned int nConfirmTarge
 
 
 
-DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
+DBErrors CWallet::LoadWallet(bool& fFirstRunRet, int nWorkers)
 {
     if (!fFileBacked)
         return DB_LOAD_OK;
     fFirstRunRet = false;
-    DBErrors nLoadWalletRet = CWalletDB(strWalletFile,"cr+").LoadWallet(this);
+    DBErrors nLoadWalletRet = CWalletDB(strWalletFile,"cr+").LoadWallet(this, nWorkers);
     if (nLoadWalletRet == DB_NEED_REWRITE)
     {
         if (CDB::Rewrite(strWalletFile, "\x04pool"))
@@ -4738,107 +5186,116 @@ void CWallet::GetFilteredNotes(
 {
     LOCK2(cs_main, cs_wallet);
 
-    for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
-
-        // Filter the transactions before checking for notes
-        if (!CheckFinalTx(wtx) ||
-            wtx.GetBlocksToMaturity() > 0 ||
-            wtx.GetDepthInMainChain() < minDepth ||
-            wtx.GetDepthInMainChain() > maxDepth) {
-            continue;
+    // Look the candidate notes up in the note index. The sets keep them in
+    // outpoint order, which is the order a scan of mapWallet visits them in.
+    UpdateOutputIndex();
+    std::set<JSOutPoint> sproutNotes;
+    std::set<SaplingOutPoint> saplingNotes;
+    if (filterAddresses.empty()) {
+        sproutNoteIndex.GetOutputs(nullptr, !ignoreSpent, sproutNotes);
+        saplingNoteIndex.GetOutputs(nullptr, !ignoreSpent, saplingNotes);
+    }
+    for (const PaymentAddress& address : filterAddresses) {
+        if (auto sproutAddr = boost::get<SproutPaymentAddress>(&address)) {
+            sproutNoteIndex.GetOutputs(sproutAddr, !ignoreSpent, sproutNotes);
+        } else if (auto saplingAddr = boost::get<SaplingPaymentAddress>(&address)) {
+            saplingNoteIndex.GetOutputs(saplingAddr, !ignoreSpent, saplingNotes);
         }
+    }
 
-        for (auto & pair : wtx.mapSproutNoteData) {
-            JSOutPoint jsop = pair.first;
-            SproutNoteData nd = pair.second;
-            SproutPaymentAddress pa = nd.address;
+    // Filter the transactions before checking for notes
+    auto txFilter = [&](const CWalletTx& wtx) -> bool {
+        if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0) {
+            return false;
+        }
+        int nDepth = wtx.GetDepthInMainChain();
+        return nDepth >= minDepth && nDepth <= maxDepth;
+    };
 
-            // skip notes which belong to a different payment address in the wallet
-            if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-                continue;
-            }
+    for (const JSOutPoint& jsop : sproutNotes) {
+        const CWalletTx& wtx = mapWallet.at(jsop.hash);
+        if (!txFilter(wtx)) {
+            continue;
+        }
+        const SproutNoteData& nd = wtx.mapSproutNoteData.at(jsop);
+        const SproutPaymentAddress& pa = nd.address;
 
-            // skip note which has been spent
-            if (ignoreSpent && nd.nullifier && IsSproutSpent(*nd.nullifier)) {
-                continue;
-            }
+        // skip note which has been spent
+        if (ignoreSpent && nd.nullifier && IsSproutSpent(*nd.nullifier)) {
+            continue;
+        }
 
-            // skip notes which cannot be spent
-            if (requireSpendingKey && !HaveSproutSpendingKey(pa)) {
-                continue;
-            }
+        // skip notes which cannot be spent
+        if (requireSpendingKey && !HaveSproutSpendingKey(pa)) {
+            continue;
+        }
 
-            // skip locked notes
-            if (ignoreLocked && IsLockedNote(jsop)) {
-                continue;
-            }
+        // skip locked notes
+        if (ignoreLocked && IsLockedNote(jsop)) {
+            continue;
+        }
 
-            int i = jsop.js; // Index into CTransaction.vjoinsplit
-            int j = jsop.n; // Index into JSDescription.ciphertexts
+        int i = jsop.js; // Index into CTransaction.vjoinsplit
+        int j = jsop.n; // Index into JSDescription.ciphertexts
 
-            // Get cached decryptor
-            ZCNoteDecryption decryptor;
-            if (!GetNoteDecryptor(pa, decryptor)) {
-                // Note decryptors are created when the wallet is loaded, so it should always exist
-                throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", EncodePaymentAddress(pa)));
-            }
+        // Get cached decryptor
+        ZCNoteDecryption decryptor;
+        if (!GetNoteDecryptor(pa, decryptor)) {
+            // Note decryptors are created when the wallet is loaded, so it should always exist
+            throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", EncodePaymentAddress(pa)));
+        }
 
-            // determine amount of funds in the note
-            auto hSig = wtx.vjoinsplit[i].h_sig(*pzcashParams, wtx.joinSplitPubKey);
-            try {
-                SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
-                        decryptor,
-                        wtx.vjoinsplit[i].ciphertexts[j],
-                        wtx.vjoinsplit[i].ephemeralKey,
-                        hSig,
-                        (unsigned char) j);
+        // determine amount of funds in the note
+        auto hSig = wtx.vjoinsplit[i].h_sig(*pzcashParams, wtx.joinSplitPubKey);
+        try {
+            SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
+                    decryptor,
+                    wtx.vjoinsplit[i].ciphertexts[j],
+                    wtx.vjoinsplit[i].ephemeralKey,
+                    hSig,
+                    (unsigned char) j);
 
-                sproutEntries.push_back(CSproutNotePlaintextEntry{jsop, pa, plaintext, wtx.GetDepthInMainChain()});
+            sproutEntries.push_back(CSproutNotePlaintextEntry{jsop, pa, plaintext, wtx.GetDepthInMainChain()});
 
-            } catch (const note_decryption_failed &err) {
-                // Couldn't decrypt with this spending key
-                throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", EncodePaymentAddress(pa)));
-            } catch (const std::exception &exc) {
-                // Unexpected failure
-                throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", EncodePaymentAddress(pa), exc.what()));
-            }
+        } catch (const note_decryption_failed &err) {
+            // Couldn't decrypt with this spending key
+            throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", EncodePaymentAddress(pa)));
+        } catch (const std::exception &exc) {
+            // Unexpected failure
+            throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", EncodePaymentAddress(pa), exc.what()));
         }
+    }
 
-        for (auto & pair : wtx.mapSaplingNoteData) {
-            SaplingOutPoint op = pair.first;
-            SaplingNoteData nd = pair.second;
-
-            auto maybe_pt = SaplingNotePlaintext::decrypt(
-                wtx.vShieldedOutput[op.n].encCiphertext,
-                nd.ivk,
-                wtx.vShieldedOutput[op.n].ephemeralKey,
-                wtx.vShieldedOutput[op.n].cm);
-            assert(static_cast<bool>(maybe_pt));
-            auto notePt = maybe_pt.get();
+    for (const SaplingOutPoint& op : saplingNotes) {
+        const CWalletTx& wtx = mapWallet.at(op.hash);
+        if (!txFilter(wtx)) {
+            continue;
+        }
+        const SaplingNoteData& nd = wtx.mapSaplingNoteData.at(op);
 
-            auto maybe_pa = nd.ivk.address(notePt.d);
-            assert(static_cast<bool>(maybe_pa));
-            auto pa = maybe_pa.get();
+        // Apply the shared spent / spending-key / locked filter. The cached
+        // balance accessor (GetSaplingBalanceCached) uses this SAME helper so
+        // the two paths can never diverge. The address filter was already
+        // applied by the note index.
+        if (!SaplingNotePassesSpendFilter(op, nd, ignoreSpent, requireSpendingKey, ignoreLocked)) {
+            continue;
+        }
 
-            // skip notes which belong to a different payment address in the wallet
-            // (this is the only filter that requires the decrypted address, so it
-            // stays here rather than in the shared SaplingNotePassesSpendFilter)
-            if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-                continue;
-            }
+        auto maybe_pt = SaplingNotePlaintext::decrypt(
+            wtx.vShieldedOutput[op.n].encCiphertext,
+            nd.ivk,
+            wtx.vShieldedOutput[op.n].ephemeralKey,
+            wtx.vShieldedOutput[op.n].cm);
+        assert(static_cast<bool>(maybe_pt));
+        auto notePt = maybe_pt.get();
 
-            // Apply the shared spent / spending-key / locked filter. The cached
-            // balance accessor (GetSaplingBalanceCached) uses this SAME helper so
-            // the two paths can never diverge.
-            if (!SaplingNotePassesSpendFilter(op, nd, ignoreSpent, requireSpendingKey, ignoreLocked)) {
-                continue;
-            }
+        auto maybe_pa = nd.ivk.address(notePt.d);
+        assert(static_cast<bool>(maybe_pa));
+        auto pa = maybe_pa.get();
 
-            auto note = notePt.note(nd.ivk).get();
-            saplingEntries.push_back(SaplingNoteEntry {
-                op, pa, note, notePt.memo(), wtx.GetDepthInMainChain() });
-        }
+        auto note = notePt.note(nd.ivk).get();
+        saplingEntries.push_back(SaplingNoteEntry {
+            op, pa, note, notePt.memo(), wtx.GetDepthInMainChain() });
     }
 }
 
@@ -4854,10 +5311,14 @@ CAmount CWallet::GetSaplingBalanceCached(int minDepth, bool requireSpendingKey,
 {
     LOCK2(cs_main, cs_wallet);
 
+    UpdateOutputIndex();
+    std::set<SaplingOutPoint> notes;
+    saplingNoteIndex.GetOutputs(nullptr, false, notes);
+
     CAmount balance = 0;
 
-    for (auto & p : mapWallet) {
-        CWalletTx& wtx = p.second;
+    for (const SaplingOutPoint& op : notes) {
+        CWalletTx& wtx = mapWallet.at(op.hash);
 
         // Per-transaction filter — IDENTICAL to GetFilteredNotes (minDepth only;
         // maxDepth is effectively INT_MAX for a balance read).
@@ -4867,35 +5328,32 @@ CAmount CWallet::GetSaplingBalanceCached(int minDepth, bool requireSpendingKey,
             continue;
         }
 
-        for (auto & pair : wtx.mapSaplingNoteData) {
-            const SaplingOutPoint& op = pair.first;
-            SaplingNoteData& nd = pair.second;  // by reference: may populate the cache
+        SaplingNoteData& nd = wtx.mapSaplingNoteData.at(op);  // by reference: may populate the cache
 
-            // Shared spent / spending-key / locked filter. The address filter
-            // from GetFilteredNotes is intentionally NOT applied here (it needs a
-            // decrypt); this accessor is for the unfiltered wallet total only.
-            // ignoreSpent is always true for a balance.
-            if (!SaplingNotePassesSpendFilter(op, nd, true, requireSpendingKey, ignoreLocked)) {
-                continue;
-            }
+        // Shared spent / spending-key / locked filter. The address filter
+        // from GetFilteredNotes is intentionally NOT applied here (it needs a
+        // decrypt); this accessor is for the unfiltered wallet total only.
+        // ignoreSpent is always true for a balance.
+        if (!SaplingNotePassesSpendFilter(op, nd, true, requireSpendingKey, ignoreLocked)) {
+            continue;
+        }
 
-            if (nd.value) {
-                // Cache hit: read the cached plaintext value (CAmount only).
-                balance += nd.value.get();
-            } else {
-                // Cache miss (memory-only cache, e.g. fresh load): decrypt to
-                // obtain the value — the same decrypt GetFilteredNotes performs —
-                // then populate the cache. NEVER treat none as zero.
-                auto maybe_pt = SaplingNotePlaintext::decrypt(
-                    wtx.vShieldedOutput[op.n].encCiphertext,
-                    nd.ivk,
-                    wtx.vShieldedOutput[op.n].ephemeralKey,
-                    wtx.vShieldedOutput[op.n].cm);
-                assert(static_cast<bool>(maybe_pt));
-                CAmount value = CAmount(maybe_pt.get().value());
-                nd.value = value;  // populate the memory-only cache
-                balance += value;
-            }
+        if (nd.value) {
+            // Cache hit: read the cached plaintext value (CAmount only).
+            balance += nd.value.get();
+        } else {
+            // Cache miss (memory-only cache, e.g. fresh load): decrypt to
+            // obtain the value — the same decrypt GetFilteredNotes performs —
+            // then populate the cache. NEVER treat none as zero.
+            auto maybe_pt = SaplingNotePlaintext::decrypt(
+                wtx.vShieldedOutput[op.n].encCiphertext,
+                nd.ivk,
+                wtx.vShieldedOutput[op.n].ephemeralKey,
+                wtx.vShieldedOutput[op.n].cm);
+            assert(static_cast<bool>(maybe_pt));
+            CAmount value = CAmount(maybe_pt.get().value());
+            nd.value = value;  // populate the memory-only cache
+            balance += value;
         }
     }
 
@@ -4917,10 +5375,14 @@ CAmount CWallet::GetSproutBalanceCached(int minDepth, bool requireSpendingKey, b
 {
     LOCK2(cs_main, cs_wallet);
 
+    UpdateOutputIndex();
+    std::set<JSOutPoint> notes;
+    sproutNoteIndex.GetOutputs(nullptr, false, notes);
+
     CAmount balance = 0;
 
-    for (auto & p : mapWallet) {
-        CWalletTx& wtx = p.second;
+    for (const JSOutPoint& jsop : notes) {
+        CWalletTx& wtx = mapWallet.at(jsop.hash);
 
         // Per-transaction filter — IDENTICAL to GetFilteredNotes (minDepth only;
         // maxDepth is effectively INT_MAX for a balance read).
@@ -4930,59 +5392,56 @@ CAmount CWallet::GetSproutBalanceCached(int minDepth, bool requireSpendingKey, b
             continue;
         }
 
-        for (auto & pair : wtx.mapSproutNoteData) {
-            const JSOutPoint& jsop = pair.first;
-            SproutNoteData& nd = pair.second;  // by reference: may populate the cache
-            const SproutPaymentAddress& pa = nd.address;
+        SproutNoteData& nd = wtx.mapSproutNoteData.at(jsop);  // by reference: may populate the cache
+        const SproutPaymentAddress& pa = nd.address;
 
-            // Per-note filter — IDENTICAL to the Sprout branch of GetFilteredNotes
-            // (the address filter is intentionally omitted: this accessor is the
-            // unfiltered wallet total). ignoreSpent is always true for a balance.
-            if (nd.nullifier && IsSproutSpent(*nd.nullifier)) {
-                continue;
-            }
-            if (requireSpendingKey && !HaveSproutSpendingKey(pa)) {
-                continue;
-            }
-            if (ignoreLocked && IsLockedNote(jsop)) {
-                continue;
-            }
+        // Per-note filter — IDENTICAL to the Sprout branch of GetFilteredNotes
+        // (the address filter is intentionally omitted: this accessor is the
+        // unfiltered wallet total). ignoreSpent is always true for a balance.
+        if (nd.nullifier && IsSproutSpent(*nd.nullifier)) {
+            continue;
+        }
+        if (requireSpendingKey && !HaveSproutSpendingKey(pa)) {
+            continue;
+        }
+        if (ignoreLocked && IsLockedNote(jsop)) {
+            continue;
+        }
 
-            if (nd.value) {
-                // Cache hit: read the cached plaintext value (CAmount only).
-                balance += nd.value.get();
-            } else {
-                // Cache miss (memory-only cache, e.g. fresh load): decrypt to
-                // obtain the value — the same decrypt GetFilteredNotes performs —
-                // then populate the cache. NEVER treat none as zero.
-                int i = jsop.js; // index into CTransaction.vjoinsplit
-                int j = jsop.n;  // index into JSDescription.ciphertexts
-
-                ZCNoteDecryption decryptor;
-                if (!GetNoteDecryptor(pa, decryptor)) {
-                    // Note decryptors are created when the wallet is loaded, so
-                    // it should always exist (mirrors GetFilteredNotes).
-                    throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", EncodePaymentAddress(pa)));
-                }
-                auto hSig = wtx.vjoinsplit[i].h_sig(*pzcashParams, wtx.joinSplitPubKey);
-                // Mirror GetFilteredNotes' error contract: Sprout decrypt() THROWS on
-                // failure (unlike Sapling's optional), so wrap it — a decrypt error must
-                // surface as a runtime_error, never crash the RPC process.
-                try {
-                    SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
-                        decryptor,
-                        wtx.vjoinsplit[i].ciphertexts[j],
-                        wtx.vjoinsplit[i].ephemeralKey,
-                        hSig,
-                        (unsigned char) j);
-                    CAmount value = CAmount(plaintext.value());
-                    nd.value = value;  // populate the memory-only cache
-                    balance += value;
-                } catch (const note_decryption_failed &err) {
-                    throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", EncodePaymentAddress(pa)));
-                } catch (const std::exception &exc) {
-                    throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", EncodePaymentAddress(pa), exc.what()));
-                }
+        if (nd.value) {
+            // Cache hit: read the cached plaintext value (CAmount only).
+            balance += nd.value.get();
+        } else {
+            // Cache miss (memory-only cache, e.g. fresh load): decrypt to
+            // obtain the value — the same decrypt GetFilteredNotes performs —
+            // then populate the cache. NEVER treat none as zero.
+            int i = jsop.js; // index into CTransaction.vjoinsplit
+            int j = jsop.n;  // index into JSDescription.ciphertexts
+
+            ZCNoteDecryption decryptor;
+            if (!GetNoteDecryptor(pa, decryptor)) {
+                // Note decryptors are created when the wallet is loaded, so
+                // it should always exist (mirrors GetFilteredNotes).
+                throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", EncodePaymentAddress(pa)));
+            }
+            auto hSig = wtx.vjoinsplit[i].h_sig(*pzcashParams, wtx.joinSplitPubKey);
+            // Mirror GetFilteredNotes' error contract: Sprout decrypt() THROWS on
+            // failure (unlike Sapling's optional), so wrap it — a decrypt error must
+            // surface as a runtime_error, never crash the RPC process.
+            try {
+                SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
+                    decryptor,
+                    wtx.vjoinsplit[i].ciphertexts[j],
+                    wtx.vjoinsplit[i].ephemeralKey,
+                    hSig,
+                    (unsigned char) j);
+                CAmount value = CAmount(plaintext.value());
+                nd.value = value;  // populate the memory-only cache
+                balance += value;
+            } catch (const note_decryption_failed &err) {
+                throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", EncodePaymentAddress(pa)));
+            } catch (const std::exception &exc) {
+                throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", EncodePaymentAddress(pa), exc.what()));
             }
         }
     }
@@ -28,6 +28,7 @@
 #include "base58.h"
 
 #include <algorithm>
+#include <limits>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -204,6 +205,36 @@ public:
     std::string ToString() const;
 };
 
+/**
+ * What wallet.dat currently holds for a note's witness cache.
+ *
+ * Witnesses are persisted as one "sproutwitness"/"saplingwitness" record per
+ * (outpoint, height) plus a height record, instead of inside the CWalletTx
+ * record, so that advancing the chain tip by one block only has to write the
+ * new witness at the tip and erase the one that fell out of the cache.
+ * Memory-only; it is rebuilt from those records when the wallet is loaded.
+ */
+struct NoteWitnessRecords
+{
+    //! Whether the witness and height records exist for this note
+    bool fStored;
+    //! Height of the newest stored witness record
+    int nHeight;
+    //! Number of stored witness records, ending at nHeight
+    int nWitnesses;
+    //! Stored witness records at or above this height are stale
+    int nDirtyHeight;
+    //! Nullifier held by the stored transaction record
+    boost::optional<uint256> nullifier;
+
+    NoteWitnessRecords() : fStored(false), nHeight(-1), nWitnesses(0),
+        nDirtyHeight(std::numeric_limits<int>::max()), nullifier() { }
+
+    void MarkDirtyFrom(int height) {
+        nDirtyHeight = std::min(nDirtyHeight, height);
+    }
+};
+
 class SproutNoteData
 {
 public:
@@ -254,6 +285,9 @@ public:
      */
     boost::optional<CAmount> value;
 
+    /** Persisted witness state; memory-only, like 'value'. */
+    NoteWitnessRecords witnessRecords;
+
     SproutNoteData() : address(), nullifier(), witnessHeight {-1}, value(boost::none) { }
     SproutNoteData(libzcash::SproutPaymentAddress a) :
             address {a}, nullifier(), witnessHeight {-1}, value(boost::none) { }
@@ -318,6 +352,9 @@ public:
      */
     boost::optional<CAmount> value;
 
+    /** Persisted witness state; memory-only, like 'value'. */
+    NoteWitnessRecords witnessRecords;
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -364,6 +401,18 @@ struct SaplingOutputMatch
     boost::optional<libzcash::SaplingPaymentAddress> address;
 };
 
+/**
+ * Result of trial-decrypting a single Sprout JoinSplit output, the Sprout
+ * counterpart of SaplingOutputMatch: the wallet address whose decryptor
+ * opened it and the decrypted note. The nullifier is left to the apply
+ * thread, as it needs the spending key. Never serialized.
+ */
+struct SproutOutputMatch
+{
+    libzcash::SproutPaymentAddress address;
+    libzcash::SproutNote note;
+};
+
 /** Decrypted note, its location in a transaction, and number of confirmations. */
 struct CSproutNotePlaintextEntry
 {
@@ -770,6 +819,116 @@ private:
 };
 
 
+/**
+ * The wallet's outputs of one kind (transparent coins, or the notes of one
+ * shielded protocol), grouped by a key and spend state, so that coin, note and
+ * balance queries only visit the outputs they can return instead of every
+ * transaction in the wallet. Notes are keyed by payment address, coins by
+ * whether they are coinbase outputs.
+ *
+ * An output is SPENT only while a wallet transaction spending it is in the
+ * active chain, which can only change when a block is disconnected; every
+ * other spend (in the mempool, conflicted or expired) leaves it SPEND_PENDING,
+ * and callers check those outputs again on each query.
+ */
+template<typename OutPoint, typename Key>
+class WalletOutputIndex
+{
+public:
+    enum SpendState {
+        //! No wallet transaction spends the output, or its nullifier is unknown
+        UNSPENT = 0,
+        //! Spent by a wallet transaction that was not mined when last checked
+        SPEND_PENDING,
+        //! Spent by a wallet transaction in the active chain
+        SPENT,
+        NUM_SPEND_STATES
+    };
+
+    void Set(const OutPoint& op, const Key& key, SpendState state) {
+        auto it = mapOutputs.find(op);
+        if (it != mapOutputs.end()) {
+            if (it->second.first == key && it->second.second == state) {
+                return;
+            }
+            Unlink(it);
+            it->second = std::make_pair(key, state);
+        } else {
+            mapOutputs.insert(std::make_pair(op, std::make_pair(key, state)));
+        }
+        mapByKey[key].outputs[state].insert(op);
+    }
+
+    void Erase(const OutPoint& op) {
+        auto it = mapOutputs.find(op);
+        if (it != mapOutputs.end()) {
+            Unlink(it);
+            mapOutputs.erase(it);
+        }
+    }
+
+    const Key* GetKey(const OutPoint& op) const {
+        auto it = mapOutputs.find(op);
+        return it == mapOutputs.end() ? nullptr : &it->second.first;
+    }
+
+    /** Add the outputs under key, or under every key if null, to outputs. */
+    void GetOutputs(const Key* key, bool fIncludeSpent, std::set<OutPoint>& outputs) const {
+        if (key) {
+            auto it = mapByKey.find(*key);
+            if (it != mapByKey.end()) {
+                it->second.GetOutputs(fIncludeSpent, outputs);
+            }
+        } else {
+            for (const auto& item : mapByKey) {
+                item.second.GetOutputs(fIncludeSpent, outputs);
+            }
+        }
+    }
+
+    void GetPendingSpends(std::vector<OutPoint>& outputs) const {
+        for (const auto& item : mapByKey) {
+            const std::set<OutPoint>& pending = item.second.outputs[SPEND_PENDING];
+            outputs.insert(outputs.end(), pending.begin(), pending.end());
+        }
+    }
+
+    size_t size() const { return mapOutputs.size(); }
+
+    void Clear() {
+        mapOutputs.clear();
+        mapByKey.clear();
+    }
+
+private:
+    struct KeyOutputs {
+        std::set<OutPoint> outputs[NUM_SPEND_STATES];
+
+        bool empty() const {
+            return outputs[UNSPENT].empty() && outputs[SPEND_PENDING].empty() && outputs[SPENT].empty();
+        }
+
+        void GetOutputs(bool fIncludeSpent, std::set<OutPoint>& result) const {
+            result.insert(outputs[UNSPENT].begin(), outputs[UNSPENT].end());
+            result.insert(outputs[SPEND_PENDING].begin(), outputs[SPEND_PENDING].end());
+            if (fIncludeSpent) {
+                result.insert(outputs[SPENT].begin(), outputs[SPENT].end());
+            }
+        }
+    };
+
+    std::map<OutPoint, std::pair<Key, SpendState>> mapOutputs;
+    std::map<Key, KeyOutputs> mapByKey;
+
+    void Unlink(typename std::map<OutPoint, std::pair<Key, SpendState>>::iterator it) {
+        auto kit = mapByKey.find(it->second.first);
+        kit->second.outputs[it->second.second].erase(it->first);
+        if (kit->second.empty()) {
+            mapByKey.erase(kit);
+        }
+    }
+};
+
 /** 
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -808,11 +967,40 @@ private:
     TxNullifiers mapTxSproutNullifiers;
     TxNullifiers mapTxSaplingNullifiers;
 
+    /**
+     * Index of the wallet's coins and notes by spend state. It is built by the
+     * first coin or note query and then kept current by reindexing the
+     * transactions in setOutputIndexDirtyTxs before each query. Importing keys
+     * or scripts can make existing outputs ours, so it drops the whole index.
+     * The members are mutable because they only cache what mapWallet says.
+     */
+    typedef WalletOutputIndex<COutPoint, bool> CoinIndex;
+    typedef WalletOutputIndex<JSOutPoint, libzcash::SproutPaymentAddress> SproutNoteIndex;
+    typedef WalletOutputIndex<SaplingOutPoint, libzcash::SaplingPaymentAddress> SaplingNoteIndex;
+    mutable CoinIndex coinIndex;
+    mutable SproutNoteIndex sproutNoteIndex;
+    mutable SaplingNoteIndex saplingNoteIndex;
+    mutable bool fOutputIndexBuilt;
+    mutable std::set<uint256> setOutputIndexDirtyTxs;
+
+    void MarkOutputIndexDirty(const uint256& hash);
+    void InvalidateOutputIndex();
+    void IndexTxOutputs(const uint256& hash) const;
+    /** Bring the output index up to date. Caller must hold cs_main and cs_wallet. */
+    void UpdateOutputIndex() const;
+
     void AddToTransparentSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSproutSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /** Whether any transaction in the wallet spends the outpoint or nullifier */
+    template <class T>
+    bool HaveWalletSpend(const T& spent, const TxSpendMap<T>& spends) const;
+    /** Whether a transaction in the wallet spending the outpoint or nullifier is in the active chain */
+    template <class T>
+    bool HaveMinedSpend(const T& spent, const TxSpendMap<T>& spends) const;
+
 public:
     /*
      * Size of the incremental witness cache for the notes in our wallet.
@@ -836,6 +1024,83 @@ protected:
      */
     void DecrementNoteWitnesses(const CBlockIndex* pindex);
 
+    /** Whether any note's transaction-level data differs from wallet.dat. */
+    template <typename NoteDataMap>
+    static bool NoteRecordsStale(const NoteDataMap& noteDataMap) {
+        for (const auto& item : noteDataMap) {
+            const NoteWitnessRecords& stored = item.second.witnessRecords;
+            if (!stored.fStored || stored.nullifier != item.second.nullifier) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Copy of wtx for the "tx" record, with the note witness caches left to
+     * the per-height witness records. The witness height is reset too, so
+     * that a node which does not know about those records treats the notes
+     * as not yet witnessed rather than finding an inconsistent cache.
+     */
+    static CWalletTx WithoutNoteWitnesses(const CWalletTx& wtx) {
+        CWalletTx copy = wtx;
+        for (auto& item : copy.mapSproutNoteData) {
+            item.second.witnesses.clear();
+            item.second.witnessHeight = -1;
+        }
+        for (auto& item : copy.mapSaplingNoteData) {
+            item.second.witnesses.clear();
+            item.second.witnessHeight = -1;
+        }
+        return copy;
+    }
+
+    /**
+     * Bring the witness records of each note up to date with its witness
+     * cache, writing only the witnesses wallet.dat does not already hold and
+     * erasing those that have left the cache. The resulting record state is
+     * appended to vStored for the caller to apply after committing.
+     */
+    template <typename WalletDB, typename NoteDataMap>
+    static bool WriteNoteWitnessRecords(WalletDB& walletdb, NoteDataMap& noteDataMap,
+                                        std::vector<std::pair<NoteWitnessRecords*, NoteWitnessRecords>>& vStored) {
+        for (auto& item : noteDataMap) {
+            const auto& op = item.first;
+            auto& nd = item.second;
+            const NoteWitnessRecords& stored = nd.witnessRecords;
+            const int nWitnesses = nd.witnesses.size();
+            const int nLowest = nd.witnessHeight - nWitnesses + 1;
+            if (stored.fStored) {
+                for (int h = stored.nHeight - stored.nWitnesses + 1; h <= stored.nHeight; h++) {
+                    if ((h < nLowest || h > nd.witnessHeight) && !walletdb.EraseNoteWitness(op, h)) {
+                        return false;
+                    }
+                }
+            }
+            int h = nd.witnessHeight;
+            for (const auto& witness : nd.witnesses) {
+                bool fHave = stored.fStored && h < stored.nDirtyHeight &&
+                             h <= stored.nHeight && h > stored.nHeight - stored.nWitnesses;
+                if (!fHave && !walletdb.WriteNoteWitness(op, h, witness)) {
+                    return false;
+                }
+                h--;
+            }
+            if (!stored.fStored || stored.nHeight != nd.witnessHeight || stored.nWitnesses != nWitnesses) {
+                if (!walletdb.WriteNoteWitnessHeight(op, nd.witnessHeight, nWitnesses)) {
+                    return false;
+                }
+            }
+            NoteWitnessRecords updated;
+            updated.fStored = true;
+            updated.nHeight = nd.witnessHeight;
+            updated.nWitnesses = nWitnesses;
+            updated.nullifier = nd.nullifier;
+            vStored.push_back(std::make_pair(&nd.witnessRecords, updated));
+        }
+        return true;
+    }
+
     template <typename WalletDB>
     void SetBestChainINTERNAL(WalletDB& walletdb, const CBlockLocator& loc) {
         if (!walletdb.TxnBegin()) {
@@ -843,20 +1108,34 @@ protected:
             LogPrintf("SetBestChain(): Couldn't start atomic write\n");
             return;
         }
+        // Witness record state to apply once the write has been committed
+        std::vector<std::pair<NoteWitnessRecords*, NoteWitnessRecords>> vStored;
         try {
             for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                auto wtx = wtxItem.second;
+                CWalletTx& wtx = wtxItem.second;
                 // We skip transactions for which mapSproutNoteData and mapSaplingNoteData
                 // are empty. This covers transactions that have no Sprout or Sapling data
                 // (i.e. are purely transparent), as well as shielding and unshielding
                 // transactions in which we only have transparent addresses involved.
-                if (!(wtx.mapSproutNoteData.empty() && wtx.mapSaplingNoteData.empty())) {
-                    if (!walletdb.WriteTx(wtxItem.first, wtx)) {
+                if (wtx.mapSproutNoteData.empty() && wtx.mapSaplingNoteData.empty()) {
+                    continue;
+                }
+                // The witness caches live in their own records, so the
+                // transaction itself only needs rewriting when a note is
+                // persisted for the first time or its nullifier changed.
+                if (NoteRecordsStale(wtx.mapSproutNoteData) || NoteRecordsStale(wtx.mapSaplingNoteData)) {
+                    if (!walletdb.WriteTx(wtxItem.first, WithoutNoteWitnesses(wtx))) {
                         LogPrintf("SetBestChain(): Failed to write CWalletTx, aborting atomic write\n");
                         walletdb.TxnAbort();
                         return;
                     }
                 }
+                if (!WriteNoteWitnessRecords(walletdb, wtx.mapSproutNoteData, vStored) ||
+                    !WriteNoteWitnessRecords(walletdb, wtx.mapSaplingNoteData, vStored)) {
+                    LogPrintf("SetBestChain(): Failed to write note witnesses, aborting atomic write\n");
+                    walletdb.TxnAbort();
+                    return;
+                }
             }
             if (!walletdb.WriteWitnessCacheSize(nWitnessCacheSize)) {
                 LogPrintf("SetBestChain(): Failed to write nWitnessCacheSize, aborting atomic write\n");
@@ -880,6 +1159,9 @@ protected:
             LogPrintf("SetBestChain(): Couldn't commit atomic write\n");
             return;
         }
+        for (const std::pair<NoteWitnessRecords*, NoteWitnessRecords>& item : vStored) {
+            *item.first = item.second;
+        }
     }
 
 private:
@@ -927,12 +1209,44 @@ protected:
      * matching ivk wins" result is identical regardless of which thread computed
      * which cell. Non-matches are simply absent from `out`. Below a small cell
      * threshold (or with <2 workers) it falls back to a single-threaded fill.
-     * Caller must hold cs_wallet (the window's blocks must outlive this call).
+     * Takes no wallet lock beyond that snapshot; the blocks must outlive this
+     * call.
      */
     void BuildSaplingScanBatch(
         const std::vector<std::pair<CBlockIndex*, CBlock>>& window,
         int nWorkers,
         std::map<SaplingOutPoint, SaplingOutputMatch>& out) const;
+    void BuildSaplingScanBatch(
+        const std::vector<const CBlock*>& blocks,
+        int nWorkers,
+        std::map<SaplingOutPoint, SaplingOutputMatch>& out) const;
+
+    /**
+     * Sprout counterpart of TrialDecryptSaplingOutput: trial-decrypt output n
+     * of a JoinSplit against an ordered snapshot of the wallet's note
+     * decryptors, returning the first match (in mapNoteDecryptors order, like
+     * the serial FindMySproutNotes loop). Lock-free.
+     */
+    boost::optional<SproutOutputMatch> TrialDecryptSproutOutput(
+        const JSDescription& jsdesc,
+        const uint256& hSig,
+        uint8_t n,
+        const std::vector<std::pair<libzcash::SproutPaymentAddress, ZCNoteDecryption>>& decryptors) const;
+
+    /**
+     * Sprout counterpart of BuildSaplingScanBatch: trial-decrypt every
+     * JoinSplit ciphertext of the window in parallel against a frozen
+     * snapshot of mapNoteDecryptors, so the first matching address is the
+     * one the serial path would pick. Fills `out` keyed by JSOutPoint.
+     */
+    void BuildSproutScanBatch(
+        const std::vector<std::pair<CBlockIndex*, CBlock>>& window,
+        int nWorkers,
+        std::map<JSOutPoint, SproutOutputMatch>& out) const;
+    void BuildSproutScanBatch(
+        const std::vector<const CBlock*>& blocks,
+        int nWorkers,
+        std::map<JSOutPoint, SproutOutputMatch>& out) const;
 
     /**
      * Transient rescan state, set ONLY by ScanForWalletTransactions while
@@ -942,6 +1256,30 @@ protected:
      * the calling thread. Always null outside an active windowed rescan.
      */
     const std::map<SaplingOutPoint, SaplingOutputMatch>* pScanSaplingBatch = nullptr;
+    /** Sprout counterpart of pScanSaplingBatch, read by FindMySproutNotes. */
+    const std::map<JSOutPoint, SproutOutputMatch>* pScanSproutBatch = nullptr;
+
+    /**
+     * Trial-decryption results for the outputs of the block being connected.
+     * The block's transactions reach SyncTransaction one at a time; the first
+     * one fills this in parallel (PrepareBlockScanBatch, without cs_wallet
+     * held) and the rest of them read their matches from it. nSaplingKeys and
+     * nSproutKeys record the key counts it was computed with, so it is not
+     * used if a key was added since. Cleared by ChainTip. Guarded by cs_wallet.
+     */
+    struct BlockScanBatch {
+        uint256 hashBlock;
+        size_t nSaplingKeys = 0;
+        size_t nSproutKeys = 0;
+        std::map<SaplingOutPoint, SaplingOutputMatch> sapling;
+        std::map<JSOutPoint, SproutOutputMatch> sprout;
+    };
+    BlockScanBatch blockScanBatch;
+
+    /** Fill blockScanBatch for this block unless it already holds it. */
+    void PrepareBlockScanBatch(const CBlock& block, const uint256& hashBlock);
+    /** Whether blockScanBatch holds usable results for this block. Caller must hold cs_wallet. */
+    bool HaveBlockScanBatch(const uint256& hashBlock) const;
 
 protected:
     bool UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx);
@@ -1004,6 +1342,7 @@ public:
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        fOutputIndexBuilt = false;
     }
 
     /**
@@ -1109,7 +1448,10 @@ public:
      */
     CPubKey GenerateNewKey();
     //! Adds a key to the store, and saves it to disk.
-    bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
+    bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey) { return AddKeyPubKey(key, pubkey, false); }
+    //! As above; fNewKey marks a key just generated by the wallet, which no
+    //! wallet transaction can pay yet, so the output index stays valid.
+    bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey, bool fNewKey);
     //! Adds a key to the store, without saving it to disk (used by LoadWallet)
     bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
     //! Load metadata (used by LoadWallet)
@@ -1305,7 +1647,8 @@ public:
     bool IsNoteSproutChange(const std::set<std::pair<libzcash::PaymentAddress, uint256>> & nullifierSet, const libzcash::PaymentAddress & address, const JSOutPoint & entry);
     bool IsNoteSaplingChange(const std::set<std::pair<libzcash::PaymentAddress, uint256>> & nullifierSet, const libzcash::PaymentAddress & address, const SaplingOutPoint & entry);
 
-    DBErrors LoadWallet(bool& fFirstRunRet);
+    //! nWorkers: threads decoding wallet transactions, -1 for the configured number
+    DBErrors LoadWallet(bool& fFirstRunRet, int nWorkers = -1);
     DBErrors ZapWalletTx(std::vector<CWalletTx>& vWtx);
 
     bool SetAddressBook(const CTxDestination& address, const std::string& strName, const std::string& purpose);
@@ -16,6 +16,8 @@
 #include "wallet/wallet.h"
 #include "zcash/Proof.hpp"
 
+#include <atomic>
+
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -67,6 +69,67 @@ bool CWalletDB::EraseTx(uint256 hash)
     return Erase(std::make_pair(std::string("tx"), hash));
 }
 
+bool CWalletDB::WriteNoteWitness(const JSOutPoint& op, int height, const SproutWitness& witness)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("sproutwitness"), std::make_pair(op, height)), witness);
+}
+
+bool CWalletDB::WriteNoteWitness(const SaplingOutPoint& op, int height, const SaplingWitness& witness)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("saplingwitness"), std::make_pair(op, height)), witness);
+}
+
+bool CWalletDB::EraseNoteWitness(const JSOutPoint& op, int height)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("sproutwitness"), std::make_pair(op, height)));
+}
+
+bool CWalletDB::EraseNoteWitness(const SaplingOutPoint& op, int height)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("saplingwitness"), std::make_pair(op, height)));
+}
+
+bool CWalletDB::WriteNoteWitnessHeight(const JSOutPoint& op, int height, int nWitnesses)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("sproutwitnessheight"), op), std::make_pair(height, nWitnesses));
+}
+
+bool CWalletDB::WriteNoteWitnessHeight(const SaplingOutPoint& op, int height, int nWitnesses)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("saplingwitnessheight"), op), std::make_pair(height, nWitnesses));
+}
+
+template<typename OutPoint>
+bool CWalletDB::EraseNoteWitnessRecords(const std::string& strType, const OutPoint& op)
+{
+    std::pair<int, int> heightRecord;
+    if (!Read(std::make_pair(strType + "height", op), heightRecord))
+        return true;
+
+    nWalletDBUpdated++;
+    for (int h = heightRecord.first - heightRecord.second + 1; h <= heightRecord.first; h++) {
+        if (!Erase(std::make_pair(strType, std::make_pair(op, h))))
+            return false;
+    }
+    return Erase(std::make_pair(strType + "height", op));
+}
+
+bool CWalletDB::EraseNoteWitnesses(const JSOutPoint& op)
+{
+    return EraseNoteWitnessRecords(std::string("sproutwitness"), op);
+}
+
+bool CWalletDB::EraseNoteWitnesses(const SaplingOutPoint& op)
+{
+    return EraseNoteWitnessRecords(std::string("saplingwitness"), op);
+}
+
 bool CWalletDB::WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata& keyMeta)
 {
     nWalletDBUpdated++;
@@ -417,6 +480,9 @@ DBErrors CWalletDB::ReorderTransactions(CWallet* pwallet)
     return DB_LOAD_OK;
 }
 
+// Number of transaction records decoded together during a wallet load
+static const size_t WALLET_LOAD_TX_BATCH = 1024;
+
 class CWalletScanState {
 public:
     unsigned int nKeys;
@@ -430,6 +496,12 @@ public:
     bool fAnyUnordered;
     int nFileVersion;
     vector<uint256> vWalletUpgrade;
+    // Note witness records, applied to the loaded transactions afterwards.
+    // The witnesses are kept serialized until then.
+    std::map<JSOutPoint, std::pair<int, int>> mapSproutWitnessHeights;
+    std::map<std::pair<JSOutPoint, int>, CDataStream> mapSproutWitnesses;
+    std::map<SaplingOutPoint, std::pair<int, int>> mapSaplingWitnessHeights;
+    std::map<std::pair<SaplingOutPoint, int>, CDataStream> mapSaplingWitnesses;
 
     CWalletScanState() {
         nKeys = nCKeys = nKeyMeta = nZKeys = nCZKeys = nZKeyMeta = nSapZAddrs = 0;
@@ -439,6 +511,54 @@ public:
     }
 };
 
+/**
+ * Decode and check a wallet transaction record. Touches no wallet state, so
+ * records can be decoded concurrently.
+ */
+static bool ReadWalletTx(const uint256& hash, CDataStream& ssValue, CWalletTx& wtx,
+                         bool& fUpgrade, string& strErr)
+{
+    fUpgrade = false;
+    ssValue >> wtx;
+    CValidationState state;
+    auto verifier = libzcash::ProofVerifier::Strict();
+    if (!(CheckTransaction(wtx, state, verifier) && (wtx.GetHash() == hash) && state.IsValid()))
+        return false;
+
+    // Undo serialize changes in 31600
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgrade = true;
+    }
+    return true;
+}
+
+static void LoadWalletTx(CWallet* pwallet, const uint256& hash, const CWalletTx& wtx,
+                         bool fUpgrade, CWalletScanState& wss)
+{
+    if (fUpgrade)
+        wss.vWalletUpgrade.push_back(hash);
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->AddToWallet(wtx, true, NULL);
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -465,36 +585,10 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             uint256 hash;
             ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            auto verifier = libzcash::ProofVerifier::Strict();
-            if (!(CheckTransaction(wtx, state, verifier) && (wtx.GetHash() == hash) && state.IsValid()))
+            bool fUpgrade;
+            if (!ReadWalletTx(hash, ssValue, wtx, fUpgrade, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true, NULL);
+            LoadWalletTx(pwallet, hash, wtx, fUpgrade, wss);
         }
         else if (strType == "acentry")
         {
@@ -811,6 +905,30 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         {
             ssValue >> pwallet->nWitnessCacheSize;
         }
+        else if (strType == "sproutwitness")
+        {
+            std::pair<JSOutPoint, int> key;
+            ssKey >> key;
+            wss.mapSproutWitnesses.insert(std::make_pair(key, ssValue));
+        }
+        else if (strType == "saplingwitness")
+        {
+            std::pair<SaplingOutPoint, int> key;
+            ssKey >> key;
+            wss.mapSaplingWitnesses.insert(std::make_pair(key, ssValue));
+        }
+        else if (strType == "sproutwitnessheight")
+        {
+            JSOutPoint op;
+            ssKey >> op;
+            ssValue >> wss.mapSproutWitnessHeights[op];
+        }
+        else if (strType == "saplingwitnessheight")
+        {
+            SaplingOutPoint op;
+            ssKey >> op;
+            ssValue >> wss.mapSaplingWitnessHeights[op];
+        }
         else if (strType == "hdseed")
         {
             uint256 seedFp;
@@ -857,6 +975,161 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
     return true;
 }
 
+/**
+ * Run f(i) for every i in [0, n), spread over up to nWorkers threads including
+ * this one. f must not throw, and must only touch state owned by its index.
+ */
+template<typename F>
+static void RunParallel(size_t n, int nWorkers, const F& f)
+{
+    if (nWorkers < 2 || n < 2) {
+        for (size_t i = 0; i < n; i++) {
+            f(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next.fetch_add(1); i < n; i = next.fetch_add(1)) {
+            f(i);
+        }
+    };
+    boost::thread_group group;
+    for (int w = 1; w < std::min<int>(nWorkers, n); w++) {
+        group.create_thread(worker);
+    }
+    worker();
+    group.join_all();
+}
+
+/**
+ * Rebuild the witness caches of the loaded notes from their witness records.
+ * Notes without a height record (wallets written before the records existed)
+ * keep the witnesses stored in their transaction. Only the records of notes
+ * still in the wallet are decoded, in parallel. Returns false if any of them
+ * could not be decoded.
+ */
+template<typename OutPoint, typename NoteDataMap>
+static bool LoadNoteWitnesses(CWallet* pwallet,
+                              const std::map<OutPoint, std::pair<int, int>>& mapHeights,
+                              std::map<std::pair<OutPoint, int>, CDataStream>& mapWitnesses,
+                              NoteDataMap CWalletTx::*noteData,
+                              int nWorkers)
+{
+    typedef typename NoteDataMap::mapped_type NoteData;
+    std::vector<std::pair<const OutPoint*, NoteData*>> vNotes;
+    std::vector<std::pair<int, int>> vHeights;
+    for (const auto& item : mapHeights) {
+        const OutPoint& op = item.first;
+        auto wit = pwallet->mapWallet.find(op.hash);
+        if (wit == pwallet->mapWallet.end()) {
+            continue;
+        }
+        NoteDataMap& noteDataMap = wit->second.*noteData;
+        auto nit = noteDataMap.find(op);
+        if (nit == noteDataMap.end()) {
+            continue;
+        }
+        vNotes.push_back(std::make_pair(&op, &nit->second));
+        vHeights.push_back(item.second);
+    }
+
+    // Each note's records are only read by the job that decodes that note
+    std::vector<char> vCorrupt(vNotes.size(), false);
+    RunParallel(vNotes.size(), nWorkers, [&](size_t i) {
+        const OutPoint& op = *vNotes[i].first;
+        NoteData& nd = *vNotes[i].second;
+        nd.witnesses.clear();
+        nd.witnessHeight = vHeights[i].first;
+        try {
+            for (int j = 0; j < vHeights[i].second; j++) {
+                auto rit = mapWitnesses.find(std::make_pair(op, nd.witnessHeight - j));
+                if (rit == mapWitnesses.end()) {
+                    break;
+                }
+                nd.witnesses.emplace_back();
+                rit->second >> nd.witnesses.back();
+            }
+        } catch (...) {
+            vCorrupt[i] = true;
+            nd.witnesses.clear();
+        }
+    });
+
+    bool fCorrupt = false;
+    for (size_t i = 0; i < vNotes.size(); i++) {
+        const OutPoint& op = *vNotes[i].first;
+        NoteData& nd = *vNotes[i].second;
+        fCorrupt |= vCorrupt[i] != 0;
+        if (nd.witnesses.size() != (size_t)vHeights[i].second) {
+            // Should not happen, as the records are written atomically; the
+            // note will need a rescan before it can be spent.
+            LogPrintf("Missing or corrupt witness records for %s, discarding its witness cache\n", op.ToString());
+            nd.witnesses.clear();
+            continue;
+        }
+        nd.witnessRecords.fStored = true;
+        nd.witnessRecords.nHeight = vHeights[i].first;
+        nd.witnessRecords.nWitnesses = vHeights[i].second;
+        nd.witnessRecords.nullifier = nd.nullifier;
+    }
+    return !fCorrupt;
+}
+
+/** A wallet transaction record, decoded in a batch with other records. */
+struct CWalletTxRecord
+{
+    CDataStream ssKey;
+    CDataStream ssValue;
+    uint256 hash;
+    CWalletTx wtx;
+    bool fValid;
+    bool fUpgrade;
+    string strErr;
+
+    CWalletTxRecord(const CDataStream& ssKeyIn, const CDataStream& ssValueIn) :
+        ssKey(ssKeyIn), ssValue(ssValueIn), fValid(false), fUpgrade(false) {}
+};
+
+static bool IsTxRecord(const CDataStream& ssKey)
+{
+    // The type string "tx" serializes as its length followed by its characters
+    return ssKey.size() >= 3 && ssKey[0] == 2 && ssKey[1] == 't' && ssKey[2] == 'x';
+}
+
+/**
+ * Decode and check a batch of transaction records on nWorkers threads, then
+ * add them to the wallet in database order.
+ */
+static void LoadWalletTxBatch(CWallet* pwallet, std::vector<CWalletTxRecord>& vRecords,
+                              CWalletScanState& wss, int nWorkers, bool& fNoncriticalErrors)
+{
+    RunParallel(vRecords.size(), nWorkers, [&](size_t i) {
+        CWalletTxRecord& record = vRecords[i];
+        try {
+            string strType;
+            record.ssKey >> strType >> record.hash;
+            record.fValid = ReadWalletTx(record.hash, record.ssValue, record.wtx, record.fUpgrade, record.strErr);
+        } catch (...) {
+            record.fValid = false;
+        }
+    });
+
+    for (CWalletTxRecord& record : vRecords) {
+        if (record.fValid) {
+            LoadWalletTx(pwallet, record.hash, record.wtx, record.fUpgrade, wss);
+        } else {
+            fNoncriticalErrors = true;
+            // Rescan if there is a bad transaction record:
+            SoftSetBoolArg("-rescan", true);
+        }
+        if (!record.strErr.empty())
+            LogPrintf("%s\n", record.strErr);
+    }
+    vRecords.clear();
+}
+
 static bool IsKeyType(string strType)
 {
     return (strType== "key" || strType == "wkey" ||
@@ -867,12 +1140,14 @@ static bool IsKeyType(string strType)
             strType == "mkey" || strType == "ckey");
 }
 
-DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
+DBErrors CWalletDB::LoadWallet(CWallet* pwallet, int nWorkers)
 {
     pwallet->vchDefaultKey = CPubKey();
     CWalletScanState wss;
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
+    if (nWorkers < 0)
+        nWorkers = GetBoolArg("-nowalletparallel", false) ? 0 : nScriptCheckThreads;
 
     try {
         LOCK(pwallet->cs_wallet);
@@ -892,6 +1167,12 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        // The cursor is read sequentially, but transaction records, which
+        // dominate the load time through their proof checks, are decoded in
+        // parallel batches.
+        std::vector<CWalletTxRecord> vTxRecords;
+        vTxRecords.reserve(WALLET_LOAD_TX_BATCH);
+
         while (true)
         {
             // Read next record
@@ -906,6 +1187,14 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 return DB_CORRUPT;
             }
 
+            if (IsTxRecord(ssKey))
+            {
+                vTxRecords.emplace_back(ssKey, ssValue);
+                if (vTxRecords.size() >= WALLET_LOAD_TX_BATCH)
+                    LoadWalletTxBatch(pwallet, vTxRecords, wss, nWorkers, fNoncriticalErrors);
+                continue;
+            }
+
             // Try to be tolerant of single corrupt records:
             string strType, strErr;
             if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
@@ -927,6 +1216,12 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 LogPrintf("%s\n", strErr);
         }
         pcursor->close();
+        LoadWalletTxBatch(pwallet, vTxRecords, wss, nWorkers, fNoncriticalErrors);
+
+        if (!LoadNoteWitnesses(pwallet, wss.mapSproutWitnessHeights, wss.mapSproutWitnesses, &CWalletTx::mapSproutNoteData, nWorkers))
+            fNoncriticalErrors = true;
+        if (!LoadNoteWitnesses(pwallet, wss.mapSaplingWitnessHeights, wss.mapSaplingWitnesses, &CWalletTx::mapSaplingNoteData, nWorkers))
+            fNoncriticalErrors = true;
     }
     catch (const boost::thread_interrupted&) {
         throw;
@@ -1060,6 +1355,18 @@ DBErrors CWalletDB::ZapWalletTx(CWallet* pwallet, vector<CWalletTx>& vWtx)
             return DB_CORRUPT;
     }
 
+    // and the witness records of its notes, which are kept apart from it
+    for (const CWalletTx& wtx : vWtx) {
+        for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
+            if (!EraseNoteWitnesses(item.first))
+                return DB_CORRUPT;
+        }
+        for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+            if (!EraseNoteWitnesses(item.first))
+                return DB_CORRUPT;
+        }
+    }
+
     return DB_LOAD_OK;
 }
 
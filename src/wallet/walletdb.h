@@ -11,6 +11,7 @@
 #include "key.h"
 #include "keystore.h"
 #include "zcash/Address.hpp"
+#include "zcash/IncrementalMerkleTree.hpp"
 #include "zcash/zip32.h"
 
 #include <list>
@@ -27,6 +28,8 @@ class CMasterKey;
 class CScript;
 class CWallet;
 class CWalletTx;
+class JSOutPoint;
+class SaplingOutPoint;
 class uint160;
 class uint256;
 
@@ -134,6 +137,17 @@ public:
     bool WriteTx(uint256 hash, const CWalletTx& wtx);
     bool EraseTx(uint256 hash);
 
+    /// Note witness caches, stored apart from their transaction (see NoteWitnessRecords)
+    bool WriteNoteWitness(const JSOutPoint& op, int height, const SproutWitness& witness);
+    bool WriteNoteWitness(const SaplingOutPoint& op, int height, const SaplingWitness& witness);
+    bool EraseNoteWitness(const JSOutPoint& op, int height);
+    bool EraseNoteWitness(const SaplingOutPoint& op, int height);
+    bool WriteNoteWitnessHeight(const JSOutPoint& op, int height, int nWitnesses);
+    bool WriteNoteWitnessHeight(const SaplingOutPoint& op, int height, int nWitnesses);
+    /// Erase all witness records of a note, as listed by its height record
+    bool EraseNoteWitnesses(const JSOutPoint& op);
+    bool EraseNoteWitnesses(const SaplingOutPoint& op);
+
     bool WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata &keyMeta);
     bool WriteCryptedKey(const CPubKey& vchPubKey, const std::vector<unsigned char>& vchCryptedSecret, const CKeyMetadata &keyMeta);
     bool WriteMasterKey(unsigned int nID, const CMasterKey& kMasterKey);
@@ -171,7 +185,9 @@ public:
     void ListAccountCreditDebit(const std::string& strAccount, std::list<CAccountingEntry>& acentries);
 
     DBErrors ReorderTransactions(CWallet* pwallet);
-    DBErrors LoadWallet(CWallet* pwallet);
+    //! Load all records into pwallet, decoding transactions on nWorkers
+    //! threads (-1: as configured by -par and -nowalletparallel)
+    DBErrors LoadWallet(CWallet* pwallet, int nWorkers = -1);
     DBErrors FindWalletTx(CWallet* pwallet, std::vector<uint256>& vTxHash, std::vector<CWalletTx>& vWtx);
     DBErrors ZapWalletTx(CWallet* pwallet, std::vector<CWalletTx>& vWtx);
     static bool Recover(CDBEnv& dbenv, const std::string& filename, bool fOnlyKeys);
@@ -205,6 +221,9 @@ private:
     void operator=(const CWalletDB&);
 
     bool WriteAccountingEntry(const uint64_t nAccEntryNum, const CAccountingEntry& acentry);
+
+    template<typename OutPoint>
+    bool EraseNoteWitnessRecords(const std::string& strType, const OutPoint& op);
 };
 
 bool BackupWallet(const CWallet& wallet, const std::string& strDest);
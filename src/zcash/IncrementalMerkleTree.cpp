@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <stdexcept>
 
 #include <boost/foreach.hpp>
@@ -134,6 +135,8 @@ void IncrementalMerkleTree<Depth, Hash>::append(Hash obj) {
         throw std::runtime_error("tree is full");
     }
 
+    cached_root = boost::none;
+
     if (!left) {
         // Set the left leaf
         left = obj;
@@ -165,6 +168,63 @@ void IncrementalMerkleTree<Depth, Hash>::append(Hash obj) {
     }
 }
 
+template<size_t Depth, typename Hash>
+void IncrementalMerkleTree<Depth, Hash>::append_many(const std::vector<Hash>& objs) {
+    if (objs.empty()) {
+        return;
+    }
+    if (Depth < 64 && objs.size() > (uint64_t(1) << Depth) - size()) {
+        throw std::runtime_error("tree is full");
+    }
+
+    cached_root = boost::none;
+
+    // The leaves not yet hashed into a parent: the current left/right ones
+    // followed by the new elements. Like append(), keep the last one or two
+    // unhashed (a lone left leaf, or a left/right pair) and hash the rest
+    // pairwise into the next level.
+    std::vector<Hash> level;
+    level.reserve(2 + objs.size());
+    if (left) {
+        level.push_back(*left);
+    }
+    if (right) {
+        level.push_back(*right);
+    }
+    level.insert(level.end(), objs.begin(), objs.end());
+    size_t keep = (size() + objs.size()) % 2 ? 1 : 2;
+    left = level[level.size() - keep];
+    right = keep == 2 ? boost::optional<Hash>(level.back()) : boost::none;
+    level.resize(level.size() - keep);
+
+    std::vector<Hash> next;
+    next.reserve(level.size() / 2);
+    for (size_t j = 0; j + 1 < level.size(); j += 2) {
+        next.push_back(Hash::combine(level[j], level[j + 1], 0));
+    }
+    level.swap(next);
+
+    // Carry the new subtrees up: at each level a waiting left sibling in
+    // parents pairs with the first new subtree, and an odd one out waits
+    // in parents in turn.
+    for (size_t i = 0; !level.empty(); i++) {
+        if (i == parents.size()) {
+            parents.push_back(boost::none);
+        }
+        next.clear();
+        size_t j = 0;
+        if (parents[i]) {
+            next.push_back(Hash::combine(*parents[i], level[0], i + 1));
+            j = 1;
+        }
+        for (; j + 1 < level.size(); j += 2) {
+            next.push_back(Hash::combine(level[j], level[j + 1], i + 1));
+        }
+        parents[i] = j < level.size() ? boost::optional<Hash>(level[j]) : boost::none;
+        level.swap(next);
+    }
+}
+
 // This is for allowing the witness to determine if a subtree has filled
 // to a particular depth, or for append() to ensure we're not appending
 // to a full tree.
@@ -257,6 +317,15 @@ Hash IncrementalMerkleTree<Depth, Hash>::root(size_t depth,
     return root;
 }
 
+template<size_t Depth, typename Hash>
+Hash IncrementalMerkleTree<Depth, Hash>::root_memoized(size_t depth) const {
+    if (!cached_root || cached_root_depth != depth) {
+        cached_root = root(depth);
+        cached_root_depth = depth;
+    }
+    return *cached_root;
+}
+
 // This constructs an authentication path into the tree in the format that the circuit
 // wants. The caller provides `filler_hashes` to fill in the uncle subtrees.
 template<size_t Depth, typename Hash>
@@ -317,7 +386,7 @@ std::deque<Hash> IncrementalWitness<Depth, Hash>::partial_path() const {
     std::deque<Hash> uncles(filled.begin(), filled.end());
 
     if (cursor) {
-        uncles.push_back(cursor->root(cursor_depth));
+        uncles.push_back(cursor->root_memoized(cursor_depth));
     }
 
     return uncles;
@@ -325,11 +394,13 @@ std::deque<Hash> IncrementalWitness<Depth, Hash>::partial_path() const {
 
 template<size_t Depth, typename Hash>
 void IncrementalWitness<Depth, Hash>::append(Hash obj) {
+    cached_root = boost::none;
+
     if (cursor) {
         cursor->append(obj);
 
         if (cursor->is_complete(cursor_depth)) {
-            filled.push_back(cursor->root(cursor_depth));
+            filled.push_back(cursor->root_memoized(cursor_depth));
             cursor = boost::none;
         }
     } else {
@@ -348,16 +419,129 @@ void IncrementalWitness<Depth, Hash>::append(Hash obj) {
     }
 }
 
+template<size_t Depth, typename Hash>
+void IncrementalWitnessBatch<Depth, Hash>::advance(IncrementalWitness<Depth, Hash>& witness) {
+    const uint64_t end_size = start_size + commitments.size();
+    const uint64_t position = witness.position();
+
+    while (true) {
+        // The subtree the witness fills next: its cursor if it has one,
+        // otherwise the sibling of the next ancestor of the note that is
+        // a left child.
+        size_t depth = witness.cursor ? witness.cursor_depth
+                                      : witness.tree.next_depth(witness.filled.size());
+        uint64_t start = ((position >> depth) + 1) << depth;
+        uint64_t size = start + (witness.cursor ? witness.cursor->size() : 0);
+
+        if (size == end_size) {
+            return;
+        }
+        if (size < start_size || size > end_size ||
+            (start < start_size && size != start_size)) {
+            throw std::runtime_error("witness is not covered by the batch");
+        }
+        if (depth >= Depth) {
+            throw std::runtime_error("tree is full");
+        }
+
+        witness.cached_root = boost::none;
+        witness.cursor_depth = depth;
+        if (start + (uint64_t(1) << depth) <= end_size) {
+            witness.filled.push_back(subtree_root(depth, start, witness.cursor));
+            witness.cursor = boost::none;
+        } else {
+            witness.cursor = partial_subtree(depth, start, witness.cursor);
+            return;
+        }
+    }
+}
+
+// Root of a complete subtree made only of commitments in this batch.
+template<size_t Depth, typename Hash>
+Hash IncrementalWitnessBatch<Depth, Hash>::new_subtree_root(size_t depth, uint64_t start) {
+    if (depth == 0) {
+        return commitments[start - start_size];
+    }
+
+    SubtreeKey key(depth, start);
+    auto it = roots.find(key);
+    if (it != roots.end()) {
+        return it->second;
+    }
+
+    Hash root = Hash::combine(new_subtree_root(depth - 1, start),
+                              new_subtree_root(depth - 1, start + (uint64_t(1) << (depth - 1))),
+                              depth - 1);
+    roots.insert(std::make_pair(key, root));
+    return root;
+}
+
+// Root of a subtree the batch completes. When it started before the batch,
+// the commitments it already had are only known as the witness's cursor,
+// which is the same for every witness waiting on that subtree.
+template<size_t Depth, typename Hash>
+Hash IncrementalWitnessBatch<Depth, Hash>::subtree_root(
+    size_t depth, uint64_t start,
+    const boost::optional<IncrementalMerkleTree<Depth, Hash>>& cursor)
+{
+    if (start >= start_size) {
+        return new_subtree_root(depth, start);
+    }
+
+    SubtreeKey key(depth, start);
+    auto it = roots.find(key);
+    if (it != roots.end()) {
+        return it->second;
+    }
+
+    IncrementalMerkleTree<Depth, Hash> subtree = *cursor;
+    subtree.append_many(std::vector<Hash>(
+        commitments.begin(),
+        commitments.begin() + (start + (uint64_t(1) << depth) - start_size)));
+    Hash root = subtree.root_memoized(depth);
+    roots.insert(std::make_pair(key, root));
+    return root;
+}
+
+// The subtree that is still being filled once the batch is appended.
+template<size_t Depth, typename Hash>
+IncrementalMerkleTree<Depth, Hash> IncrementalWitnessBatch<Depth, Hash>::partial_subtree(
+    size_t depth, uint64_t start,
+    const boost::optional<IncrementalMerkleTree<Depth, Hash>>& cursor)
+{
+    SubtreeKey key(depth, start);
+    auto it = partials.find(key);
+    if (it != partials.end()) {
+        return it->second;
+    }
+
+    IncrementalMerkleTree<Depth, Hash> subtree;
+    if (start < start_size) {
+        subtree = *cursor;
+    }
+    subtree.append_many(std::vector<Hash>(
+        commitments.begin() + (std::max(start, start_size) - start_size),
+        commitments.end()));
+    partials.insert(std::make_pair(key, subtree));
+    return subtree;
+}
+
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
 template class IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
+template class IncrementalWitnessBatch<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
+template class IncrementalWitnessBatch<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
+
 template class IncrementalMerkleTree<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, PedersenHash>;
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, PedersenHash>;
 
 template class IncrementalWitness<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, PedersenHash>;
 template class IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, PedersenHash>;
 
+template class IncrementalWitnessBatch<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, PedersenHash>;
+template class IncrementalWitnessBatch<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, PedersenHash>;
+
 } // end namespace `libzcash`
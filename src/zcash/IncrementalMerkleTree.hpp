@@ -3,6 +3,7 @@
 
 #include <array>
 #include <deque>
+#include <map>
 #include <boost/optional.hpp>
 #include <boost/static_assert.hpp>
 
@@ -82,10 +83,14 @@ bool operator==(const EmptyMerkleRoots<Depth, Hash>& a,
 template<size_t Depth, typename Hash>
 class IncrementalWitness;
 
+template<size_t Depth, typename Hash>
+class IncrementalWitnessBatch;
+
 template<size_t Depth, typename Hash>
 class IncrementalMerkleTree {
 
 friend class IncrementalWitness<Depth, Hash>;
+friend class IncrementalWitnessBatch<Depth, Hash>;
 
 public:
     BOOST_STATIC_ASSERT(Depth >= 1);
@@ -101,8 +106,14 @@ public:
     size_t size() const;
 
     void append(Hash obj);
+    // Appends the elements in order, with the same result as appending them
+    // one at a time, hashing each level of the new subtrees in one pass.
+    void append_many(const std::vector<Hash>& objs);
+    // The root is memoized until the next append, so it is only hashed once
+    // however often a block or a wallet asks for it. Like the rest of the
+    // class this is not safe to call on one tree from several threads.
     Hash root() const {
-        return root(Depth, std::deque<Hash>());
+        return root_memoized(Depth);
     }
     Hash last() const;
 
@@ -119,6 +130,9 @@ public:
         READWRITE(parents);
 
         wfcheck();
+        if (ser_action.ForRead()) {
+            cached_root = boost::none;
+        }
     }
 
     static Hash empty_root() {
@@ -136,8 +150,13 @@ private:
 
     // Collapsed "left" subtrees ordered toward the root of the tree.
     std::vector<boost::optional<Hash>> parents;
+    // The root at depth cached_root_depth, with empty uncles; reset by any
+    // change to the tree.
+    mutable boost::optional<Hash> cached_root;
+    mutable size_t cached_root_depth = 0;
     MerklePath path(std::deque<Hash> filler_hashes = std::deque<Hash>()) const;
     Hash root(size_t depth, std::deque<Hash> filler_hashes = std::deque<Hash>()) const;
+    Hash root_memoized(size_t depth) const;
     bool is_complete(size_t depth = Depth) const;
     size_t next_depth(size_t skip) const;
     void wfcheck() const;
@@ -155,6 +174,7 @@ bool operator==(const IncrementalMerkleTree<Depth, Hash>& a,
 template <size_t Depth, typename Hash>
 class IncrementalWitness {
 friend class IncrementalMerkleTree<Depth, Hash>;
+friend class IncrementalWitnessBatch<Depth, Hash>;
 
 public:
     // Required for Unserialize()
@@ -174,8 +194,12 @@ public:
         return tree.size() - 1;
     }
 
+    // Memoized until the next append, like IncrementalMerkleTree::root().
     Hash root() const {
-        return tree.root(Depth, partial_path());
+        if (!cached_root) {
+            cached_root = tree.root(Depth, partial_path());
+        }
+        return *cached_root;
     }
 
     void append(Hash obj);
@@ -189,6 +213,9 @@ public:
         READWRITE(cursor);
 
         cursor_depth = tree.next_depth(filled.size());
+        if (ser_action.ForRead()) {
+            cached_root = boost::none;
+        }
     }
 
     template <size_t D, typename H>
@@ -200,6 +227,7 @@ private:
     std::vector<Hash> filled;
     boost::optional<IncrementalMerkleTree<Depth, Hash>> cursor;
     size_t cursor_depth = 0;
+    mutable boost::optional<Hash> cached_root;
     std::deque<Hash> partial_path() const;
     IncrementalWitness(IncrementalMerkleTree<Depth, Hash> tree) : tree(tree) {}
 };
@@ -213,6 +241,41 @@ bool operator==(const IncrementalWitness<Depth, Hash>& a,
             a.cursor_depth == b.cursor_depth);
 }
 
+// Brings many witnesses of one tree up to date with the same run of new
+// commitments. Appending them to each witness separately costs a hash per
+// commitment per witness; but all a witness gains from them is the roots of
+// the aligned subtrees to the right of its note, plus at most one partly
+// filled subtree, and those are the same for every witness that needs them.
+// They are computed once here and shared, so advancing a witness only costs
+// a few lookups.
+template<size_t Depth, typename Hash>
+class IncrementalWitnessBatch {
+public:
+    // The commitments appended to a tree that held start_size of them.
+    IncrementalWitnessBatch(uint64_t start_size, const std::vector<Hash>& commitments) :
+        start_size(start_size), commitments(commitments) {}
+
+    // Same as appending to the witness every commitment it is missing. The
+    // witness must cover at least the first start_size commitments of the
+    // tree; if it covers more, the commitments it already holds must be
+    // those of this batch.
+    void advance(IncrementalWitness<Depth, Hash>& witness);
+
+private:
+    typedef std::pair<size_t, uint64_t> SubtreeKey; // depth, first position
+
+    uint64_t start_size;
+    std::vector<Hash> commitments;
+    std::map<SubtreeKey, Hash> roots;
+    std::map<SubtreeKey, IncrementalMerkleTree<Depth, Hash>> partials;
+
+    Hash new_subtree_root(size_t depth, uint64_t start);
+    Hash subtree_root(size_t depth, uint64_t start,
+                      const boost::optional<IncrementalMerkleTree<Depth, Hash>>& cursor);
+    IncrementalMerkleTree<Depth, Hash> partial_subtree(size_t depth, uint64_t start,
+                      const boost::optional<IncrementalMerkleTree<Depth, Hash>>& cursor);
+};
+
 class SHA256Compress : public uint256 {
 public:
     SHA256Compress() : uint256() {}
@@ -254,10 +317,16 @@ typedef libzcash::IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, l
 typedef libzcash::IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress> SproutWitness;
 typedef libzcash::IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::SHA256Compress> SproutTestingWitness;
 
+typedef libzcash::IncrementalWitnessBatch<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress> SproutWitnessBatch;
+typedef libzcash::IncrementalWitnessBatch<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::SHA256Compress> SproutTestingWitnessBatch;
+
 typedef libzcash::IncrementalMerkleTree<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash> SaplingMerkleTree;
 typedef libzcash::IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::PedersenHash> SaplingTestingMerkleTree;
 
 typedef libzcash::IncrementalWitness<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash> SaplingWitness;
 typedef libzcash::IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::PedersenHash> SaplingTestingWitness;
 
+typedef libzcash::IncrementalWitnessBatch<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash> SaplingWitnessBatch;
+typedef libzcash::IncrementalWitnessBatch<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::PedersenHash> SaplingTestingWitnessBatch;
+
 #endif /* ZC_INCREMENTALMERKLETREE_H_ */
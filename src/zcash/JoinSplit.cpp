@@ -29,6 +29,9 @@ namespace libzcash {
 #include "zcash/circuit/gadget.tcc"
 
 static CCriticalSection cs_ParamsIO;
+// libsnark keeps global state while proving, so PHGR proofs are made one at a
+// time even when several async operations run at once
+static CCriticalSection cs_PHGRProve;
 
 template<typename T>
 void saveToFile(const std::string path, T& obj) {
@@ -334,6 +337,8 @@ public:
             return PHGRProof();
         }
 
+        LOCK(cs_PHGRProve);
+
         protoboard<FieldT> pb;
         {
             joinsplit_gadget<FieldT, NumInputs, NumOutputs> g(pb);
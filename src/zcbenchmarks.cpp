@@ -1,4 +1,6 @@
+#include <atomic>
 #include <cstdio>
+#include <functional>
 #include <future>
 #include <map>
 #include <thread>
@@ -165,6 +167,82 @@ double benchmark_verify_joinsplit(const JSDescription &joinsplit)
     return timer_stop(tv_start);
 }
 
+std::vector<double> benchmark_verify_joinsplit_threaded(const JSDescription &joinsplit, int nThreads)
+{
+    std::vector<double> ret;
+    std::vector<std::future<double>> tasks;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nThreads; i++) {
+        std::packaged_task<double(void)> task(std::bind(&benchmark_verify_joinsplit, std::cref(joinsplit)));
+        tasks.emplace_back(task.get_future());
+        threads.emplace_back(std::move(task));
+    }
+    for (auto it = tasks.begin(); it != tasks.end(); it++) {
+        it->wait();
+        ret.push_back(it->get());
+    }
+    for (auto it = threads.begin(); it != threads.end(); it++) {
+        it->join();
+    }
+    return ret;
+}
+
+// Verifies the joinSplitSig of nTxs Sprout transactions split across nThreads
+// threads, the way the proof-check workers verify the signatures collected
+// over a block. Comparing nThreads = 1 against the -par setting shows the
+// speedup of block-level joinSplitSig verification.
+double benchmark_verify_joinsplit_sigs(size_t nTxs, int nThreads)
+{
+    auto consensusBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_SAPLING].nBranchId;
+
+    std::vector<CTransaction> txs;
+    std::vector<uint256> sighashes;
+    for (size_t i = 0; i < nTxs; i++) {
+        CMutableTransaction mtx;
+        mtx.fOverwintered = true;
+        mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+        mtx.nVersion = SAPLING_TX_VERSION;
+        mtx.nLockTime = i;
+
+        JSDescription jsdesc;
+        jsdesc.proof = libzcash::GrothProof();
+        mtx.vjoinsplit.push_back(jsdesc);
+
+        unsigned char joinSplitPrivKey[crypto_sign_SECRETKEYBYTES];
+        crypto_sign_keypair(mtx.joinSplitPubKey.begin(), joinSplitPrivKey);
+
+        CScript scriptCode;
+        CTransaction signTx(mtx);
+        uint256 dataToBeSigned = SignatureHash(scriptCode, signTx, NOT_AN_INPUT, SigHashType(), 0, consensusBranchId);
+        assert(crypto_sign_detached(&mtx.joinSplitSig[0], NULL,
+                                    dataToBeSigned.begin(), 32,
+                                    joinSplitPrivKey) == 0);
+
+        txs.push_back(CTransaction(mtx));
+        sighashes.push_back(dataToBeSigned);
+    }
+
+    std::atomic<size_t> nextTx(0);
+    auto worker = [&]() {
+        CValidationState state;
+        for (size_t i = nextTx++; i < txs.size(); i = nextTx++) {
+            assert(CheckJoinSplitSig(txs[i], sighashes[i], state, 100));
+        }
+    };
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    std::vector<std::thread> threads;
+    for (int i = 1; i < nThreads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto it = threads.begin(); it != threads.end(); it++) {
+        it->join();
+    }
+    return timer_stop(tv_start);
+}
+
 #ifdef ENABLE_MINING
 double benchmark_solve_equihash()
 {
@@ -452,20 +530,22 @@ double benchmark_increment_sapling_note_witnesses(size_t nTxs)
 
 // Fake the input of a given block
 // This class is based on the class CCoinsViewDB, but with limited functionality.
-// The construtor and the functions `GetCoins` and `HaveCoins` come directly from
-// CCoinsViewDB, but the rest are either mocks and/or don't really do anything.
+// The functions `GetCoin` and `HaveCoin` are forwarded to a CCoinsViewDB, but the
+// rest are either mocks and/or don't really do anything.
 class FakeCoinsViewDB : public CCoinsView {
-    // The following constant is a duplicate of the one found in txdb.cpp
-    static constexpr char DB_COINS = 'c';
-
-    CDBWrapper db;
+    CCoinsViewDB db;
 
     uint256 hash;
     SproutMerkleTree sproutTree;
     SaplingMerkleTree saplingTree;
 
 public:
-    FakeCoinsViewDB(std::string dbName, uint256& hash) : db(GetDataDir() / dbName, 100, false, false), hash(hash) {}
+    FakeCoinsViewDB(std::string dbName, uint256& hash) : db(GetDataDir() / dbName, 100, false, false), hash(hash) {
+        // The input database is distributed in the per-transaction format;
+        // convert it in place the first time it is used.
+        if (!db.Upgrade())
+            throw std::runtime_error("Failed to upgrade block input database");
+    }
 
     bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
         if (rt == sproutTree.root()) {
@@ -487,14 +567,12 @@ public:
         return false;
     }
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
-        char key = DB_COINS;
-        return db.Read(std::make_pair(key, txid), coins);
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
+        return db.GetCoin(outpoint, coin);
     }
 
-    bool HaveCoins(const uint256 &txid) const {
-        char key = DB_COINS;
-        return db.Exists(std::make_pair(key, txid));
+    bool HaveCoin(const COutPoint &outpoint) const {
+        return db.HaveCoin(outpoint);
     }
 
     uint256 GetBestBlock() const {
@@ -519,7 +597,8 @@ public:
                     CAnchorsSproutMap &mapSproutAnchors,
                     CAnchorsSaplingMap &mapSaplingAnchors,
                     CNullifiersMap &mapSproutNullifiers,
-                    CNullifiersMap &mapSaplingNullifiers) {
+                    CNullifiersMap &mapSaplingNullifiers,
+                    bool fErase) {
         return false;
     }
 
@@ -583,14 +662,15 @@ double benchmark_sendtoaddress(CAmount amount)
     return timer_stop(tv_start);
 }
 
-double benchmark_loadwallet()
+// nThreads: threads decoding wallet transactions, -1 for the node's setting
+double benchmark_loadwallet(int nThreads)
 {
     pre_wallet_load();
     struct timeval tv_start;
     bool fFirstRunRet=true;
     timer_start(tv_start);
     pwalletMain = new CWallet("wallet.dat");
-    DBErrors nLoadWalletRet = pwalletMain->LoadWallet(fFirstRunRet);
+    DBErrors nLoadWalletRet = pwalletMain->LoadWallet(fFirstRunRet, nThreads);
     auto res = timer_stop(tv_start);
     post_wallet_load();
     return res;
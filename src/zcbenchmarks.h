@@ -11,6 +11,8 @@ extern std::vector<double> benchmark_create_joinsplit_threaded(int nThreads);
 extern double benchmark_solve_equihash();
 extern std::vector<double> benchmark_solve_equihash_threaded(int nThreads);
 extern double benchmark_verify_joinsplit(const JSDescription &joinsplit);
+extern std::vector<double> benchmark_verify_joinsplit_threaded(const JSDescription &joinsplit, int nThreads);
+extern double benchmark_verify_joinsplit_sigs(size_t nTxs, int nThreads);
 extern double benchmark_verify_equihash();
 extern double benchmark_large_tx(size_t nInputs);
 extern double benchmark_try_decrypt_sprout_notes(size_t nAddrs);
@@ -19,7 +21,7 @@ extern double benchmark_increment_sprout_note_witnesses(size_t nTxs);
 extern double benchmark_increment_sapling_note_witnesses(size_t nTxs);
 extern double benchmark_connectblock_slow();
 extern double benchmark_sendtoaddress(CAmount amount);
-extern double benchmark_loadwallet();
+extern double benchmark_loadwallet(int nThreads);
 extern double benchmark_listunspent();
 extern double benchmark_create_sapling_spend();
 extern double benchmark_create_sapling_output();